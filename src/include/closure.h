@@ -0,0 +1,514 @@
+#ifndef CLOSURE_IMPL
+
+#define CLOSURE_IMPL
+
+typedef struct Closure Closure;
+typedef NodeValue (*ClosureFn)(Closure *self, InterpreterState *state);
+
+/// @brief A node compiled into a handler that already knows what the node does.
+///
+/// Everything `traverseAstnode` works out on each visit (the token type, the node type,
+/// which builtin is being called, which slot a variable lives in and what type it has) is
+/// resolved once by `compileClosure`, so running a closure is just a call through `fn`.
+struct Closure {
+    ClosureFn fn;
+
+    NodeValue constant; // the value of a literal
+    int slot; // the variable read or assigned
+    int slot_type;
+    bool global; // whether the slot is a global accessed from inside a function
+    Builtin builtin; // the builtin called
+    FunctionInfo *function; // the user-defined function called
+    Closure *body; // the body of the user-defined function called
+    Token *token; // for error reporting
+
+    Closure *children;
+    int num_children;
+};
+
+/// @brief Runs a closure. Like `traverseAstnode`, the result is a new reference
+#define runClosure(closure, state) (countStep((closure)->token), (closure)->fn((closure), (state)))
+
+NodeValue closureNop(Closure *self, InterpreterState *state) {
+    return value_null;
+}
+
+NodeValue closureConstant(Closure *self, InterpreterState *state) {
+    return self->constant;
+}
+
+/// @brief Returns the slots a closure's variable is in
+#define closureSlots(self, state) ((self)->global ? (state)->stack : (state)->frame)
+
+NodeValue closureVariable(Closure *self, InterpreterState *state) {
+    return slotValue(closureSlots(self, state)[self->slot], self->slot_type);
+}
+
+NodeValue closureObjectVariable(Closure *self, InterpreterState *state) {
+    NodeValue value = slotValue(closureSlots(self, state)[self->slot], self->slot_type);
+
+    retainValue(value);
+
+    return value;
+}
+
+NodeValue closureGroup(Closure *self, InterpreterState *state) {
+    return runClosure(self->children, state);
+}
+
+NodeValue closureBlock(Closure *self, InterpreterState *state) {
+    int i;
+
+    for (i = 0; i < self->num_children; i++) {
+        releaseValue(runClosure(self->children + i, state));
+
+        if (state->returning) {
+            break;
+        }
+    }
+
+    return value_null;
+}
+
+/// @brief Runs the top-level statements, from where a restored snapshot left off, see `closureBlock`
+NodeValue closureRoot(Closure *self, InterpreterState *state) {
+    int i;
+
+    for (i = state->first_statement; i < self->num_children; i++) {
+        releaseValue(runClosure(self->children + i, state));
+
+        if (state->snapshot_requested) {
+            takeSnapshot(state, i + 1);
+        }
+    }
+
+    return value_null;
+}
+
+NodeValue closureWhile(Closure *self, InterpreterState *state) {
+    // The condition is an int or a char, so it's never an Object that needs releasing
+    while (runClosure(self->children, state).i != 0) {
+        releaseValue(runClosure(self->children + 1, state));
+
+        if (state->returning) {
+            break;
+        }
+    }
+
+    return value_null;
+}
+
+NodeValue closureReturn(Closure *self, InterpreterState *state) {
+    state->return_value = self->num_children > 0 ? runClosure(self->children, state) : value_null;
+    state->returning = true;
+
+    return value_null;
+}
+
+NodeValue closureCall(Closure *self, InterpreterState *state) {
+    NodeValue values[self->num_children > 0 ? self->num_children : 1];
+    int i;
+
+    for (i = 0; i < self->num_children; i++) {
+        values[i] = runClosure(self->children + i, state);
+    }
+
+    state->call_token = self->token;
+
+    NodeValue result = self->builtin(state, values, self->num_children);
+
+    for (i = 0; i < self->num_children; i++) {
+        releaseValue(values[i]);
+    }
+
+    return result;
+}
+
+NodeValue closureUserCall(Closure *self, InterpreterState *state) {
+    NodeValue values[self->num_children > 0 ? self->num_children : 1];
+    int i;
+
+    for (i = 0; i < self->num_children; i++) {
+        values[i] = runClosure(self->children + i, state);
+    }
+
+    Slot *caller = pushFrame(state, self->function, values, self->token);
+
+    releaseValue(runClosure(self->body, state));
+
+    NodeValue result = popFrame(state, self->function, caller);
+
+    for (i = 0; i < self->num_children; i++) {
+        releaseValue(values[i]);
+    }
+
+    return result;
+}
+
+NodeValue closureIntIndex(Closure *self, InterpreterState *state) {
+    NodeValue array = runClosure(self->children, state);
+    int index = runClosure(self->children + 1, state).i;
+
+    checkIndex(self->token, array, index);
+
+    int element = arrayInts(array)[index];
+
+    releaseValue(array);
+
+    return (NodeValue){.i = element, .type = Type_int};
+}
+
+NodeValue closureFloatIndex(Closure *self, InterpreterState *state) {
+    NodeValue array = runClosure(self->children, state);
+    int index = runClosure(self->children + 1, state).i;
+
+    checkIndex(self->token, array, index);
+
+    double element = arrayFloats(array)[index];
+
+    releaseValue(array);
+
+    return (NodeValue){.f = element, .type = Type_float};
+}
+
+/// @brief Indexes a `string[]` or a map, whose elements and keys may be Objects
+NodeValue closureElement(Closure *self, InterpreterState *state) {
+    NodeValue container = runClosure(self->children, state);
+    NodeValue index = runClosure(self->children + 1, state);
+    NodeValue element = getElement(self->token, container, index);
+
+    releaseValue(container);
+    releaseValue(index);
+
+    return element;
+}
+
+NodeValue closureIndexAssign(Closure *self, InterpreterState *state) {
+    Closure *target = self->children;
+    NodeValue container = runClosure(target->children, state);
+    NodeValue index = runClosure(target->children + 1, state);
+    NodeValue value = runClosure(self->children + 1, state);
+
+    setElement(target->token, container, index, value);
+    releaseValue(container);
+    releaseValue(index);
+
+    return value;
+}
+
+NodeValue closureNewMap(Closure *self, InterpreterState *state) {
+    NodeValue map = newMap(self->slot_type);
+
+    storeSlot(closureSlots(self, state) + self->slot, map.type, map);
+    releaseValue(map);
+
+    return value_null;
+}
+
+NodeValue closureUnknownCall(Closure *self, InterpreterState *state) {
+    reportUnknownFunction(self->token);
+    return value_null;
+}
+
+NodeValue closureAssign(Closure *self, InterpreterState *state) {
+    NodeValue value = runClosure(self->children, state);
+
+    closureSlots(self, state)[self->slot].loc = value.loc;
+
+    return value;
+}
+
+NodeValue closureObjectAssign(Closure *self, InterpreterState *state) {
+    NodeValue value = runClosure(self->children, state);
+
+    storeSlot(closureSlots(self, state) + self->slot, self->slot_type, value);
+
+    return value;
+}
+
+/// @brief Defines a closure for a binary operator on operands of a known type, so running it doesn't look at the operator or the types
+#define DEFINE_OPERATOR_CLOSURE(name, result_field, result_type, expr) \
+    NodeValue name(Closure *self, InterpreterState *state) { \
+        NodeValue a = runClosure(self->children, state); \
+        NodeValue b = runClosure(self->children + 1, state); \
+        return (NodeValue){.result_field = (expr), .type = result_type}; \
+    }
+
+DEFINE_OPERATOR_CLOSURE(closureIntAdd, i, Type_int, (int)((unsigned int)a.i + (unsigned int)b.i))
+DEFINE_OPERATOR_CLOSURE(closureIntSub, i, Type_int, (int)((unsigned int)a.i - (unsigned int)b.i))
+DEFINE_OPERATOR_CLOSURE(closureIntMul, i, Type_int, (int)((unsigned int)a.i * (unsigned int)b.i))
+DEFINE_OPERATOR_CLOSURE(closureIntLess, i, Type_int, a.i < b.i)
+DEFINE_OPERATOR_CLOSURE(closureIntLessEqual, i, Type_int, a.i <= b.i)
+DEFINE_OPERATOR_CLOSURE(closureIntGreater, i, Type_int, a.i > b.i)
+DEFINE_OPERATOR_CLOSURE(closureIntGreaterEqual, i, Type_int, a.i >= b.i)
+DEFINE_OPERATOR_CLOSURE(closureIntEqual, i, Type_int, a.i == b.i)
+DEFINE_OPERATOR_CLOSURE(closureIntNotEqual, i, Type_int, a.i != b.i)
+DEFINE_OPERATOR_CLOSURE(closureFloatAdd, f, Type_float, a.f + b.f)
+DEFINE_OPERATOR_CLOSURE(closureFloatSub, f, Type_float, a.f - b.f)
+DEFINE_OPERATOR_CLOSURE(closureFloatMul, f, Type_float, a.f * b.f)
+DEFINE_OPERATOR_CLOSURE(closureFloatDiv, f, Type_float, a.f / b.f)
+DEFINE_OPERATOR_CLOSURE(closureFloatLess, i, Type_int, a.f < b.f)
+DEFINE_OPERATOR_CLOSURE(closureFloatGreater, i, Type_int, a.f > b.f)
+
+/// @brief Runs any other binary operator, like int division or concatenating strings
+NodeValue closureBinary(Closure *self, InterpreterState *state) {
+    NodeValue a = runClosure(self->children, state);
+    NodeValue b = runClosure(self->children + 1, state);
+    NodeValue result = binaryOperation(self->token, a, b);
+
+    releaseValue(a);
+    releaseValue(b);
+
+    return result;
+}
+
+NodeValue closureAnd(Closure *self, InterpreterState *state) {
+    return (NodeValue){.i = runClosure(self->children, state).i != 0 && runClosure(self->children + 1, state).i != 0, .type = Type_int};
+}
+
+NodeValue closureOr(Closure *self, InterpreterState *state) {
+    return (NodeValue){.i = runClosure(self->children, state).i != 0 || runClosure(self->children + 1, state).i != 0, .type = Type_int};
+}
+
+NodeValue closureUnary(Closure *self, InterpreterState *state) {
+    return unaryOperation(self->token, runClosure(self->children, state));
+}
+
+/// @brief Picks the closure for a binary operator
+/// @param op The TokenType of the operator
+/// @param type The type of both operands
+ClosureFn operatorClosure(TokenType op, int type) {
+    if (op == Tk_And || op == Tk_Or) {
+        return op == Tk_And ? closureAnd : closureOr;
+    }
+
+    if (type == Type_int || type == Type_char) {
+        switch (op) {
+            case Tk_Plus:
+                return closureIntAdd;
+            case Tk_Minus:
+                return closureIntSub;
+            case Tk_Star:
+                return closureIntMul;
+            case Tk_Less:
+                return closureIntLess;
+            case Tk_LessEqual:
+                return closureIntLessEqual;
+            case Tk_Greater:
+                return closureIntGreater;
+            case Tk_GreaterEqual:
+                return closureIntGreaterEqual;
+            case Tk_Equal:
+                return closureIntEqual;
+            case Tk_NotEqual:
+                return closureIntNotEqual;
+            default:
+                break;
+        }
+    }
+
+    if (type == Type_float) {
+        switch (op) {
+            case Tk_Plus:
+                return closureFloatAdd;
+            case Tk_Minus:
+                return closureFloatSub;
+            case Tk_Star:
+                return closureFloatMul;
+            case Tk_Slash:
+                return closureFloatDiv;
+            case Tk_Less:
+                return closureFloatLess;
+            case Tk_Greater:
+                return closureFloatGreater;
+            default:
+                break;
+        }
+    }
+
+    return closureBinary;
+}
+
+/// @brief Compiles a node and everything under it into closures
+/// @param ast The Ast the node belongs to
+/// @param program The tokens the Ast refers to
+/// @param types What `typecheck` worked out about the program
+/// @param closures The closure array, which has one slot per Ast node
+/// @param node The id of the node to compile
+void compileClosure(Ast *ast, Program program, TypeInfo *types, Closure *closures, int node) {
+    Closure *self = closures + node;
+    Token *token = AstNodeToken(ast, program, node);
+    int i;
+
+    *self = (Closure){
+        .fn = closureNop,
+        .token = token,
+        .slot = types->node_slots[node],
+        .slot_type = types->node_types[node],
+        .global = types->node_globals[node],
+        .children = closures + ast->first_child[node],
+        .num_children = ast->child_count[node]
+    };
+
+    switch (ast->kind[node]) {
+        case Node_Root:
+            self->fn = closureRoot;
+            break;
+
+        case Node_Value:
+            if (token->token_type == Tk_Strliteral) {
+                self->fn = closureConstant;
+                self->constant = stringValue(literalString(token->value));
+            } else if (token->token_type == Tk_Intliteral) {
+                self->fn = closureConstant;
+                self->constant = (NodeValue){.type = Type_int, .i = token->value};
+            } else if (token->token_type == Tk_Floatliteral) {
+                self->fn = closureConstant;
+                self->constant = (NodeValue){.type = Type_float, .f = float_literals.ref[token->value]};
+            } else if (token->token_type == Tk_Charliteral) {
+                self->fn = closureConstant;
+                self->constant = (NodeValue){.type = Type_char, .i = token->value};
+            } else if (token->token_type == Tk_ID) {
+                // Only variables holding Objects need their reference counts touched
+                self->fn = typeIsObject(self->slot_type) ? closureObjectVariable : closureVariable;
+            }
+            return;
+
+        case Node_Expr:
+            if (token->token_type == Tk_Fncall) {
+                // Skip the Node_Args and call with its children directly
+                int args = getChildAst(ast, node, 0);
+
+                if (types->node_functions[node] != -1) {
+                    self->function = types->functions.ref + types->node_functions[node];
+                    self->body = closures + self->function->body;
+                    self->fn = closureUserCall;
+                } else {
+                    self->builtin = findBuiltin(internedStr(token->value));
+                    self->fn = self->builtin != NULL ? closureCall : closureUnknownCall;
+                }
+
+                self->children = closures + ast->first_child[args];
+                self->num_children = ast->child_count[args];
+
+                for (i = 0; i < self->num_children; i++) {
+                    compileClosure(ast, program, types, closures, ast->first_child[args] + i);
+                }
+                return;
+            }
+
+            self->fn = closureGroup;
+            break;
+
+        case Node_Action:
+            if (token->token_type == Tk_Assign && ast->kind[getChildAst(ast, node, 0)] == Node_Index) {
+                // The target is compiled too, but only its children are run
+                self->fn = closureIndexAssign;
+            } else if (token->token_type == Tk_Assign) {
+                self->slot = types->node_slots[getChildAst(ast, node, 0)];
+                self->global = types->node_globals[getChildAst(ast, node, 0)];
+                self->fn = typeIsObject(self->slot_type) ? closureObjectAssign : closureAssign;
+                self->children++;
+                self->num_children = 1;
+            }
+            break;
+
+        case Node_Block:
+            self->fn = closureBlock;
+            break;
+
+        case Node_While:
+            self->fn = closureWhile;
+            break;
+
+        case Node_Return:
+            self->fn = closureReturn;
+            break;
+
+        case Node_Index:
+            if (typeIsMap(types->node_types[ast->first_child[node]]) || self->slot_type == Type_str) {
+                self->fn = closureElement;
+            } else {
+                self->fn = self->slot_type == Type_int ? closureIntIndex : closureFloatIndex;
+            }
+            break;
+
+        case Node_Function:
+            // The function itself does nothing when it's reached, only its body is compiled for calls
+            compileClosure(ast, program, types, closures, getChildAst(ast, node, 2));
+            return;
+
+        case Node_Binary:
+            self->fn = operatorClosure(token->token_type, types->node_types[ast->first_child[node]]);
+            break;
+
+        case Node_Unary:
+            self->fn = closureUnary;
+            break;
+
+        case Node_Declr:
+            // Declaring a map creates an empty one
+            if (typeIsMap(self->slot_type)) {
+                self->fn = closureNewMap;
+            }
+            return;
+
+        case Node_Args:
+        case Node_Import:
+            return;
+    }
+
+    for (i = 0; i < self->num_children; i++) {
+        compileClosure(ast, program, types, closures, self->children - closures + i);
+    }
+
+    // Operators on literals, like `-1` or `60 * 60`, are worked out once. Division is left alone, since it can fail,
+    // and so are strings, since a constant can't own a reference
+    if ((ast->kind[node] == Node_Binary || ast->kind[node] == Node_Unary) && token->token_type != Tk_Slash && token->token_type != Tk_Percent
+        && !typeIsObject(types->node_types[node])) {
+        for (i = 0; i < self->num_children; i++) {
+            if (self->children[i].fn != closureConstant) {
+                return;
+            }
+        }
+
+        self->constant = ast->kind[node] == Node_Unary ? unaryOperation(token, self->children[0].constant)
+                                                       : binaryOperation(token, self->children[0].constant, self->children[1].constant);
+        self->fn = closureConstant;
+    }
+}
+
+/// @brief Compiles a whole Ast into closures
+/// @param ast The parsed program, with the root at node 0
+/// @param program The tokens the Ast refers to
+/// @param types What `typecheck` worked out about the program
+/// @return The closures, with the root closure first
+Closure *compileClosures(Ast *ast, Program program, TypeInfo *types) {
+    Closure *closures = nmalloc(ast->len * sizeof(Closure));
+
+    compileClosure(ast, program, types, closures, 0);
+
+    return closures;
+}
+
+/// @brief Compiles an Ast into closures and runs it. An alternative to `interpretAst`
+/// @param ast The parsed program, with the root at node 0
+/// @param program The tokens the Ast refers to
+/// @param types What `typecheck` worked out about the program
+void runClosureEngine(Ast *ast, Program program, TypeInfo *types) {
+    InterpreterState state = {
+        .program = program,
+        .ast = ast,
+        .types = types
+    };
+
+    Closure *closures = compileClosures(ast, program, types);
+
+    initStack(&state);
+    startUsage();
+    releaseValue(runClosure(closures, &state));
+    freeStack(&state);
+    nfree(closures);
+}
+
+#endif
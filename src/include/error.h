@@ -2,13 +2,40 @@
 
 #define _ERROR_H
 
+#include <setjmp.h>
+
+// Exit codes, so whoever runs a script can tell why it stopped
+#define EXIT_ERROR 1 // a syntax, type or runtime error
+#define EXIT_STEP_LIMIT 3 // ran more steps than `-max-steps` allows
+#define EXIT_MEMORY_LIMIT 4 // allocated more than `-max-memory` allows
+#define EXIT_TIMEOUT 5 // ran longer than `-timeout` allows
+
+// When set, errors jump here instead of exiting, so `-watch` can wait for the next edit
+jmp_buf *error_recovery = NULL;
+
+/// @brief Reports an error and stops, either by jumping to `error_recovery` or by exiting
+/// @param token Where the error happened, or NULL if it isn't tied to a place in the source
+/// @param exit_code The code to exit with
+void reportFatalError(Token *token, char *errorType, char *errorMsg, int exit_code) {
+    if (token != NULL) {
+        fprintf(stderr, "\x1B[31mERROR at %s:\n%s: %s\n\x1B[0m", formatTokenLoc(tokenLoc(token)), errorType, errorMsg);
+    } else {
+        fprintf(stderr, "\x1B[31mERROR:\n%s: %s\n\x1B[0m", errorType, errorMsg);
+    }
+
+    if (error_recovery != NULL) {
+        longjmp(*error_recovery, exit_code);
+    }
+
+    exit(exit_code);
+}
+
 void reportError(Token *token, char *errorType, char *errorMsg) {
-    fprintf(stderr, "\x1B[31mERROR at %s:\n%s: %s\n\x1B[0m", formatTokenLoc(token->loc), errorType, errorMsg);
-    exit(1);
+    reportFatalError(token, errorType, errorMsg, EXIT_ERROR);
 }
 
 void reportWarning(Token *token, char *errorType, char *errorMsg) {
-    fprintf(stderr, "\x1B[33mERROR at %s:\n%s: %s\n\x1B[0m", formatTokenLoc(token->loc), errorType, errorMsg);
+    fprintf(stderr, "\x1B[33mERROR at %s:\n%s: %s\n\x1B[0m", formatTokenLoc(tokenLoc(token)), errorType, errorMsg);
 }
 
 #endif
\ No newline at end of file
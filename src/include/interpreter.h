@@ -2,8 +2,17 @@
 
 #define INTERPRETER_IMPL
 
+#include <sys/resource.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
 typedef struct NodeValue {
-    void* loc;
+    union {
+        void* loc;
+        int i; // Type_int and Type_char values are stored inline
+        double f; // and so are Type_float values
+    };
     enum {
         Type_null,
         Type_float,
@@ -12,187 +21,2718 @@ typedef struct NodeValue {
         Type_char,
         Type_ptr_int,
         Type_ptr_float,
+        Type_ptr_str,
         Type_value,
         Type_symbol
     } type;
 } NodeValue;
 
-typedef struct Variable {
-    char *name;
-    NodeValue *value;
-} Variable;
+/// @brief Runtime memory statistics, see `memStats`
+typedef struct MemStats {
+    long allocations;
+    long frees;
+    long bytes_allocated;
+    long bytes_freed;
+    long live_bytes;
+    long peak_bytes;
+} MemStats;
 
-typedef struct Variables {
-    Variable *start;
-    int len;
-    int capacity;
-} Variables;
+MemStats mem_stats;
 
-typedef struct InterpreterState {
-    char *current_function;
-    bool in_fn_call;
-    Variables vars;
-} InterpreterState;
+// Set while the parallel builtins run the program on more than one thread. Until then, reference counts,
+// `mem_stats` and the step count are updated without atomics or locks
+bool runtime_shared = false;
+pthread_mutex_t runtime_lock = PTHREAD_MUTEX_INITIALIZER; // guards `mem_stats` while `runtime_shared` is set
 
-#define value_null (NodeValue){.loc = NULL, .type = Type_null}
+#define QUOTA_CHECK_INTERVAL 4096 // steps between checks of the limits and the clock
+
+/// @brief Limits on what a program may use, 0 meaning no limit
+typedef struct Quotas {
+    long max_steps; // steps are counted in interpreter dispatches: node visits, closure calls and runs of compiled statements
+    long max_memory; // most bytes the runtime may have allocated at once
+    double timeout; // seconds of wall-clock time
+} Quotas;
+
+Quotas quotas = {0};
+
+/// @brief What the running program has used, apart from memory, which is counted in `mem_stats`
+typedef struct Usage {
+    bool started;
+    double start; // in milliseconds
+    long steps; // steps in the finished batches of every thread, added to atomically
+} Usage;
+
+Usage usage;
+
+// Each thread counts its steps in batches of its own. Counting a step is just a decrement; the limits are only checked
+// when a batch runs out, so the accounting can stay on all the time
+__thread long step_batch; // steps in the current batch
+__thread long quota_countdown = QUOTA_CHECK_INTERVAL; // steps left in the current batch
+__thread Token *step_token = NULL; // the token of the last step counted, for going over the memory limit
+
+/// @brief Counts an interpreter dispatch
+/// @param token The token of what's being run, for the error if it goes over a limit
+#define countStep(token) (step_token = (token), --quota_countdown >= 0 ? (void)0 : checkQuotas(step_token))
+
+/// @brief Returns a monotonic time in milliseconds
+double clockMs() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+/// @brief Starts a new batch of steps, cut short so the step limit falls at its end
+void startStepBatch() {
+    long steps = __atomic_load_n(&usage.steps, __ATOMIC_RELAXED);
+
+    step_batch = QUOTA_CHECK_INTERVAL;
+
+    if (quotas.max_steps > 0 && quotas.max_steps - steps < step_batch) {
+        step_batch = quotas.max_steps - steps > 0 ? quotas.max_steps - steps : 0;
+    }
+
+    quota_countdown = step_batch;
+}
+
+/// @brief Adds the steps of this thread's current batch to `usage` and starts a new batch
+void finishStepBatch() {
+    __atomic_add_fetch(&usage.steps, step_batch - (quota_countdown > 0 ? quota_countdown : 0), __ATOMIC_RELAXED);
+    startStepBatch();
+}
 
-#define VARS_CAPACITY 128
-Variables init_Vars() {
-    Variable  *start = calloc(VARS_CAPACITY, sizeof(Variable));
-    return (Variables){
-        .capacity = VARS_CAPACITY,
-        .len = 0,
-        .start = start
+/// @brief Starts counting what a program uses
+void startUsage() {
+    usage = (Usage){
+        .started = true,
+        .start = clockMs(),
+        .steps = 0
     };
+
+    startStepBatch();
+}
+
+/// @brief Returns how many steps have been run
+long stepsUsed() {
+    return __atomic_load_n(&usage.steps, __ATOMIC_RELAXED) + step_batch - (quota_countdown > 0 ? quota_countdown : 0);
 }
 
-void setVariable(Variables *vars, Variable var) {    
-    if (vars->len >= vars->capacity) {
-        vars->capacity *= 2;
-        vars->start = realloc(vars->start, vars->capacity * sizeof(Variable));
+/// @brief Called by `countStep` when a batch runs out. Stops the program if it's over the step limit or past its deadline
+/// @param token The token of what's being run
+void checkQuotas(Token *token) {
+    char msg[96];
+    long steps = __atomic_add_fetch(&usage.steps, step_batch, __ATOMIC_RELAXED);
+
+    step_batch = 0;
+    quota_countdown = 0;
+
+    if (quotas.max_steps > 0 && steps >= quotas.max_steps) {
+        snprintf(msg, sizeof(msg), "Ran out of steps after %ld.", steps);
+        reportFatalError(token, "QuotaError", msg, EXIT_STEP_LIMIT);
+    }
+
+    if (quotas.timeout > 0 && clockMs() - usage.start > quotas.timeout * 1000) {
+        snprintf(msg, sizeof(msg), "Ran out of time after %gs.", quotas.timeout);
+        reportFatalError(token, "QuotaError", msg, EXIT_TIMEOUT);
     }
 
-    vars->start[vars->len] = var;
-    vars->len++;
+    // The step that ran out the last batch is the first of the next one
+    startStepBatch();
+    quota_countdown--;
 }
 
-NodeValue getVariableValue(Variables *vars, char *name) {
-    for (int i = 0; i < vars->len; i++) {
-        if (streq(name, vars->start[i].name)) {
-            return *(vars->start[i].value);
-        }
+/// @brief Counts `size` more bytes of memory owned by the runtime in `mem_stats`, stopping the program if that goes over the memory limit.
+/// The error points at the token of the last step this thread counted
+void countRuntimeAlloc(size_t size) {
+    if (runtime_shared) {
+        pthread_mutex_lock(&runtime_lock);
     }
 
-    return value_null;
+    if (quotas.max_memory > 0 && mem_stats.live_bytes + (long)size > quotas.max_memory) {
+        char msg[128];
+
+        snprintf(msg, sizeof(msg), "Allocating %ld more bytes would go over the memory limit of %ld bytes.", (long)size, quotas.max_memory);
+        reportFatalError(step_token, "QuotaError", msg, EXIT_MEMORY_LIMIT);
+    }
+
+    mem_stats.allocations++;
+    mem_stats.bytes_allocated += size;
+    mem_stats.live_bytes += size;
+
+    if (mem_stats.live_bytes > mem_stats.peak_bytes) {
+        mem_stats.peak_bytes = mem_stats.live_bytes;
+    }
+
+    if (runtime_shared) {
+        pthread_mutex_unlock(&runtime_lock);
+    }
 }
 
-/// @brief Converts a NodeValue into a string
-/// @param val The NodeValue to convert
-/// @return The NodeValue as a string
-char *valueAsString(NodeValue val) {
-    // printf("type: %d, loc: %p\n", val.type, val.loc);
-    switch (val.type) {
-        case Type_null:
-            return "null";
-        case Type_str:
-            return val.loc;
-        case Type_int:
-            return AstrToStr(fromInt(*(int*)(val.loc)));
-        case Type_value:
-            return valueAsString(*(NodeValue*)val.loc);
-        case Type_char:
-            char *new = malloc(sizeof(char) * 2);
-            new[0] = *(char*)(val.loc);
-            new[1] = '\0';
-            return new;
-        case Type_float:
-            return "TODO: Floats are not supported in valueAsString yet";
-        case Type_ptr_int:
-            return AstrToStr(concat(_Astr("int*: 0x"), fromInt((long)*(int**)(val.loc))));
-        case Type_ptr_float:
-            return AstrToStr(concat(_Astr("float*: 0x"), fromInt((long)*(int**)(val.loc))));
-        case Type_symbol:
-            return valueAsString(*(((Variable*)val.loc)->value));
+/// @brief Allocates memory owned by the runtime (variable storage and Objects), keeping count in `mem_stats`
+void *runtimeAlloc(size_t size) {
+    countRuntimeAlloc(size);
+
+    return nmalloc(size);
+}
+
+/// @brief Frees memory allocated with `runtimeAlloc`
+/// @param ptr The memory to free
+/// @param size The size it was allocated with
+void runtimeFree(void *ptr, size_t size) {
+    if (runtime_shared) {
+        pthread_mutex_lock(&runtime_lock);
+    }
+
+    mem_stats.frees++;
+    mem_stats.bytes_freed += size;
+    mem_stats.live_bytes -= size;
+
+    if (runtime_shared) {
+        pthread_mutex_unlock(&runtime_lock);
     }
 
-    return "TODO";
+    nfree(ptr);
 }
 
-/// @brief Interprets a function call
-/// @param node The AstNode of the function call
-/// @param state The Interpreter state
-/// @param values A list of the values associated with the arguments
-/// @param num_values The number of arguments
-void interpretFunctionCall(AstNode* node, InterpreterState* state, NodeValue values[], int num_values) {
-    if (node->token->values == NULL) {
-        reportError(node->token, "ReferenceError", "Function with an undefined name");
+/// @brief Returns a snapshot of the runtime memory statistics
+MemStats memStats() {
+    return mem_stats;
+}
+
+/// @brief Prints the runtime memory statistics to stderr
+void printMemStats() {
+    MemStats stats = memStats();
+
+    fprintf(stderr, "memory: %ld allocations, %ld frees, %ld bytes allocated, %ld bytes freed, %ld bytes live, %ld bytes peak\n",
+        stats.allocations, stats.frees, stats.bytes_allocated, stats.bytes_freed, stats.live_bytes, stats.peak_bytes);
+}
+
+/// @brief Prints how many steps, how much memory and how much time the program used, and the limits on them, to stderr
+void printUsage() {
+    if (!usage.started) {
+        return;
+    }
+
+    fprintf(stderr, "usage: %ld steps", stepsUsed());
+
+    if (quotas.max_steps > 0) {
+        fprintf(stderr, " (limit %ld)", quotas.max_steps);
+    }
+
+    fprintf(stderr, ", %ld bytes peak memory", mem_stats.peak_bytes);
+
+    if (quotas.max_memory > 0) {
+        fprintf(stderr, " (limit %ld)", quotas.max_memory);
+    }
+
+    fprintf(stderr, ", %.2fms", clockMs() - usage.start);
+
+    if (quotas.timeout > 0) {
+        fprintf(stderr, " (limit %gs)", quotas.timeout);
+    }
+
+    fprintf(stderr, "\n");
+}
+
+#define OBJECT_IMMORTAL -1
+
+/// @brief The header at the start of every heap-allocated runtime value.
+///
+/// Objects are reference counted: whoever stores a value (a variable, a container)
+/// holds a reference, and the Object is freed when the last one is released.
+/// Containers may only hold values that can't refer back to a container, so
+/// references never form cycles and counting alone is enough to free everything.
+/// Objects that live as long as the program (like literals) are OBJECT_IMMORTAL and are never counted.
+typedef struct Object {
+    int refcount;
+    int size; // total size of the allocation, header included
+    void (*finalize)(struct Object *object); // releases whatever the object refers to, may be NULL
+} Object;
+
+/// @brief Allocates an Object with a reference count of 1
+/// @param size The size of the object, header included
+/// @param finalize Called before the object is freed, may be NULL
+/// @return The new object
+Object *newObject(int size, void (*finalize)(Object *object)) {
+    Object *object = runtimeAlloc(size);
+
+    object->refcount = 1;
+    object->size = size;
+    object->finalize = finalize;
+
+    return object;
+}
+
+// Map types aren't in the enum of NodeValue. Each pair of a key type and a value type is its own type, numbered from TYPE_MAP
+#define TYPE_MAP 64
+#define mapType(key_type, value_type) (TYPE_MAP + (key_type) * 16 + (value_type))
+#define typeIsMap(type) ((type) >= TYPE_MAP)
+#define mapKeyType(type) (((type) - TYPE_MAP) / 16)
+#define mapValueType(type) (((type) - TYPE_MAP) % 16)
+
+/// @brief Whether values of a type point at an Object
+#define typeIsObject(type) ((type) == Type_ptr_int || (type) == Type_ptr_float || (type) == Type_ptr_str || (type) == Type_str || typeIsMap(type))
+
+/// @brief Whether a NodeValue points at an Object
+#define valueIsObject(val) typeIsObject((val).type)
+
+/// @brief Takes a new reference to a value
+void retainValue(NodeValue val) {
+    // Immortal objects never change, but other threads may be changing the count of mortal ones, so it's read atomically.
+    // Variables that have been declared but not assigned hold NULL
+    if (!valueIsObject(val) || val.loc == NULL || __atomic_load_n(&((Object*)val.loc)->refcount, __ATOMIC_RELAXED) == OBJECT_IMMORTAL) {
+        return;
+    }
+
+    if (runtime_shared) {
+        __atomic_add_fetch(&((Object*)val.loc)->refcount, 1, __ATOMIC_RELAXED);
+    } else {
+        ((Object*)val.loc)->refcount++;
+    }
+}
+
+/// @brief Drops a reference to a value, freeing it if that was the last one
+void releaseValue(NodeValue val) {
+    if (!valueIsObject(val) || val.loc == NULL) {
+        return;
     }
 
-    if (streq((char*)node->token->values, "print")) {
-        printf("%s\n", valueAsString(*values));
+    Object *object = val.loc;
+
+    if (__atomic_load_n(&object->refcount, __ATOMIC_RELAXED) == OBJECT_IMMORTAL) {
         return;
     }
 
-    char *error_str = "Cannot find function `";
-    strcat(error_str, (char*)node->token->values);
-    strcat(error_str, "`");
+    int refcount = runtime_shared ? __atomic_sub_fetch(&object->refcount, 1, __ATOMIC_ACQ_REL) : --object->refcount;
+
+    if (refcount == 0) {
+        if (object->finalize != NULL) {
+            object->finalize(object);
+        }
 
-    reportError(node->token, "ReferenceError", error_str);
+        runtimeFree(object, object->size);
+    }
 }
 
-/// @brief Traverses an AstNode and performs all necessary interpreting. The core function of the interpreter
-/// @param node The node to traverse
-/// @param state The Interpreter state
-/// @return A NodeValue associated with the node (by default is the value of its children)
-NodeValue traverseAstnode(AstNode* node, InterpreterState* state) {
+#define ARRAY_ALIGN 32 // so every AVX2 block of an array's elements stays inside one cache line
+
+/// @brief An `int[]`, `float[]` or `string[]`. The elements are ints, doubles or pointers to strings, stored in one
+/// contiguous, ARRAY_ALIGN-aligned buffer allocated together with the header. A `string[]` holds a reference to each
+/// of its strings, and NULL elements are empty strings
+typedef struct Array {
+    Object object;
+    int len;
+    void *data;
+} Array;
+
+Array empty_array = {.object = {.refcount = OBJECT_IMMORTAL}, .len = 0, .data = &empty_array};
+
+/// @brief Returns the Array an array value points at. Arrays that have been declared but not assigned are empty
+#define asArray(val) ((val).loc != NULL ? (Array*)(val).loc : &empty_array)
+
+/// @brief Returns the type of the elements of an array type, or of the values of a map type
+#define elementType(type) (typeIsMap(type) ? mapValueType(type) : (type) == Type_ptr_int ? Type_int : (type) == Type_ptr_str ? Type_str : Type_float)
+
+/// @brief Returns the size of the elements of an array type
+#define elementSize(type) ((type) == Type_ptr_int ? sizeof(int) : (type) == Type_ptr_str ? sizeof(void*) : sizeof(double))
+
+#define arrayInts(val) ((int*)asArray(val)->data)
+#define arrayFloats(val) ((double*)asArray(val)->data)
+#define arrayStrings(val) ((struct String**)asArray(val)->data)
+#define arrayLen(val) (asArray(val)->len)
+
+/// @brief Releases the strings of a `string[]`
+void finalizeStringArray(Object *object) {
+    Array *array = (Array*)object;
     int i;
 
-    if (node->token != NULL) {
-        // printf("TT: %s\n", TokenTypeRepr(node->token->token_type));
-        if (node->token->token_type == Tk_Strliteral) {
-            // char *copied = strdup(node->token->values);
-            return (NodeValue){
-                .type = Type_str,
-                .loc = node->token->values
-            };
-        }
+    for (i = 0; i < array->len; i++) {
+        releaseValue((NodeValue){.loc = ((void**)array->data)[i], .type = Type_str});
+    }
+}
 
-        if (node->token->token_type == Tk_Intliteral) {
-            // printf("intlit: %d\n", *(int*)(node->token->values));
-            return (NodeValue){
-                .type = Type_int,
-                .loc = node->token->values
-            };
-        }
-    }   
+/// @brief Allocates a zeroed array
+/// @param type Type_ptr_int, Type_ptr_float or Type_ptr_str
+/// @param len The number of elements, which can't be negative
+/// @return A NodeValue holding the only reference to the new array
+NodeValue newArray(int type, int len) {
+    Array *array = (Array*)newObject(sizeof(Array) + ARRAY_ALIGN + len * elementSize(type), type == Type_ptr_str ? finalizeStringArray : NULL);
 
-    NodeValue *values;
+    array->len = len;
+    array->data = (void*)(((unsigned long)(array + 1) + ARRAY_ALIGN - 1) & ~(unsigned long)(ARRAY_ALIGN - 1));
+    memset(array->data, 0, len * elementSize(type));
 
-    if (node->children.length == 0) {
-        values = malloc(sizeof(NodeValue));
-        *values = (NodeValue){
-            .type = Type_null,
-            .loc = NULL
-        };
+    return (NodeValue){.loc = array, .type = type};
+}
+
+/// @brief Reports an error unless `index` is inside an array
+/// @param token The token of the indexing, for reporting the error
+/// @param array The array
+/// @param index The index
+void checkIndex(Token *token, NodeValue array, int index) {
+    if ((unsigned int)index >= (unsigned int)arrayLen(array)) {
+        Astr error_str = concat(_Astr("Index "), fromInt(index));
+        error_str = concat(error_str, _Astr(" is out of bounds for an array of length "));
+        error_str = concat(error_str, fromInt(arrayLen(array)));
+        error_str = concat(error_str, _Astr("."));
+
+        reportError(token, "RuntimeError", AstrToStr(error_str));
+    }
+}
+
+/// @brief Returns an element of an array, without retaining it. The index has to be checked first
+NodeValue arrayGet(NodeValue array, int index) {
+    if (array.type == Type_ptr_int) {
+        return (NodeValue){.i = arrayInts(array)[index], .type = Type_int};
+    }
+
+    if (array.type == Type_ptr_str) {
+        return (NodeValue){.loc = ((void**)asArray(array)->data)[index], .type = Type_str};
+    }
+
+    return (NodeValue){.f = arrayFloats(array)[index], .type = Type_float};
+}
+
+/// @brief Sets an element of an array. The index has to be checked first, and a `string[]` takes its own reference to `value`
+void arraySet(NodeValue array, int index, NodeValue value) {
+    if (array.type == Type_ptr_int) {
+        arrayInts(array)[index] = value.i;
+    } else if (array.type == Type_ptr_str) {
+        void **element = (void**)asArray(array)->data + index;
+
+        retainValue(value);
+        releaseValue((NodeValue){.loc = *element, .type = Type_str});
+        *element = value.loc;
     } else {
-        values = calloc(node->children.length, sizeof(NodeValue));
+        arrayFloats(array)[index] = value.f;
+    }
+}
+
+#define ROPE_MIN_LEN 256 // concatenations at least this long become ropes instead of being copied
+
+/// @brief A `string`. Strings are immutable, so they share their characters wherever they can:
+/// a slice points into the characters of the string it was taken from, and a long concatenation is a rope
+/// that only refers to its two halves until its characters are needed, when it's flattened into a buffer of its own.
+/// The characters aren't NUL-terminated
+typedef struct String {
+    Object object;
+    int len;
+    char *chars; // the first character, or NULL for a rope that hasn't been flattened yet
+    struct String *base; // the string whose allocation holds `chars`, or NULL if this one does or they're never freed
+
+    // The halves of a rope, until it's flattened
+    struct String *left;
+    struct String *right;
+} String;
+
+DEFINE_VEC(Strings, String*)
+
+String empty_string = {.object = {.refcount = OBJECT_IMMORTAL}, .len = 0, .chars = ""};
+
+Strings string_literals; // the immortal string of every string literal, indexed by intern id
+
+// Guards flattening ropes while `runtime_shared` is set, since several threads may need the characters of the same rope
+pthread_mutex_t string_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// @brief Returns the String a Type_str value points at. Strings that have been declared but not assigned are empty
+#define asString(val) ((val).loc != NULL ? (String*)(val).loc : &empty_string)
+
+/// @brief Returns a Type_str value holding a string
+#define stringValue(string) ((NodeValue){.loc = (string), .type = Type_str})
+
+__thread Strings strings_to_release; // the halves of ropes being freed, see `finalizeString`
+__thread bool releasing_strings = false;
+
+/// @brief Releases what a string refers to. Ropes can be arbitrarily deep, so the strings they refer to are released
+/// one at a time in a loop rather than by recursing
+void finalizeString(Object *object) {
+    String *string = (String*)object;
+    String *parts[3] = {string->base, string->left, string->right};
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (parts[i] != NULL) {
+            Strings_push(&strings_to_release, parts[i]);
+        }
+    }
+
+    if (releasing_strings) {
+        return;
+    }
+
+    releasing_strings = true;
+
+    while (strings_to_release.len > 0) {
+        releaseValue(stringValue(Strings_pop(&strings_to_release)));
+    }
+
+    releasing_strings = false;
+}
+
+/// @brief Allocates a string with room for `len` characters of its own
+/// @return The new string, holding the only reference to it
+String *newString(int len) {
+    String *string = (String*)newObject(sizeof(String) + len + 1, finalizeString);
+
+    string->len = len;
+    string->chars = (char*)(string + 1);
+    string->chars[len] = '\0'; // so a copy can be handed to C functions as it is
+    string->base = string->left = string->right = NULL;
+
+    return string;
+}
+
+/// @brief Frees the buffer a string made by `newBufferString` took over
+void finalizeBufferString(Object *object) {
+    String *string = (String*)object;
+
+    runtimeFree(string->chars, string->len + 1);
+    finalizeString(object);
+}
+
+/// @brief Creates a string that takes over a NUL-terminated buffer allocated with `nmalloc`, like what an I/O operation read,
+/// and counts the buffer as runtime memory from then on. The buffer is freed with the string, and slices keep it alive
+/// @return The new string, holding the only reference to it
+String *newBufferString(char *chars, int len) {
+    String *string = (String*)newObject(sizeof(String), finalizeBufferString);
+
+    countRuntimeAlloc(len + 1);
+
+    string->len = len;
+    string->chars = chars;
+    string->base = string->left = string->right = NULL;
+
+    return string;
+}
+
+/// @brief Returns the immortal string of a string literal, creating it the first time. Once a program starts,
+/// `initStringLiterals` has created all of them, so threads only ever read `string_literals`
+/// @param id The intern id of the literal's text
+String *literalString(int id) {
+    while (string_literals.len <= id) {
+        Strings_push(&string_literals, NULL);
     }
 
-    for (i = 0; i < node->children.length; i++) {
-        values[i] = traverseAstnode(getChildAst(*node, i), state);
+    if (string_literals.ref[id] == NULL) {
+        String *string = nmalloc(sizeof(String));
+
+        *string = (String){
+            .object = {.refcount = OBJECT_IMMORTAL, .size = sizeof(String)},
+            .len = interned.strs.ref[id].len,
+            .chars = internedStr(id)
+        };
+
+        string_literals.ref[id] = string;
     }
 
-    if (node->token != NULL) {
-        if (node->token->token_type == Tk_Fncall) {
-            // printf("calling: %p, %s\n", values, (char*)(node->token->values));
-            interpretFunctionCall(node, state, values, node->children.length);
+    return string_literals.ref[id];
+}
+
+/// @brief Creates the strings of every string literal in a program
+void initStringLiterals(Program program) {
+    int i;
+
+    for (i = 0; i < program.len; i++) {
+        if (program.ref[i].token_type == Tk_Strliteral) {
+            literalString(program.ref[i].value);
         }
+    }
+}
+
+/// @brief Copies the characters of a rope into a buffer of its own, and lets go of its halves
+/// @return The characters
+char *flattenString(String *string) {
+    if (runtime_shared) {
+        pthread_mutex_lock(&string_lock);
+    }
+
+    // Another thread may have flattened it while this one waited
+    if (string->chars == NULL) {
+        String *buffer = newString(string->len);
+        Strings pending = Strings_new(16);
+        int len = 0;
+
+        // The halves are copied from left to right with a stack instead of recursion, since ropes can be deep
+        Strings_push(&pending, string);
 
-        else if (node->node_type == Node_Action) {
-            if (node->token->token_type == Tk_Assign) {
-                setVariable(&(state->vars), (Variable){.name = "TESTNAME", .value = values});
+        while (pending.len > 0) {
+            String *part = Strings_pop(&pending);
+
+            if (part->chars == NULL) {
+                Strings_push(&pending, part->right);
+                Strings_push(&pending, part->left);
+            } else {
+                memcpy(buffer->chars + len, part->chars, part->len);
+                len += part->len;
             }
         }
+
+        Strings_free(&pending);
+
+        String *left = string->left;
+        String *right = string->right;
+
+        string->base = buffer;
+        string->left = string->right = NULL;
+        __atomic_store_n(&string->chars, buffer->chars, __ATOMIC_RELEASE);
+
+        releaseValue(stringValue(left));
+        releaseValue(stringValue(right));
     }
 
-    int type = Type_value;
+    if (runtime_shared) {
+        pthread_mutex_unlock(&string_lock);
+    }
 
-    return (NodeValue){
-        .type = type,
-        .loc = values
-    };
+    return string->chars;
+}
+
+/// @brief Returns the characters of a string, flattening it first if it's a rope
+char *stringChars(String *string) {
+    char *chars = __atomic_load_n(&string->chars, __ATOMIC_ACQUIRE);
+
+    return chars != NULL ? chars : flattenString(string);
+}
+
+/// @brief Returns a NUL-terminated copy of a string, allocated with `nmalloc`
+char *stringToCStr(String *string) {
+    return nstrndup(stringChars(string), string->len);
+}
+
+/// @brief Concatenates two strings. Short results are copied, longer ones become a rope of the two halves,
+/// so building a long string piece by piece takes linear time
+/// @param token The token of the `+`, for reporting a result that's too long
+/// @return A new reference to the result
+String *concatStrings(Token *token, String *a, String *b) {
+    if (a->len == 0 || b->len == 0) {
+        String *result = a->len == 0 ? b : a;
+
+        retainValue(stringValue(result));
+        return result;
+    }
+
+    if (a->len > INT_MAX - b->len) {
+        reportError(token, "RuntimeError", "The concatenated string would be too long, strings can have at most 2147483647 characters.");
+    }
+
+    if (a->len + b->len < ROPE_MIN_LEN) {
+        String *result = newString(a->len + b->len);
+
+        memcpy(result->chars, stringChars(a), a->len);
+        memcpy(result->chars + a->len, stringChars(b), b->len);
+
+        return result;
+    }
+
+    String *rope = (String*)newObject(sizeof(String), finalizeString);
+
+    retainValue(stringValue(a));
+    retainValue(stringValue(b));
+
+    rope->len = a->len + b->len;
+    rope->chars = NULL;
+    rope->base = NULL;
+    rope->left = a;
+    rope->right = b;
+
+    return rope;
+}
+
+/// @brief Takes the characters from `start` up to, but not including, `end` of a string, without copying them.
+/// The range has to be inside the string
+/// @return A new reference to the slice
+String *sliceString(String *string, int start, int end) {
+    if (start == 0 && end == string->len) {
+        retainValue(stringValue(string));
+        return string;
+    }
+
+    char *chars = stringChars(string);
+    String *base = string->base != NULL ? string->base : string;
+    String *slice = (String*)newObject(sizeof(String), finalizeString);
+
+    // The slice keeps the allocation that holds its characters alive, not the string it was taken from
+    retainValue(stringValue(base));
+
+    slice->len = end - start;
+    slice->chars = chars + start;
+    slice->base = base;
+    slice->left = slice->right = NULL;
+
+    return slice;
+}
+
+/// @brief Returns whether two strings have the same characters
+bool stringsEqual(String *a, String *b) {
+    return a == b || (a->len == b->len && memcmp(stringChars(a), stringChars(b), a->len) == 0);
+}
+
+/// @brief Finds the first occurence of one string in another, starting at an index
+/// @return The index of `needle` in `string`, or -1 if it isn't there
+int findString(String *string, String *needle, int from) {
+    int found = findBytes(stringChars(string) + from, string->len - from, stringChars(needle), needle->len);
+
+    return found == -1 ? -1 : from + found;
+}
+
+/// @brief Finds where every occurence of a non-empty string in another starts. Occurences don't overlap
+/// @param positions Where the indices are pushed to
+void findAllStrings(String *string, String *needle, IntVec *positions) {
+    int found = 0;
+
+    while ((found = findString(string, needle, found)) != -1) {
+        IntVec_push(positions, found);
+        found += needle->len;
+    }
+}
+
+/// @brief The storage of a variable. A slot holds only the payload of a value, since the
+/// type checker has already worked out the type every variable will always have
+typedef union Slot {
+    void *loc;
+    int i; // Type_int and Type_char
+    double f; // Type_float
+} Slot;
+
+_Static_assert(sizeof(Slot) == sizeof(void*), "Slots are copied through `loc`");
+
+/// @brief The layout of a user-defined function's frame
+typedef struct FunctionInfo {
+    int node; // the Node_Function
+    int body; // the Node_Block
+    int return_type;
+    int num_params;
+
+    ByteVec slot_types; // the type of each slot in the frame, parameters first
+} FunctionInfo;
+
+DEFINE_VEC(FunctionInfos, FunctionInfo)
+
+/// @brief What the type checker worked out about a program, see `typecheck`
+typedef struct TypeInfo {
+    unsigned char *node_types; // the type of the value of each node, indexed by node id
+    int *node_slots; // the slot of the variable each node reads, assigns or declares, or -1
+    unsigned char *node_globals; // whether the slot of a node is a global read or assigned from inside a function
+    int *node_functions; // the user-defined function each call calls, or -1 for builtins
+
+    ByteVec slot_types; // the type of each global slot
+    FunctionInfos functions;
+    int max_frame_slots; // the size of the largest function frame
+} TypeInfo;
+
+#define MAX_CALL_DEPTH 1000
+#define MAX_CALL_DEPTH_LIMIT 1000000 // the most -max-depth allows, the frame stack is allocated for the whole depth up front
+#define NATIVE_STACK_MARGIN (256 * 1024) // bytes of the C stack kept free for builtins and error reporting
+
+int max_call_depth = MAX_CALL_DEPTH;
+
+typedef struct InterpreterState {
+    // One block holding every frame. The globals are the bottom frame, and each call
+    // pushes the callee's slots right above its caller's, so calls never allocate
+    Slot *stack;
+    Slot *frame; // the slots of the running function (the globals at the top level)
+    Slot *frame_top; // where the next frame will start
+    int depth;
+
+    Token *call_token; // the call of the running builtin, for reporting errors
+
+    bool returning; // set by `return` until the function call has finished unwinding
+    NodeValue return_value;
+
+    // The engines recurse on the C stack for each call, so deep recursion has to stop before it runs out
+    char *native_stack_base;
+    long native_stack_limit;
+
+    Program program;
+    Ast *ast;
+    TypeInfo *types;
+
+    struct JitState *jit; // NULL when the JIT is disabled
+
+    // What each node of the tree walker has specialized itself into, see NodeVariant. Shared by the workers of parallel builtins
+    unsigned char *node_variants;
+    struct BuiltinEntry **node_builtins; // the builtin each Variant_BuiltinCall node calls
+
+    int first_statement; // the top-level statement the run starts at, which is only 0 if it isn't resuming a snapshot
+    bool snapshot_requested; // set by `snapshot()`, so an image is written once the top-level statement finishes
+} InterpreterState;
+
+/// @brief Where runs start. Restoring a snapshot moves it to where the snapshot was taken, see snapshot.h
+typedef struct StartPoint {
+    Slot *globals; // the values the globals start with, or NULL for zeroes
+    int first_statement;
+} StartPoint;
+
+StartPoint start_point = {0};
+
+char *snapshot_path = NULL; // where `snapshot()` writes an image to, or NULL to ignore it
+
+void takeSnapshot(InterpreterState *state, int resume_at);
+
+#define value_null (NodeValue){.loc = NULL, .type = Type_null}
+
+/// @brief Reads a slot as a NodeValue of the slot's type, without retaining it
+#define slotValue(slot, slot_type) ((NodeValue){.loc = (slot).loc, .type = (slot_type)})
+
+#include "map.h"
+
+/// @brief Returns the slots a node's variable is in: the globals or the running function's frame
+#define nodeSlots(state, node) ((state)->types->node_globals[node] ? (state)->stack : (state)->frame)
+
+/// @brief The number of slots the frame stack of a program needs
+long stackSize(TypeInfo *types) {
+    return types->slot_types.len + (long)max_call_depth * types->max_frame_slots + 1;
+}
+
+/// @brief Releases the Objects held by a frame's slots
+/// @param frame The frame
+/// @param slot_types The type of each slot in the frame
+void releaseFrame(Slot *frame, ByteVec *slot_types) {
+    int i;
+
+    for (i = 0; i < slot_types->len; i++) {
+        if (typeIsObject(slot_types->ref[i]) && frame[i].loc != NULL) {
+            releaseValue(slotValue(frame[i], slot_types->ref[i]));
+        }
+    }
+}
+
+/// @brief Allocates the frame stack of a program, with the globals of `start_point` at the bottom, and sets every node to Variant_Generic
+/// @param state The Interpreter state, whose `ast` and `types` are already set
+void initStack(InterpreterState *state) {
+    TypeInfo *types = state->types;
+
+    state->stack = runtimeAlloc(stackSize(types) * sizeof(Slot));
+    state->node_variants = ncalloc(state->ast->len, sizeof(unsigned char));
+    state->node_builtins = ncalloc(state->ast->len, sizeof(struct BuiltinEntry*));
+
+    if (start_point.globals != NULL) {
+        memcpy(state->stack, start_point.globals, types->slot_types.len * sizeof(Slot));
+    } else {
+        memset(state->stack, 0, types->slot_types.len * sizeof(Slot));
+    }
+
+    initStringLiterals(state->program);
+
+    state->first_statement = start_point.first_statement;
+    state->snapshot_requested = false;
+
+    state->frame = state->stack;
+    state->frame_top = state->stack + types->slot_types.len;
+    state->depth = 0;
+    state->returning = false;
+    state->return_value = value_null;
+
+    struct rlimit limit;
+    char here;
+
+    state->native_stack_base = &here;
+    state->native_stack_limit = 8L * 1024 * 1024 - NATIVE_STACK_MARGIN;
+
+    if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        state->native_stack_limit = (long)limit.rlim_cur - NATIVE_STACK_MARGIN;
+    }
+}
+
+/// @brief Releases the globals of a program and frees its frame stack and node variants
+void freeStack(InterpreterState *state) {
+    releaseFrame(state->stack, &(state->types->slot_types));
+    runtimeFree(state->stack, stackSize(state->types) * sizeof(Slot));
+    nfree(state->node_variants);
+    nfree(state->node_builtins);
+}
+
+/// @brief Stores a value in a slot. The slot takes its own reference to `value`.
+/// Functions run by parallel builtins can't assign globals (see `checkParallelCallbacks`), so only one thread ever stores into a slot
+/// @param slot The slot to store into
+/// @param slot_type The type of the slot, which `value` has to have
+/// @param value The new value
+void storeSlot(Slot *slot, int slot_type, NodeValue value) {
+    if (typeIsObject(slot_type)) {
+        retainValue(value);
+
+        if (slot->loc != NULL) {
+            releaseValue(slotValue(*slot, slot_type));
+        }
+    }
+
+    slot->loc = value.loc;
+}
+
+/// @brief Pushes the frame of a call to a user-defined function and stores the arguments in it
+/// @param state The Interpreter state
+/// @param function The function being called
+/// @param args The arguments, which the type checker has matched to the parameters
+/// @param token The token of the call, for reporting a stack overflow
+/// @return The caller's frame, to give to `popFrame`
+Slot *pushFrame(InterpreterState *state, FunctionInfo *function, NodeValue args[], Token *token) {
+    Slot *caller = state->frame;
+    Slot *frame = state->frame_top;
+    char here;
+    int i;
+
+    if (state->depth >= max_call_depth || state->native_stack_base - &here > state->native_stack_limit) {
+        Astr error_str = concat(_Astr("Stack overflow after "), fromInt(state->depth));
+        error_str = concat(error_str, _Astr(" nested calls."));
+
+        reportError(token, "RuntimeError", AstrToStr(error_str));
+    }
+
+    memset(frame, 0, function->slot_types.len * sizeof(Slot));
+
+    for (i = 0; i < function->num_params; i++) {
+        storeSlot(frame + i, function->slot_types.ref[i], args[i]);
+    }
+
+    state->frame = frame;
+    state->frame_top = frame + function->slot_types.len;
+    state->depth++;
+
+    return caller;
+}
+
+/// @brief Pops the frame of a finished call, releasing its locals
+/// @param state The Interpreter state
+/// @param function The function that was called
+/// @param caller The frame `pushFrame` returned
+/// @return The returned value, which the caller of `popFrame` owns
+NodeValue popFrame(InterpreterState *state, FunctionInfo *function, Slot *caller) {
+    NodeValue result = state->return_value;
+
+    releaseFrame(state->frame, &(function->slot_types));
+
+    state->frame_top = state->frame;
+    state->frame = caller;
+    state->depth--;
+
+    state->returning = false;
+    state->return_value = value_null;
+
+    return result;
+}
+
+#define PRINT_BUFFER_SIZE 4096
+
+/// @brief Formats a NodeValue into a buffer, without allocating
+/// @param out The buffer to format into
+/// @param val The NodeValue to format
+void formatValue(FormatBuffer *out, NodeValue val) {
+    int i;
+
+    switch (val.type) {
+        case Type_null:
+            formatBytes(out, "null", 4);
+            return;
+        case Type_str:
+            formatBytes(out, stringChars(asString(val)), asString(val)->len);
+            return;
+        case Type_int:
+            formatIntTo(out, val.i);
+            return;
+        case Type_value:
+            formatValue(out, *(NodeValue*)val.loc);
+            return;
+        case Type_char:
+            formatBytes(out, (char*)&val.i, 1);
+            return;
+        case Type_float:
+            formatDoubleTo(out, val.f);
+            return;
+        case Type_ptr_int:
+        case Type_ptr_float:
+        case Type_ptr_str:
+            formatBytes(out, "[", 1);
+
+            for (i = 0; i < arrayLen(val); i++) {
+                if (i > 0) {
+                    formatBytes(out, ", ", 2);
+                }
+
+                formatValue(out, arrayGet(val, i));
+            }
+
+            formatBytes(out, "]", 1);
+            return;
+        default:
+            if (typeIsMap(val.type)) {
+                Map *map = val.loc;
+                bool first = true;
+
+                formatBytes(out, "{", 1);
+                lockMaps();
+
+                for (i = 0; map != NULL && i < map->capacity; i++) {
+                    if (map->ctrl[i] >= 0) {
+                        if (!first) {
+                            formatBytes(out, ", ", 2);
+                        }
+
+                        formatValue(out, mapKey(map, i));
+                        formatBytes(out, ": ", 2);
+                        formatValue(out, mapValue(map, i));
+                        first = false;
+                    }
+                }
+
+                unlockMaps();
+                formatBytes(out, "}", 1);
+                return;
+            }
+
+            formatBytes(out, "<value at ", 10);
+            formatPointerTo(out, val.loc);
+            formatBytes(out, ">", 1);
+            return;
+    }
+}
+
+typedef NodeValue (*Builtin)(InterpreterState* state, NodeValue values[], int num_values);
+
+/// @brief The `print` builtin. Prints its first argument to stdout
+NodeValue builtinPrint(InterpreterState* state, NodeValue values[], int num_values) {
+    char buf[PRINT_BUFFER_SIZE];
+    FormatBuffer out = {.ref = buf, .len = 0, .capacity = sizeof(buf), .flush_to = stdout};
+
+    formatValue(&out, num_values > 0 ? values[0] : value_null);
+    formatBytes(&out, "\n", 1);
+    formatFlush(&out);
+
+    return value_null;
+}
+
+/// @brief Prints an int the way `print` does, for calls the tree walker has specialized, see Variant_PrintInt
+void printInt(int value) {
+    char buf[FORMAT_INT_MAX + 1];
+    FormatBuffer out = {.ref = buf, .len = 0, .capacity = sizeof(buf), .flush_to = stdout};
+
+    formatIntTo(&out, value);
+    formatBytes(&out, "\n", 1);
+    formatFlush(&out);
+}
+
+/// @brief Returns the map a value holds, reporting an error if it's a map variable whose declaration hasn't run yet
+/// @param token Where to report the error
+Map *valueMap(Token *token, NodeValue map) {
+    if (map.loc == NULL) {
+        reportError(token, "RuntimeError", "The map is used before its declaration has run.");
+    }
+
+    return map.loc;
+}
+
+/// @brief Reports that a key isn't in a map
+/// @param token The token of the indexing
+void reportMissingKey(Token *token, NodeValue key) {
+    char buf[64];
+    FormatBuffer out = {.ref = buf, .len = 0, .capacity = sizeof(buf) - 1, .flush_to = NULL};
+    char *quote = key.type == Type_str ? "\"" : key.type == Type_char ? "'" : "";
+
+    formatBytes(&out, quote, strlen(quote));
+    formatValue(&out, key);
+    formatBytes(&out, quote, strlen(quote));
+    buf[out.len] = '\0';
+
+    Astr error_str = concat(_Astr("Key "), _Astr(buf));
+    error_str = concat(error_str, _Astr(" is not in the map."));
+
+    reportError(token, "RuntimeError", AstrToStr(error_str));
+}
+
+/// @brief Reads an element of an array, or the value of a key of a map
+/// @param token The token of the indexing, for reporting errors
+/// @param container The array or map
+/// @param index The index or key
+/// @return A new reference to the element
+NodeValue getElement(Token *token, NodeValue container, NodeValue index) {
+    NodeValue value;
+
+    if (typeIsMap(container.type)) {
+        Map *map = valueMap(token, container);
+        bool found;
+
+        // Another thread could replace the value as soon as the lock is released, so it's retained first
+        lockMaps();
+        value = mapGet(map, index, &found);
+        retainValue(value);
+        unlockMaps();
+
+        if (!found) {
+            reportMissingKey(token, index);
+        }
+
+        return value;
+    }
+
+    checkIndex(token, container, index.i);
+    value = arrayGet(container, index.i);
+    retainValue(value);
+
+    return value;
+}
+
+/// @brief Sets an element of an array, or the value of a key of a map, which takes its own reference to `value`
+/// @param token The token of the indexing, for reporting errors
+void setElement(Token *token, NodeValue container, NodeValue index, NodeValue value) {
+    if (typeIsMap(container.type)) {
+        Map *map = valueMap(token, container);
+
+        lockMaps();
+        mapSet(map, index, value);
+        unlockMaps();
+    } else {
+        checkIndex(token, container, index.i);
+        arraySet(container, index.i, value);
+    }
+}
+
+/// @brief Reports an error in a builtin at the call that's running it
+void reportBuiltinError(InterpreterState *state, char *errorMsg) {
+    reportError(state->call_token, "RuntimeError", errorMsg);
+}
+
+/// @brief Reports an error unless two arrays have the same length
+void checkSameLength(InterpreterState *state, NodeValue a, NodeValue b) {
+    if (arrayLen(a) != arrayLen(b)) {
+        reportBuiltinError(state, "The arrays have different lengths.");
+    }
+}
+
+/// @brief Reports an error if an array is empty
+void checkNotEmpty(InterpreterState *state, NodeValue a) {
+    if (arrayLen(a) == 0) {
+        reportBuiltinError(state, "The array is empty.");
+    }
+}
+
+/// @brief Creates the array of zeros the `ints` and `floats` builtins return
+NodeValue builtinNewArray(InterpreterState* state, NodeValue values[], int num_values, int type) {
+    if (values[0].i < 0) {
+        reportBuiltinError(state, "Arrays can't have a negative length.");
+    }
+
+    return newArray(type, values[0].i);
+}
+
+NodeValue builtinInts(InterpreterState* state, NodeValue values[], int num_values) {
+    return builtinNewArray(state, values, num_values, Type_ptr_int);
+}
+
+NodeValue builtinFloats(InterpreterState* state, NodeValue values[], int num_values) {
+    return builtinNewArray(state, values, num_values, Type_ptr_float);
+}
+
+/// @brief The `len` builtin. Returns the length of an array or a string, or the number of keys of a map
+NodeValue builtinLen(InterpreterState* state, NodeValue values[], int num_values) {
+    if (values[0].type == Type_str) {
+        return (NodeValue){.i = asString(values[0])->len, .type = Type_int};
+    }
+
+    if (typeIsMap(values[0].type)) {
+        Map *map = valueMap(state->call_token, values[0]);
+
+        lockMaps();
+
+        int len = map->len;
+
+        unlockMaps();
+
+        return (NodeValue){.i = len, .type = Type_int};
+    }
+
+    return (NodeValue){.i = arrayLen(values[0]), .type = Type_int};
+}
+
+/// @brief The `slice` builtin. Returns the characters of a string from one index up to, but not including, another,
+/// sharing them with the string
+NodeValue builtinSlice(InterpreterState* state, NodeValue values[], int num_values) {
+    String *string = asString(values[0]);
+    int start = values[1].i;
+    int end = values[2].i;
+
+    if (start < 0 || end < start || end > string->len) {
+        Astr error_str = concat(_Astr("Cannot slice "), fromInt(start));
+        error_str = concat(error_str, _Astr(" to "));
+        error_str = concat(error_str, fromInt(end));
+        error_str = concat(error_str, _Astr(" out of a string of length "));
+        error_str = concat(error_str, fromInt(string->len));
+        error_str = concat(error_str, _Astr("."));
+
+        reportBuiltinError(state, AstrToStr(error_str));
+    }
+
+    return stringValue(sliceString(string, start, end));
+}
+
+/// @brief Reports an error if a string is empty
+void checkNotEmptyString(InterpreterState *state, String *string, char *what) {
+    if (string->len == 0) {
+        reportBuiltinError(state, AstrToStr(concat(_Astr(what), _Astr(" can't be empty."))));
+    }
+}
+
+/// @brief The `find` builtin. Returns the index of the first occurence of the second string in the first, or -1
+NodeValue builtinFind(InterpreterState* state, NodeValue values[], int num_values) {
+    return (NodeValue){.i = findString(asString(values[0]), asString(values[1]), 0), .type = Type_int};
+}
+
+/// @brief The `count` builtin. Returns how many times the second string occurs in the first, without overlapping
+NodeValue builtinCount(InterpreterState* state, NodeValue values[], int num_values) {
+    String *string = asString(values[0]);
+    String *needle = asString(values[1]);
+    int count = 0;
+    int found = 0;
+
+    // An empty string occurs before every character and at the end
+    if (needle->len == 0) {
+        return (NodeValue){.i = string->len + 1, .type = Type_int};
+    }
+
+    while ((found = findString(string, needle, found)) != -1) {
+        count++;
+        found += needle->len;
+    }
+
+    return (NodeValue){.i = count, .type = Type_int};
+}
+
+/// @brief The `starts_with` builtin. Returns whether the first string starts with the second
+NodeValue builtinStartsWith(InterpreterState* state, NodeValue values[], int num_values) {
+    String *string = asString(values[0]);
+    String *prefix = asString(values[1]);
+    bool starts = prefix->len <= string->len && memcmp(stringChars(string), stringChars(prefix), prefix->len) == 0;
+
+    return (NodeValue){.i = starts, .type = Type_int};
+}
+
+/// @brief Whether a character is whitespace, for `trim`
+#define isSpace(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r' || (c) == '\v' || (c) == '\f')
+
+/// @brief The `trim` builtin. Returns a string without the whitespace at its start and end, sharing its characters
+NodeValue builtinTrim(InterpreterState* state, NodeValue values[], int num_values) {
+    String *string = asString(values[0]);
+    char *chars = stringChars(string);
+    int start = 0;
+    int end = string->len;
+
+    while (start < end && isSpace(chars[start])) {
+        start++;
+    }
+
+    while (end > start && isSpace(chars[end - 1])) {
+        end--;
+    }
+
+    return stringValue(sliceString(string, start, end));
+}
+
+/// @brief The `split` builtin. Returns the parts of the first string between occurences of the second,
+/// as slices that share the first string's characters
+NodeValue builtinSplit(InterpreterState* state, NodeValue values[], int num_values) {
+    String *string = asString(values[0]);
+    String *separator = asString(values[1]);
+    IntVec positions = IntVec_new(16);
+    int start = 0;
+    int i;
+
+    checkNotEmptyString(state, separator, "The separator");
+    findAllStrings(string, separator, &positions);
+
+    NodeValue parts = newArray(Type_ptr_str, positions.len + 1);
+
+    for (i = 0; i < positions.len; i++) {
+        arrayStrings(parts)[i] = sliceString(string, start, positions.ref[i]);
+        start = positions.ref[i] + separator->len;
+    }
+
+    arrayStrings(parts)[positions.len] = sliceString(string, start, string->len);
+    IntVec_free(&positions);
+
+    return parts;
+}
+
+/// @brief The `replace` builtin. Returns the first string with every occurence of the second replaced by the third
+NodeValue builtinReplace(InterpreterState* state, NodeValue values[], int num_values) {
+    String *string = asString(values[0]);
+    String *old = asString(values[1]);
+    String *new = asString(values[2]);
+    IntVec positions = IntVec_new(16);
+    int start = 0;
+    int len = 0;
+    int i;
+
+    checkNotEmptyString(state, old, "The string to replace");
+    findAllStrings(string, old, &positions);
+
+    if (positions.len == 0) {
+        IntVec_free(&positions);
+        retainValue(values[0]);
+
+        return stringValue(string);
+    }
+
+    long result_len = string->len + (long)positions.len * (new->len - old->len);
+
+    if (result_len > INT_MAX) {
+        IntVec_free(&positions);
+        reportBuiltinError(state, "The result is too long for a string.");
+    }
+
+    String *result = newString(result_len);
+    char *chars = stringChars(string);
+    char *new_chars = stringChars(new);
+
+    for (i = 0; i < positions.len; i++) {
+        memcpy(result->chars + len, chars + start, positions.ref[i] - start);
+        len += positions.ref[i] - start;
+        memcpy(result->chars + len, new_chars, new->len);
+        len += new->len;
+        start = positions.ref[i] + old->len;
+    }
+
+    memcpy(result->chars + len, chars + start, string->len - start);
+    IntVec_free(&positions);
+
+    return stringValue(result);
+}
+
+/// @brief The `fill` builtin. Sets every element of an array to a value
+NodeValue builtinFill(InterpreterState* state, NodeValue values[], int num_values) {
+    if (values[0].type == Type_ptr_int) {
+        fillInts(arrayInts(values[0]), arrayLen(values[0]), values[1].i);
+    } else {
+        fillFloats(arrayFloats(values[0]), arrayLen(values[0]), values[1].f);
+    }
+
+    return value_null;
+}
+
+/// @brief The `sum` builtin. Returns the sum of the elements of an array
+NodeValue builtinSum(InterpreterState* state, NodeValue values[], int num_values) {
+    if (values[0].type == Type_ptr_int) {
+        return (NodeValue){.i = sumInts(arrayInts(values[0]), arrayLen(values[0])), .type = Type_int};
+    }
+
+    return (NodeValue){.f = sumFloats(arrayFloats(values[0]), arrayLen(values[0])), .type = Type_float};
+}
+
+/// @brief The `min` builtin. Returns the smallest element of a non-empty array
+NodeValue builtinMin(InterpreterState* state, NodeValue values[], int num_values) {
+    checkNotEmpty(state, values[0]);
+
+    if (values[0].type == Type_ptr_int) {
+        return (NodeValue){.i = minInts(arrayInts(values[0]), arrayLen(values[0])), .type = Type_int};
+    }
+
+    return (NodeValue){.f = minFloats(arrayFloats(values[0]), arrayLen(values[0])), .type = Type_float};
+}
+
+/// @brief The `max` builtin. Returns the largest element of a non-empty array
+NodeValue builtinMax(InterpreterState* state, NodeValue values[], int num_values) {
+    checkNotEmpty(state, values[0]);
+
+    if (values[0].type == Type_ptr_int) {
+        return (NodeValue){.i = maxInts(arrayInts(values[0]), arrayLen(values[0])), .type = Type_int};
+    }
+
+    return (NodeValue){.f = maxFloats(arrayFloats(values[0]), arrayLen(values[0])), .type = Type_float};
+}
+
+/// @brief The `dot` builtin. Returns the dot product of two arrays of the same length
+NodeValue builtinDot(InterpreterState* state, NodeValue values[], int num_values) {
+    checkSameLength(state, values[0], values[1]);
+
+    if (values[0].type == Type_ptr_int) {
+        return (NodeValue){.i = dotInts(arrayInts(values[0]), arrayInts(values[1]), arrayLen(values[0])), .type = Type_int};
+    }
+
+    return (NodeValue){.f = dotFloats(arrayFloats(values[0]), arrayFloats(values[1]), arrayLen(values[0])), .type = Type_float};
+}
+
+/// @brief The `add` builtin. Sets each element of the first array to the sum of the elements of the other two
+NodeValue builtinAdd(InterpreterState* state, NodeValue values[], int num_values) {
+    checkSameLength(state, values[0], values[1]);
+    checkSameLength(state, values[0], values[2]);
+
+    if (values[0].type == Type_ptr_int) {
+        addInts(arrayInts(values[0]), arrayInts(values[1]), arrayInts(values[2]), arrayLen(values[0]));
+    } else {
+        addFloats(arrayFloats(values[0]), arrayFloats(values[1]), arrayFloats(values[2]), arrayLen(values[0]));
+    }
+
+    return value_null;
+}
+
+/// @brief The `mul` builtin. Sets each element of the first array to the product of the elements of the other two
+NodeValue builtinMul(InterpreterState* state, NodeValue values[], int num_values) {
+    checkSameLength(state, values[0], values[1]);
+    checkSameLength(state, values[0], values[2]);
+
+    if (values[0].type == Type_ptr_int) {
+        mulInts(arrayInts(values[0]), arrayInts(values[1]), arrayInts(values[2]), arrayLen(values[0]));
+    } else {
+        mulFloats(arrayFloats(values[0]), arrayFloats(values[1]), arrayFloats(values[2]), arrayLen(values[0]));
+    }
+
+    return value_null;
+}
+
+/// @brief The `copy` builtin. Copies the elements of the second array into the first
+NodeValue builtinCopy(InterpreterState* state, NodeValue values[], int num_values) {
+    checkSameLength(state, values[0], values[1]);
+
+    // memmove is already vectorized, and the arrays may be the same one
+    memmove(asArray(values[0])->data, asArray(values[1])->data, arrayLen(values[0]) * elementSize(values[0].type));
+
+    return value_null;
+}
+
+/// @brief The `has` builtin. Returns whether a key is in a map
+NodeValue builtinHas(InterpreterState* state, NodeValue values[], int num_values) {
+    Map *map = valueMap(state->call_token, values[0]);
+    bool found;
+
+    lockMaps();
+    mapGet(map, values[1], &found);
+    unlockMaps();
+
+    return (NodeValue){.i = found, .type = Type_int};
+}
+
+/// @brief The `get` builtin. Returns the value of a key in a map, or the third argument if the key isn't in it
+NodeValue builtinGet(InterpreterState* state, NodeValue values[], int num_values) {
+    Map *map = valueMap(state->call_token, values[0]);
+    bool found;
+
+    lockMaps();
+
+    NodeValue value = mapGet(map, values[1], &found);
+
+    value = found ? value : values[2];
+    retainValue(value);
+    unlockMaps();
+
+    return value;
+}
+
+/// @brief The `delete` builtin. Removes a key from a map, and returns whether it was in it
+NodeValue builtinDelete(InterpreterState* state, NodeValue values[], int num_values) {
+    Map *map = valueMap(state->call_token, values[0]);
+
+    lockMaps();
+
+    bool deleted = mapDelete(map, values[1]);
+
+    unlockMaps();
+
+    return (NodeValue){.i = deleted, .type = Type_int};
+}
+
+/// @brief Copies the keys or the values of a map into a new array, or a string for chars, in the order they're in the table
+NodeValue mapColumn(InterpreterState *state, NodeValue map_value, bool keys) {
+    Map *map = valueMap(state->call_token, map_value);
+    int type = keys ? mapKeyType(map->type) : mapValueType(map->type);
+    NodeValue column;
+    int len = 0;
+    int i;
+
+    lockMaps();
+
+    if (type == Type_char) {
+        column = stringValue(newString(map->len));
+    } else {
+        column = newArray(mapColumnType(type), map->len);
+    }
+
+    for (i = 0; i < map->capacity; i++) {
+        if (map->ctrl[i] >= 0 && type == Type_char) {
+            asString(column)->chars[len++] = (keys ? map->entries[i].key : map->entries[i].value).i;
+        } else if (map->ctrl[i] >= 0) {
+            arraySet(column, len++, keys ? mapKey(map, i) : mapValue(map, i));
+        }
+    }
+
+    unlockMaps();
+
+    return column;
+}
+
+/// @brief The `keys` builtin. Returns the keys of a map
+NodeValue builtinKeys(InterpreterState* state, NodeValue values[], int num_values) {
+    return mapColumn(state, values[0], true);
+}
+
+/// @brief The `values` builtin. Returns the values of a map, in the same order as `keys`
+NodeValue builtinValues(InterpreterState* state, NodeValue values[], int num_values) {
+    return mapColumn(state, values[0], false);
+}
+
+/// @brief The `snapshot` builtin. When an image was asked for with `-snapshot`, the program
+/// stops after the running top-level statement and its state is written to the image
+NodeValue builtinSnapshot(InterpreterState* state, NodeValue values[], int num_values) {
+    state->snapshot_requested = snapshot_path != NULL;
+
+    return value_null;
+}
+
+/// @brief Reports an error if a file builtin is called from a function a parallel builtin is running
+void checkNotShared(InterpreterState *state) {
+    if (runtime_shared) {
+        reportBuiltinError(state, "Files can't be used inside a parallel builtin.");
+    }
+}
+
+/// @brief Returns the file an id returned by `open` refers to, reporting an error if there is none
+IoFile *builtinFile(InterpreterState *state, NodeValue id) {
+    checkNotShared(state);
+
+    if ((unsigned int)id.i >= (unsigned int)io_files.len) {
+        reportBuiltinError(state, AstrToStr(concat(_Astr("There is no open file with id "), fromInt(id.i))));
+    }
+
+    return io_files.ref[id.i];
+}
+
+/// @brief Waits for the operation an id refers to, reporting an error if there is none or if it failed
+/// @return The operation
+IoOp *builtinAwaitOp(InterpreterState *state, NodeValue id) {
+    checkNotShared(state);
+
+    if ((unsigned int)id.i >= (unsigned int)io_ops.len) {
+        reportBuiltinError(state, AstrToStr(concat(_Astr("There is no I/O operation with id "), fromInt(id.i))));
+    }
+
+    IoOp *op = io_ops.ref[id.i];
+
+    ioAwait(op);
+
+    if (op->error != 0) {
+        Astr error_str = concat(_Astr(op->kind == Io_Write ? "Could not write " : "Could not read "), _Astr(op->file->path));
+        error_str = concat(error_str, _Astr(": "));
+        error_str = concat(error_str, _Astr(strerror(op->error)));
+
+        reportError(state->call_token, "IOError", AstrToStr(error_str));
+    }
+
+    // The first time a read is awaited, what it read becomes a string, which the operation keeps a reference to
+    // until the program ends. This is when the buffer starts counting towards the memory limit
+    if (op->kind != Io_Write && op->text == NULL) {
+        if (op->len >= INT_MAX) {
+            Astr error_str = concat(_Astr("Could not read "), _Astr(op->file->path));
+            error_str = concat(error_str, _Astr(": it's too big to be a string"));
+
+            reportError(state->call_token, "IOError", AstrToStr(error_str));
+        }
+
+        op->text = newBufferString(op->data, op->len);
+        op->data = NULL;
+    }
+
+    return op;
+}
+
+/// @brief Queues an operation on the file an id refers to
+/// @return The id of the operation
+NodeValue builtinQueue(InterpreterState *state, NodeValue id, IoOpKind kind, char *data) {
+    IoFile *file = builtinFile(state, id);
+
+    // The first operation decides whether the file is opened for reading or for writing
+    if (file->num_ops == 0) {
+        file->writing = kind == Io_Write;
+    }
+
+    if (file->writing != (kind == Io_Write)) {
+        reportBuiltinError(state, AstrToStr(concat(_Astr(file->writing ? "Cannot read a file that is being written: " : "Cannot write a file that is being read: "), _Astr(file->path))));
+    }
+
+    return (NodeValue){.i = ioQueue(kind, file, data), .type = Type_int};
+}
+
+/// @brief The `open` builtin. Returns the id of a file, which is opened by the first operation on it
+NodeValue builtinOpen(InterpreterState* state, NodeValue values[], int num_values) {
+    checkNotShared(state);
+
+    // The file frees this copy of the path when the program ends
+    return (NodeValue){.i = ioFile(stringToCStr(asString(values[0]))), .type = Type_int};
+}
+
+/// @brief The `read_all` builtin. Starts reading a whole file and returns the id of the operation
+NodeValue builtinReadAll(InterpreterState* state, NodeValue values[], int num_values) {
+    return builtinQueue(state, values[0], Io_ReadAll, NULL);
+}
+
+/// @brief The `read_lines` builtin. Starts reading a file line by line and returns the id of the operation
+NodeValue builtinReadLines(InterpreterState* state, NodeValue values[], int num_values) {
+    return builtinQueue(state, values[0], Io_ReadLines, NULL);
+}
+
+/// @brief The `write` builtin. Starts writing a string after everything already written to a file, and returns the id of the operation
+NodeValue builtinWrite(InterpreterState* state, NodeValue values[], int num_values) {
+    // The write runs on another thread, so it gets a copy of the string that it can keep until it's done
+    return builtinQueue(state, values[0], Io_Write, stringToCStr(asString(values[1])));
+}
+
+/// @brief The `await` builtin. Waits for an operation and returns the number of lines it read
+/// for `read_lines`, otherwise the number of bytes it read or wrote
+NodeValue builtinAwait(InterpreterState* state, NodeValue values[], int num_values) {
+    IoOp *op = builtinAwaitOp(state, values[0]);
+
+    return (NodeValue){.i = op->kind == Io_ReadLines ? op->lines.len : (int)op->len, .type = Type_int};
+}
+
+/// @brief The `text` builtin. Waits for a `read_all` and returns what it read
+NodeValue builtinText(InterpreterState* state, NodeValue values[], int num_values) {
+    IoOp *op = builtinAwaitOp(state, values[0]);
+
+    if (op->kind != Io_ReadAll) {
+        reportBuiltinError(state, "`text` needs the id of a `read_all`.");
+    }
+
+    // The operation keeps its own reference, so `text` can be called again
+    retainValue(stringValue(op->text));
+
+    return stringValue(op->text);
+}
+
+/// @brief The `line` builtin. Waits for a `read_lines` and returns one of the lines it read
+NodeValue builtinLine(InterpreterState* state, NodeValue values[], int num_values) {
+    IoOp *op = builtinAwaitOp(state, values[0]);
+
+    if (op->kind != Io_ReadLines) {
+        reportBuiltinError(state, "`line` needs the id of a `read_lines`.");
+    }
+
+    if ((unsigned int)values[1].i >= (unsigned int)op->lines.len) {
+        Astr error_str = concat(_Astr("Line "), fromInt(values[1].i));
+        error_str = concat(error_str, _Astr(" is out of bounds for a file of "));
+        error_str = concat(error_str, fromInt(op->lines.len));
+        error_str = concat(error_str, _Astr(" lines."));
+
+        reportBuiltinError(state, AstrToStr(error_str));
+    }
+
+    // Lines were NUL-terminated in place when they were split, and are slices of what was read
+    int start = op->lines.ref[values[1].i];
+
+    return stringValue(sliceString(op->text, start, start + strlen(op->text->chars + start)));
+}
+
+/// @brief Waits for every I/O operation, so no write is lost when the program ends, then frees them and what they read
+void finishIo() {
+    int i;
+
+    ioAwaitAll();
+
+    for (i = 0; i < io_ops.len; i++) {
+        if (io_ops.ref[i]->text != NULL) {
+            releaseValue(stringValue(io_ops.ref[i]->text));
+        }
+    }
+
+    freeIo();
+}
+
+NodeValue traverseAstnode(int node, InterpreterState* state);
+
+/// @brief Calls a user-defined function
+/// @param state The Interpreter state
+/// @param function The function
+/// @param args The arguments, which the caller still owns
+/// @param token The token of the call, for reporting a stack overflow
+/// @return The value returned by the function, which the caller owns
+NodeValue callFunction(InterpreterState *state, FunctionInfo *function, NodeValue args[], Token *token) {
+    Slot *caller = pushFrame(state, function, args, token);
+
+    releaseValue(traverseAstnode(function->body, state));
+
+    return popFrame(state, function, caller);
+}
+
+/// @brief Finds a user-defined function by name. The type checker has made sure the function exists
+FunctionInfo *namedFunction(InterpreterState *state, String *name) {
+    int id = internAstr((Astr){.str_ref = stringChars(name), .len = name->len});
+    FunctionInfo *function;
+
+    vecForEach(&state->types->functions, function) {
+        if (AstNodeToken(state->ast, state->program, function->node)->value == id) {
+            return function;
+        }
+    }
+
+    return NULL;
+}
+
+// Without a chunk size, the work is split into this many chunks. It doesn't depend on the number of cores,
+// so reductions combine their elements in the same order on every machine
+#define PARALLEL_CHUNKS 256
+
+typedef enum ParallelKind {
+    Parallel_Map,
+    Parallel_Reduce,
+    Parallel_For
+} ParallelKind;
+
+/// @brief A call of a parallel builtin, split into chunks of indices that run on the work pool
+typedef struct ParallelCall {
+    ParallelKind kind;
+    InterpreterState *caller;
+    FunctionInfo *function;
+
+    int start; // the first index of a Parallel_For
+    int len; // the number of indices
+    int chunk_size;
+    int num_chunks;
+
+    NodeValue dst; // the array a Parallel_Map stores into
+    NodeValue src; // the array a Parallel_Map or a Parallel_Reduce reads
+    NodeValue *partials; // the result of each chunk of a Parallel_Reduce
+
+    // The state of each worker, set up by the first chunk it runs. The globals are shared,
+    // but each worker pushes frames onto a stack of its own, and runs without the JIT
+    InterpreterState workers[POOL_MAX_WORKERS];
+    Slot *stacks[POOL_MAX_WORKERS];
+} ParallelCall;
+
+/// @brief Returns the state a worker runs a parallel call's function with
+InterpreterState *parallelWorker(ParallelCall *call, int worker) {
+    InterpreterState *state = call->workers + worker;
+    TypeInfo *types = call->caller->types;
+    char here;
+
+    if (call->stacks[worker] != NULL) {
+        return state;
+    }
+
+    call->stacks[worker] = runtimeAlloc(((long)max_call_depth * types->max_frame_slots + 1) * sizeof(Slot));
+
+    *state = *call->caller;
+    state->frame_top = call->stacks[worker];
+    state->jit = NULL;
+    state->returning = false;
+    state->return_value = value_null;
+
+    // Worker 0 is the thread that made the call, which is already some way into its native stack
+    if (worker != 0) {
+        state->depth = 0;
+        state->native_stack_base = &here;
+        state->native_stack_limit = POOL_STACK_SIZE - NATIVE_STACK_MARGIN;
+    }
+
+    return state;
+}
+
+void runParallelChunk(void *context, int chunk, int worker) {
+    ParallelCall *call = context;
+    InterpreterState *state = parallelWorker(call, worker);
+    Token *token = call->caller->call_token;
+    int first = chunk * call->chunk_size;
+    int end = call->len - first < call->chunk_size ? call->len : first + call->chunk_size;
+    NodeValue args[2];
+    int i;
+
+    // Pool threads count their steps chunk by chunk
+    if (worker != 0) {
+        startStepBatch();
+    }
+
+    switch (call->kind) {
+        case Parallel_Map:
+            for (i = first; i < end; i++) {
+                args[0] = arrayGet(call->src, i);
+                arraySet(call->dst, i, callFunction(state, call->function, args, token));
+            }
+            break;
+
+        case Parallel_Reduce:
+            // Each chunk is folded from left to right, starting with its first element
+            args[0] = arrayGet(call->src, first);
+
+            for (i = first + 1; i < end; i++) {
+                args[1] = arrayGet(call->src, i);
+                args[0] = callFunction(state, call->function, args, token);
+            }
+
+            call->partials[chunk] = args[0];
+            break;
+
+        case Parallel_For:
+            for (i = first; i < end; i++) {
+                args[0] = (NodeValue){.i = call->start + i, .type = Type_int};
+                releaseValue(callFunction(state, call->function, args, token));
+            }
+            break;
+    }
+
+    if (worker != 0) {
+        finishStepBatch();
+    }
+}
+
+/// @brief Runs a parallel call on the work pool
+/// @param name The name of the function to run
+/// @param chunk_size The number of indices in each chunk, or 0 or less to split the work into PARALLEL_CHUNKS chunks
+void runParallel(InterpreterState *state, ParallelCall *call, String *name, int chunk_size) {
+    bool was_shared = runtime_shared;
+    int i;
+
+    call->caller = state;
+    call->function = namedFunction(state, name);
+    call->chunk_size = chunk_size > 0 ? chunk_size : (call->len + PARALLEL_CHUNKS - 1) / PARALLEL_CHUNKS;
+
+    if (call->chunk_size < 1) {
+        call->chunk_size = 1;
+    }
+
+    call->num_chunks = (int)(((long)call->len + call->chunk_size - 1) / call->chunk_size);
+
+    if (call->kind == Parallel_Reduce) {
+        call->partials = nmalloc(call->num_chunks * sizeof(NodeValue));
+    }
+
+    // Only the outermost parallel call switches between sharing and not, since nested ones run while other workers read the flag
+    if (!was_shared) {
+        runtime_shared = true;
+    }
+
+    runChunks(call->num_chunks, runParallelChunk, call);
+
+    if (!was_shared) {
+        runtime_shared = false;
+    }
+
+    for (i = 0; i < POOL_MAX_WORKERS; i++) {
+        if (call->stacks[i] != NULL) {
+            runtimeFree(call->stacks[i], ((long)max_call_depth * state->types->max_frame_slots + 1) * sizeof(Slot));
+        }
+    }
+}
+
+/// @brief The `parallel_map` builtin. Sets each element of the first array to the function
+/// named by the third argument applied to the same element of the second array
+NodeValue builtinParallelMap(InterpreterState* state, NodeValue values[], int num_values) {
+    ParallelCall call = {.kind = Parallel_Map, .dst = values[0], .src = values[1], .len = arrayLen(values[0])};
+
+    checkSameLength(state, values[0], values[1]);
+    runParallel(state, &call, asString(values[2]), values[3].i);
+
+    return value_null;
+}
+
+/// @brief The `parallel_reduce` builtin. Combines the elements of an array with the function named by the
+/// second argument. Chunks are reduced in parallel and their results combined from left to right,
+/// so for a given chunk size the elements are always combined in the same order
+NodeValue builtinParallelReduce(InterpreterState* state, NodeValue values[], int num_values) {
+    ParallelCall call = {.kind = Parallel_Reduce, .src = values[0], .len = arrayLen(values[0])};
+    NodeValue args[2];
+    int i;
+
+    checkNotEmpty(state, values[0]);
+    runParallel(state, &call, asString(values[1]), values[2].i);
+
+    args[0] = call.partials[0];
+
+    for (i = 1; i < call.num_chunks; i++) {
+        args[1] = call.partials[i];
+        args[0] = callFunction(state, call.function, args, state->call_token);
+    }
+
+    nfree(call.partials);
+
+    return args[0];
+}
+
+/// @brief The `parallel_for` builtin. Calls the function named by the third argument with every int
+/// from the first argument up to, but not including, the second, in no particular order
+NodeValue builtinParallelFor(InterpreterState* state, NodeValue values[], int num_values) {
+    long len = (long)values[1].i - values[0].i;
+    ParallelCall call = {.kind = Parallel_For, .start = values[0].i, .len = len > 0 ? (int)len : 0};
+
+    runParallel(state, &call, asString(values[2]), values[3].i);
+
+    return value_null;
+}
+
+#define RETURNS_ELEMENT -1 // the return type of a builtin that returns an element of its first argument, or a value of a map
+#define RETURNS_KEYS -2 // the return type of a builtin that returns the keys of its first argument, see `mapColumnType`
+#define RETURNS_VALUES -3 // the return type of a builtin that returns the values of its first argument
+
+typedef struct BuiltinEntry {
+    char *name;
+    Builtin fn;
+    int return_type; // what the type checker assumes a call returns, or RETURNS_ELEMENT, RETURNS_KEYS or RETURNS_VALUES
+
+    // One character per parameter, which the type checker checks arguments against:
+    // `i` an int, `s` a string, `F` a function (see `callback`), `A` an `int[]` or `float[]`, `L` an array, a string or a map, `M` a map, `S` the same type as the first argument,
+    // `E` the element type of the first argument (the value type for maps), `K` the key type of the first argument, `V` a value of any type
+    char *params;
+
+    // For builtins with an `F` parameter, a string literal naming a user-defined function: the type the function
+    // returns and then the types it takes, where `E` and `e` are the element types of the first and second
+    // arguments and `*` in place of the return type means any
+    char *callback;
+} BuiltinEntry;
+
+BuiltinEntry builtins[] = {
+    {"print", builtinPrint, Type_null, "V"},
+    {"ints", builtinInts, Type_ptr_int, "i"},
+    {"floats", builtinFloats, Type_ptr_float, "i"},
+    {"len", builtinLen, Type_int, "L"},
+    {"slice", builtinSlice, Type_str, "sii"},
+    {"find", builtinFind, Type_int, "ss"},
+    {"count", builtinCount, Type_int, "ss"},
+    {"starts_with", builtinStartsWith, Type_int, "ss"},
+    {"trim", builtinTrim, Type_str, "s"},
+    {"split", builtinSplit, Type_ptr_str, "ss"},
+    {"replace", builtinReplace, Type_str, "sss"},
+    {"fill", builtinFill, Type_null, "AE"},
+    {"sum", builtinSum, RETURNS_ELEMENT, "A"},
+    {"min", builtinMin, RETURNS_ELEMENT, "A"},
+    {"max", builtinMax, RETURNS_ELEMENT, "A"},
+    {"dot", builtinDot, RETURNS_ELEMENT, "AS"},
+    {"add", builtinAdd, Type_null, "ASS"},
+    {"mul", builtinMul, Type_null, "ASS"},
+    {"copy", builtinCopy, Type_null, "AS"},
+    {"has", builtinHas, Type_int, "MK"},
+    {"get", builtinGet, RETURNS_ELEMENT, "MKE"},
+    {"delete", builtinDelete, Type_int, "MK"},
+    {"keys", builtinKeys, RETURNS_KEYS, "M"},
+    {"values", builtinValues, RETURNS_VALUES, "M"},
+    {"snapshot", builtinSnapshot, Type_null, ""},
+    {"open", builtinOpen, Type_int, "s"},
+    {"read_all", builtinReadAll, Type_int, "i"},
+    {"read_lines", builtinReadLines, Type_int, "i"},
+    {"write", builtinWrite, Type_int, "is"},
+    {"await", builtinAwait, Type_int, "i"},
+    {"text", builtinText, Type_str, "i"},
+    {"line", builtinLine, Type_str, "ii"},
+    {"parallel_map", builtinParallelMap, Type_null, "AAFi", "Ee"},
+    {"parallel_reduce", builtinParallelReduce, RETURNS_ELEMENT, "AFi", "EEE"},
+    {"parallel_for", builtinParallelFor, Type_null, "iiFi", "*i"}
+};
+
+/// @brief Looks up the entry of a builtin function by name
+/// @param name The name of the function
+/// @return The entry, or NULL if there is no builtin called `name`
+BuiltinEntry *findBuiltinEntry(char *name) {
+    int i;
+
+    for (i = 0; i < (int)(sizeof(builtins) / sizeof(BuiltinEntry)); i++) {
+        if (streq(builtins[i].name, name)) {
+            return builtins + i;
+        }
+    }
+
+    return NULL;
+}
+
+/// @brief Looks up a builtin function by name
+/// @param name The name of the function
+/// @return The builtin, or NULL if there is no builtin called `name`
+Builtin findBuiltin(char *name) {
+    BuiltinEntry *entry = findBuiltinEntry(name);
+
+    return entry != NULL ? entry->fn : NULL;
+}
+
+/// @brief Reports that a called function doesn't exist
+/// @param token The token of the function call
+void reportUnknownFunction(Token *token) {
+    Astr error_str = concat(_Astr("Cannot find function `"), _Astr(internedStr(token->value)));
+    error_str = concat(error_str, _Astr("`"));
+
+    reportError(token, "ReferenceError", AstrToStr(error_str));
+}
+
+/// @brief Interprets a function call
+/// @param node The id of the function call's node
+/// @param state The Interpreter state
+/// @param values A list of the values associated with the arguments
+/// @param num_values The number of arguments
+/// @return The value returned by the function
+NodeValue interpretFunctionCall(int node, InterpreterState* state, NodeValue values[], int num_values) {
+    Token *token = AstNodeToken(state->ast, state->program, node);
+    int function = state->types->node_functions[node];
+
+    if (function != -1) {
+        return callFunction(state, state->types->functions.ref + function, values, token);
+    }
+
+    Builtin builtin = findBuiltin(internedStr(token->value));
+
+    if (builtin == NULL) {
+        reportUnknownFunction(token);
+    }
+
+    state->call_token = token;
+
+    return builtin(state, values, num_values);
+}
+
+/// @brief Divides two ints, or takes the remainder. Like the other int arithmetic, dividing the smallest int by -1 wraps around
+/// @param token The token of the operator, for reporting a division by zero
+int intDivide(Token *token, int a, int b) {
+    if (b == 0) {
+        reportError(token, "RuntimeError", "Division by zero.");
+    }
+
+    if (b == -1) {
+        return token->token_type == Tk_Slash ? (int)-(unsigned int)a : 0;
+    }
+
+    return token->token_type == Tk_Slash ? a / b : a % b;
+}
+
+/// @brief Applies a binary operator to two values of the same type, which the caller still owns. Ints wrap around on overflow.
+/// `&&` and `||` are only applied here when both operands are known, since their right operand isn't always evaluated
+/// @param token The token of the operator
+/// @param a The left operand
+/// @param b The right operand
+/// @return The result
+NodeValue binaryOperation(Token *token, NodeValue a, NodeValue b) {
+    if (a.type == Type_float) {
+        switch (token->token_type) {
+            case Tk_Plus:
+                return (NodeValue){.f = a.f + b.f, .type = Type_float};
+            case Tk_Minus:
+                return (NodeValue){.f = a.f - b.f, .type = Type_float};
+            case Tk_Star:
+                return (NodeValue){.f = a.f * b.f, .type = Type_float};
+            case Tk_Slash:
+                return (NodeValue){.f = a.f / b.f, .type = Type_float};
+            case Tk_Less:
+                return (NodeValue){.i = a.f < b.f, .type = Type_int};
+            case Tk_LessEqual:
+                return (NodeValue){.i = a.f <= b.f, .type = Type_int};
+            case Tk_Greater:
+                return (NodeValue){.i = a.f > b.f, .type = Type_int};
+            case Tk_GreaterEqual:
+                return (NodeValue){.i = a.f >= b.f, .type = Type_int};
+            case Tk_Equal:
+                return (NodeValue){.i = a.f == b.f, .type = Type_int};
+            case Tk_NotEqual:
+                return (NodeValue){.i = a.f != b.f, .type = Type_int};
+        }
+    }
+
+    if (a.type == Type_str && token->token_type == Tk_Plus) {
+        return stringValue(concatStrings(token, asString(a), asString(b)));
+    }
+
+    if (a.type == Type_str) {
+        bool equal = stringsEqual(asString(a), asString(b));
+
+        return (NodeValue){.i = token->token_type == Tk_Equal ? equal : !equal, .type = Type_int};
+    }
+
+    // Ints and chars, which are both stored in `i`
+    switch (token->token_type) {
+        case Tk_Plus:
+            return (NodeValue){.i = (int)((unsigned int)a.i + (unsigned int)b.i), .type = Type_int};
+        case Tk_Minus:
+            return (NodeValue){.i = (int)((unsigned int)a.i - (unsigned int)b.i), .type = Type_int};
+        case Tk_Star:
+            return (NodeValue){.i = (int)((unsigned int)a.i * (unsigned int)b.i), .type = Type_int};
+        case Tk_Slash:
+        case Tk_Percent:
+            return (NodeValue){.i = intDivide(token, a.i, b.i), .type = Type_int};
+        case Tk_Less:
+            return (NodeValue){.i = a.i < b.i, .type = Type_int};
+        case Tk_LessEqual:
+            return (NodeValue){.i = a.i <= b.i, .type = Type_int};
+        case Tk_Greater:
+            return (NodeValue){.i = a.i > b.i, .type = Type_int};
+        case Tk_GreaterEqual:
+            return (NodeValue){.i = a.i >= b.i, .type = Type_int};
+        case Tk_Equal:
+            return (NodeValue){.i = a.i == b.i, .type = Type_int};
+        case Tk_NotEqual:
+            return (NodeValue){.i = a.i != b.i, .type = Type_int};
+        case Tk_And:
+            return (NodeValue){.i = a.i != 0 && b.i != 0, .type = Type_int};
+        case Tk_Or:
+            return (NodeValue){.i = a.i != 0 || b.i != 0, .type = Type_int};
+    }
+
+    return value_null;
+}
+
+/// @brief Applies `-` or `!` to a value
+NodeValue unaryOperation(Token *token, NodeValue a) {
+    if (token->token_type == Tk_Not) {
+        return (NodeValue){.i = a.i == 0, .type = Type_int};
+    }
+
+    if (a.type == Type_float) {
+        return (NodeValue){.f = -a.f, .type = Type_float};
+    }
+
+    return (NodeValue){.i = (int)-(unsigned int)a.i, .type = Type_int};
+}
+
+bool jitRunStatement(InterpreterState *state, int node);
+struct JitState *initJit(Ast *ast, Program program, TypeInfo *types);
+void freeJit(struct JitState *jit);
+
+/// @brief What a node does in the tree walker. Every node starts out Variant_Generic, which works out what to do
+/// from the node's kind and token like an ordinary tree walker, and then rewrites the node in place into the variant
+/// for what it saw: the kind of node and the types of the values it was given. From then on, the node runs its
+/// variant straight away. Variants that depend on the types of their operands check them first (the guard), and
+/// if they don't match, the node does the work the generic way and goes back to Variant_Generic, which
+/// specializes it again the next time it runs. The type checker already makes every node see one type,
+/// so in practice guards only ever fail on values a variant wasn't specialized for
+typedef enum NodeVariant {
+    Variant_Generic,
+    Variant_Nop, // a function definition, an import or a declaration that does nothing at runtime
+    Variant_IntLiteral,
+    Variant_CharLiteral,
+    Variant_FloatLiteral,
+    Variant_StringLiteral,
+    Variant_Variable, // a variable that isn't an Object, so reading it takes no reference
+    Variant_ObjectVariable,
+    Variant_Group, // an expression with a single child
+    Variant_BuiltinCall,
+    Variant_PrintInt, // `print` of an int
+    Variant_UserCall,
+    Variant_Assign, // to a variable that isn't an Object
+    Variant_ObjectAssign,
+    Variant_IndexAssign,
+    Variant_IntAdd,
+    Variant_IntSub,
+    Variant_IntMul,
+    Variant_IntLess,
+    Variant_IntLessEqual,
+    Variant_IntGreater,
+    Variant_IntGreaterEqual,
+    Variant_IntEqual,
+    Variant_IntNotEqual,
+    Variant_FloatAdd,
+    Variant_FloatSub,
+    Variant_FloatMul,
+    Variant_FloatDiv,
+    Variant_FloatLess,
+    Variant_FloatGreater,
+    Variant_Binary, // any other operator, see `binaryOperation`
+    Variant_And,
+    Variant_Or,
+    Variant_IntNegate,
+    Variant_Not,
+    Variant_Unary, // negating a float
+    Variant_While,
+    Variant_IntIndex,
+    Variant_FloatIndex,
+    Variant_Element, // indexing a `string[]` or a map
+    Variant_NewMap,
+    Variant_Return,
+    Variant_Block
+} NodeVariant;
+
+// Workers of parallel builtins run the same nodes, so a node may be rewritten by several threads at once.
+// They all rewrite it into the same variant, and the builtin a call caches is stored before its variant is
+#define nodeVariant(state, node) __atomic_load_n((state)->node_variants + (node), __ATOMIC_ACQUIRE)
+#define rewriteNode(state, node, variant) __atomic_store_n((state)->node_variants + (node), (unsigned char)(variant), __ATOMIC_RELEASE)
+#define nodeBuiltin(state, node) __atomic_load_n((state)->node_builtins + (node), __ATOMIC_RELAXED)
+
+/// @brief Picks the variant of a binary operator for the operands it was given
+/// @param op The TokenType of the operator, which isn't `&&` or `||`
+NodeVariant binaryVariant(TokenType op, NodeValue a, NodeValue b) {
+    if (a.type == Type_int && b.type == Type_int) {
+        switch (op) {
+            case Tk_Plus:
+                return Variant_IntAdd;
+            case Tk_Minus:
+                return Variant_IntSub;
+            case Tk_Star:
+                return Variant_IntMul;
+            case Tk_Less:
+                return Variant_IntLess;
+            case Tk_LessEqual:
+                return Variant_IntLessEqual;
+            case Tk_Greater:
+                return Variant_IntGreater;
+            case Tk_GreaterEqual:
+                return Variant_IntGreaterEqual;
+            case Tk_Equal:
+                return Variant_IntEqual;
+            case Tk_NotEqual:
+                return Variant_IntNotEqual;
+            default:
+                break;
+        }
+    }
+
+    if (a.type == Type_float && b.type == Type_float) {
+        switch (op) {
+            case Tk_Plus:
+                return Variant_FloatAdd;
+            case Tk_Minus:
+                return Variant_FloatSub;
+            case Tk_Star:
+                return Variant_FloatMul;
+            case Tk_Slash:
+                return Variant_FloatDiv;
+            case Tk_Less:
+                return Variant_FloatLess;
+            case Tk_Greater:
+                return Variant_FloatGreater;
+            default:
+                break;
+        }
+    }
+
+    return Variant_Binary;
+}
+
+/// @brief Applies a binary operator whose guard failed, and turns its node back into a generic one
+/// @return The result, with both operands released
+NodeValue despecializeBinary(InterpreterState *state, int node, Token *token, NodeValue a, NodeValue b) {
+    NodeValue result = binaryOperation(token, a, b);
+
+    rewriteNode(state, node, Variant_Generic);
+    releaseValue(a);
+    releaseValue(b);
+
+    return result;
+}
+
+/// @brief Indexes a container whose guard failed, and turns its node back into a generic one
+/// @return The element, with the container released
+NodeValue despecializeIndex(InterpreterState *state, int node, Token *token, NodeValue container, int index) {
+    NodeValue element = getElement(token, container, (NodeValue){.i = index, .type = Type_int});
+
+    rewriteNode(state, node, Variant_Generic);
+    releaseValue(container);
+
+    return element;
+}
+
+/// @brief Runs the arguments of a call
+/// @param args The Node_Args of the call
+/// @param values Where to put the values of the arguments, which the caller has to release
+void traverseArgs(int args, InterpreterState *state, NodeValue values[]) {
+    int i;
+
+    for (i = 0; i < state->ast->child_count[args]; i++) {
+        values[i] = traverseAstnode(state->ast->first_child[args] + i, state);
+    }
+}
+
+void releaseArgs(NodeValue values[], int num_values) {
+    int i;
+
+    for (i = 0; i < num_values; i++) {
+        releaseValue(values[i]);
+    }
+}
+
+/// @brief A case of `traverseAstnode` for a binary operator on operands of one type, guarded by their types
+#define OPERATOR_VARIANT(variant, operand_type, result_field, result_type, expr) \
+    case variant: { \
+        NodeValue a = traverseAstnode(ast->first_child[node], state); \
+        NodeValue b = traverseAstnode(ast->first_child[node] + 1, state); \
+        if (a.type == operand_type && b.type == operand_type) { \
+            return (NodeValue){.result_field = (expr), .type = result_type}; \
+        } \
+        return despecializeBinary(state, node, token, a, b); \
+    }
+
+/// @brief Traverses an Ast node and performs all necessary interpreting. The core function of the interpreter.
+/// Nodes that have run before go straight to their variant, the others run generically and specialize themselves, see NodeVariant
+/// @param node The id of the node to traverse
+/// @param state The Interpreter state
+/// @return A new reference to the value of the node, which the caller has to release
+NodeValue traverseAstnode(int node, InterpreterState* state) {
+    Ast *ast = state->ast;
+    Token *token = AstNodeToken(ast, state->program, node);
+    int num_children = ast->child_count[node];
+    int i;
+
+    countStep(token);
+
+    switch (nodeVariant(state, node)) {
+        case Variant_Generic:
+            break;
+
+        case Variant_Nop:
+            return value_null;
+
+        case Variant_IntLiteral:
+            return (NodeValue){.i = token->value, .type = Type_int};
+
+        case Variant_CharLiteral:
+            return (NodeValue){.i = token->value, .type = Type_char};
+
+        case Variant_FloatLiteral:
+            return (NodeValue){.f = float_literals.ref[token->value], .type = Type_float};
+
+        case Variant_StringLiteral:
+            return stringValue(literalString(token->value));
+
+        case Variant_Variable:
+            return slotValue(nodeSlots(state, node)[state->types->node_slots[node]], state->types->node_types[node]);
+
+        case Variant_ObjectVariable: {
+            NodeValue value = slotValue(nodeSlots(state, node)[state->types->node_slots[node]], state->types->node_types[node]);
+
+            retainValue(value);
+
+            return value;
+        }
+
+        case Variant_Group:
+            return traverseAstnode(ast->first_child[node], state);
+
+        case Variant_BuiltinCall: {
+            int args = ast->first_child[node];
+            int num_args = ast->child_count[args];
+            NodeValue values[num_args > 0 ? num_args : 1];
+
+            traverseArgs(args, state, values);
+            state->call_token = token;
+
+            NodeValue result = nodeBuiltin(state, node)->fn(state, values, num_args);
+
+            releaseArgs(values, num_args);
+
+            return result;
+        }
+
+        case Variant_PrintInt: {
+            NodeValue value = traverseAstnode(ast->first_child[ast->first_child[node]], state);
+
+            if (value.type == Type_int) {
+                printInt(value.i);
+                return value_null;
+            }
+
+            rewriteNode(state, node, Variant_Generic);
+            builtinPrint(state, &value, 1);
+            releaseValue(value);
+
+            return value_null;
+        }
+
+        case Variant_UserCall: {
+            int args = ast->first_child[node];
+            int num_args = ast->child_count[args];
+            NodeValue values[num_args > 0 ? num_args : 1];
+
+            traverseArgs(args, state, values);
+
+            NodeValue result = callFunction(state, state->types->functions.ref + state->types->node_functions[node], values, token);
+
+            releaseArgs(values, num_args);
+
+            return result;
+        }
+
+        case Variant_Assign: {
+            int target = ast->first_child[node];
+            NodeValue value = traverseAstnode(target + 1, state);
+
+            nodeSlots(state, target)[state->types->node_slots[target]].loc = value.loc;
+
+            return value;
+        }
+
+        case Variant_ObjectAssign: {
+            int target = ast->first_child[node];
+            NodeValue value = traverseAstnode(target + 1, state);
+
+            storeSlot(nodeSlots(state, target) + state->types->node_slots[target], state->types->node_types[node], value);
+
+            return value;
+        }
+
+        case Variant_IndexAssign: {
+            int target = ast->first_child[node];
+            NodeValue container = traverseAstnode(ast->first_child[target], state);
+            NodeValue index = traverseAstnode(ast->first_child[target] + 1, state);
+            NodeValue value = traverseAstnode(target + 1, state);
+
+            setElement(AstNodeToken(ast, state->program, target), container, index, value);
+            releaseValue(container);
+            releaseValue(index);
+
+            return value;
+        }
+
+        OPERATOR_VARIANT(Variant_IntAdd, Type_int, i, Type_int, (int)((unsigned int)a.i + (unsigned int)b.i))
+        OPERATOR_VARIANT(Variant_IntSub, Type_int, i, Type_int, (int)((unsigned int)a.i - (unsigned int)b.i))
+        OPERATOR_VARIANT(Variant_IntMul, Type_int, i, Type_int, (int)((unsigned int)a.i * (unsigned int)b.i))
+        OPERATOR_VARIANT(Variant_IntLess, Type_int, i, Type_int, a.i < b.i)
+        OPERATOR_VARIANT(Variant_IntLessEqual, Type_int, i, Type_int, a.i <= b.i)
+        OPERATOR_VARIANT(Variant_IntGreater, Type_int, i, Type_int, a.i > b.i)
+        OPERATOR_VARIANT(Variant_IntGreaterEqual, Type_int, i, Type_int, a.i >= b.i)
+        OPERATOR_VARIANT(Variant_IntEqual, Type_int, i, Type_int, a.i == b.i)
+        OPERATOR_VARIANT(Variant_IntNotEqual, Type_int, i, Type_int, a.i != b.i)
+        OPERATOR_VARIANT(Variant_FloatAdd, Type_float, f, Type_float, a.f + b.f)
+        OPERATOR_VARIANT(Variant_FloatSub, Type_float, f, Type_float, a.f - b.f)
+        OPERATOR_VARIANT(Variant_FloatMul, Type_float, f, Type_float, a.f * b.f)
+        OPERATOR_VARIANT(Variant_FloatDiv, Type_float, f, Type_float, a.f / b.f)
+        OPERATOR_VARIANT(Variant_FloatLess, Type_float, i, Type_int, a.f < b.f)
+        OPERATOR_VARIANT(Variant_FloatGreater, Type_float, i, Type_int, a.f > b.f)
+
+        case Variant_Binary: {
+            NodeValue a = traverseAstnode(ast->first_child[node], state);
+            NodeValue b = traverseAstnode(ast->first_child[node] + 1, state);
+            NodeValue result = binaryOperation(token, a, b);
+
+            releaseValue(a);
+            releaseValue(b);
+
+            return result;
+        }
+
+        case Variant_And:
+            return (NodeValue){.i = traverseAstnode(ast->first_child[node], state).i != 0 && traverseAstnode(ast->first_child[node] + 1, state).i != 0, .type = Type_int};
+
+        case Variant_Or:
+            return (NodeValue){.i = traverseAstnode(ast->first_child[node], state).i != 0 || traverseAstnode(ast->first_child[node] + 1, state).i != 0, .type = Type_int};
+
+        case Variant_IntNegate: {
+            NodeValue a = traverseAstnode(ast->first_child[node], state);
+
+            if (a.type == Type_int) {
+                return (NodeValue){.i = (int)-(unsigned int)a.i, .type = Type_int};
+            }
+
+            rewriteNode(state, node, Variant_Generic);
+
+            return unaryOperation(token, a);
+        }
+
+        case Variant_Not:
+            return (NodeValue){.i = traverseAstnode(ast->first_child[node], state).i == 0, .type = Type_int};
+
+        case Variant_Unary:
+            return unaryOperation(token, traverseAstnode(ast->first_child[node], state));
+
+        case Variant_While:
+            while (traverseAstnode(ast->first_child[node], state).i != 0) {
+                releaseValue(traverseAstnode(ast->first_child[node] + 1, state));
+
+                if (state->returning) {
+                    break;
+                }
+            }
+            return value_null;
+
+        case Variant_IntIndex: {
+            NodeValue array = traverseAstnode(ast->first_child[node], state);
+            int index = traverseAstnode(ast->first_child[node] + 1, state).i;
+
+            if (array.type != Type_ptr_int) {
+                return despecializeIndex(state, node, token, array, index);
+            }
+
+            checkIndex(token, array, index);
+
+            int element = arrayInts(array)[index];
+
+            releaseValue(array);
+
+            return (NodeValue){.i = element, .type = Type_int};
+        }
+
+        case Variant_FloatIndex: {
+            NodeValue array = traverseAstnode(ast->first_child[node], state);
+            int index = traverseAstnode(ast->first_child[node] + 1, state).i;
+
+            if (array.type != Type_ptr_float) {
+                return despecializeIndex(state, node, token, array, index);
+            }
+
+            checkIndex(token, array, index);
+
+            double element = arrayFloats(array)[index];
+
+            releaseValue(array);
+
+            return (NodeValue){.f = element, .type = Type_float};
+        }
+
+        case Variant_Element: {
+            NodeValue container = traverseAstnode(ast->first_child[node], state);
+            NodeValue index = traverseAstnode(ast->first_child[node] + 1, state);
+
+            // The element is retained before the container is released, which may free it
+            NodeValue value = getElement(token, container, index);
+
+            releaseValue(container);
+            releaseValue(index);
+
+            return value;
+        }
+
+        case Variant_NewMap: {
+            NodeValue map = newMap(state->types->node_types[node]);
+
+            storeSlot(nodeSlots(state, node) + state->types->node_slots[node], map.type, map);
+            releaseValue(map);
+
+            return value_null;
+        }
+
+        case Variant_Return:
+            state->return_value = num_children > 0 ? traverseAstnode(ast->first_child[node], state) : value_null;
+            state->returning = true;
+            return value_null;
+
+        case Variant_Block:
+            for (i = 0; i < num_children; i++) {
+                int child = ast->first_child[node] + i;
+
+                // Statements that have been compiled run natively instead
+                if (state->jit != NULL && jitRunStatement(state, child)) {
+                    continue;
+                }
+
+                releaseValue(traverseAstnode(child, state));
+
+                if (state->returning) {
+                    break;
+                }
+            }
+            return value_null;
+    }
+
+    if (token != NULL) {
+        // printf("TT: %s\n", TokenTypeRepr(token->token_type));
+        if (token->token_type == Tk_Strliteral) {
+            rewriteNode(state, node, Variant_StringLiteral);
+            return stringValue(literalString(token->value));
+        }
+
+        if (token->token_type == Tk_Intliteral) {
+            rewriteNode(state, node, Variant_IntLiteral);
+            return (NodeValue){
+                .type = Type_int,
+                .i = token->value
+            };
+        }
+
+        if (token->token_type == Tk_Floatliteral) {
+            rewriteNode(state, node, Variant_FloatLiteral);
+            return (NodeValue){
+                .type = Type_float,
+                .f = float_literals.ref[token->value]
+            };
+        }
+
+        if (token->token_type == Tk_Charliteral) {
+            rewriteNode(state, node, Variant_CharLiteral);
+            return (NodeValue){
+                .type = Type_char,
+                .i = token->value
+            };
+        }
+
+        if (token->token_type == Tk_ID && ast->kind[node] == Node_Value) {
+            NodeValue value = slotValue(nodeSlots(state, node)[state->types->node_slots[node]], state->types->node_types[node]);
+
+            rewriteNode(state, node, valueIsObject(value) ? Variant_ObjectVariable : Variant_Variable);
+            retainValue(value);
+
+            return value;
+        }
+
+        if (token->token_type == Tk_Fncall) {
+            // The only child is the Node_Args, whose children are the arguments
+            int args = getChildAst(ast, node, 0);
+            int num_args = ast->child_count[args];
+            NodeValue values[num_args > 0 ? num_args : 1];
+
+            traverseArgs(args, state, values);
+
+            if (state->types->node_functions[node] != -1) {
+                rewriteNode(state, node, Variant_UserCall);
+            } else {
+                BuiltinEntry *builtin = findBuiltinEntry(internedStr(token->value));
+
+                // An unknown function is reported by `interpretFunctionCall`, so the node stays generic
+                if (builtin != NULL) {
+                    __atomic_store_n(state->node_builtins + node, builtin, __ATOMIC_RELAXED);
+                    rewriteNode(state, node, builtin->fn == builtinPrint && num_args == 1 && values[0].type == Type_int ? Variant_PrintInt : Variant_BuiltinCall);
+                }
+            }
+
+            NodeValue result = interpretFunctionCall(node, state, values, num_args);
+
+            releaseArgs(values, num_args);
+
+            return result;
+        }
+
+        if (ast->kind[node] == Node_Action && token->token_type == Tk_Assign && ast->kind[getChildAst(ast, node, 0)] == Node_Index) {
+            int target = getChildAst(ast, node, 0);
+            NodeValue array = traverseAstnode(getChildAst(ast, target, 0), state);
+            NodeValue index = traverseAstnode(getChildAst(ast, target, 1), state);
+            NodeValue value = traverseAstnode(getChildAst(ast, node, 1), state);
+
+            rewriteNode(state, node, Variant_IndexAssign);
+            setElement(AstNodeToken(ast, state->program, target), array, index, value);
+            releaseValue(array);
+            releaseValue(index);
+
+            return value;
+        }
+
+        if (ast->kind[node] == Node_Action && token->token_type == Tk_Assign) {
+            int target = getChildAst(ast, node, 0);
+            NodeValue value = traverseAstnode(getChildAst(ast, node, 1), state);
+
+            rewriteNode(state, node, typeIsObject(state->types->node_types[node]) ? Variant_ObjectAssign : Variant_Assign);
+            storeSlot(nodeSlots(state, target) + state->types->node_slots[target], state->types->node_types[node], value);
+
+            return value;
+        }
+    }
+
+    switch (ast->kind[node]) {
+        case Node_Expr:
+            if (num_children == 1) {
+                rewriteNode(state, node, Variant_Group);
+                return traverseAstnode(ast->first_child[node], state);
+            }
+            break;
+
+        case Node_Function:
+            // Functions only run when they're called
+            rewriteNode(state, node, Variant_Nop);
+            return value_null;
+
+        case Node_Import:
+            // The module's functions were linked into the program before it ran
+            rewriteNode(state, node, Variant_Nop);
+            return value_null;
+
+        case Node_Binary: {
+            NodeValue left = traverseAstnode(ast->first_child[node], state);
+
+            if (token->token_type == Tk_And || token->token_type == Tk_Or) {
+                rewriteNode(state, node, token->token_type == Tk_And ? Variant_And : Variant_Or);
+
+                // The right operand only runs if the left one doesn't decide the result
+                if ((left.i != 0) == (token->token_type == Tk_Or)) {
+                    return (NodeValue){.i = left.i != 0, .type = Type_int};
+                }
+
+                return (NodeValue){.i = traverseAstnode(ast->first_child[node] + 1, state).i != 0, .type = Type_int};
+            }
+
+            NodeValue right = traverseAstnode(ast->first_child[node] + 1, state);
+            NodeValue result = binaryOperation(token, left, right);
+
+            rewriteNode(state, node, binaryVariant(token->token_type, left, right));
+            releaseValue(left);
+            releaseValue(right);
+
+            return result;
+        }
+
+        case Node_Unary: {
+            NodeValue operand = traverseAstnode(ast->first_child[node], state);
+
+            rewriteNode(state, node, token->token_type == Tk_Not ? Variant_Not : operand.type == Type_int ? Variant_IntNegate : Variant_Unary);
+
+            return unaryOperation(token, operand);
+        }
+
+        case Node_While:
+            rewriteNode(state, node, Variant_While);
+
+            // The condition is an int or a char, so it's never an Object that needs releasing
+            while (traverseAstnode(ast->first_child[node], state).i != 0) {
+                releaseValue(traverseAstnode(ast->first_child[node] + 1, state));
+
+                if (state->returning) {
+                    break;
+                }
+            }
+            return value_null;
+
+        case Node_Index: {
+            NodeValue array = traverseAstnode(ast->first_child[node], state);
+            NodeValue index = traverseAstnode(ast->first_child[node] + 1, state);
+
+            // The element is retained before the array is released, which may free it
+            NodeValue value = getElement(token, array, index);
+
+            rewriteNode(state, node, array.type == Type_ptr_int ? Variant_IntIndex : array.type == Type_ptr_float ? Variant_FloatIndex : Variant_Element);
+            releaseValue(array);
+            releaseValue(index);
+
+            return value;
+        }
+
+        case Node_Declr:
+            // Declaring a map creates an empty one
+            if (typeIsMap(state->types->node_types[node])) {
+                NodeValue map = newMap(state->types->node_types[node]);
+
+                rewriteNode(state, node, Variant_NewMap);
+                storeSlot(nodeSlots(state, node) + state->types->node_slots[node], map.type, map);
+                releaseValue(map);
+            } else {
+                rewriteNode(state, node, Variant_Nop);
+            }
+            return value_null;
+
+        case Node_Return:
+            rewriteNode(state, node, Variant_Return);
+            state->return_value = num_children > 0 ? traverseAstnode(ast->first_child[node], state) : value_null;
+            state->returning = true;
+            return value_null;
+
+        case Node_Block:
+            // The root stays generic, since it runs once and may resume a snapshot
+            rewriteNode(state, node, Variant_Block);
+            break;
+
+        default:
+            break;
+    }
+
+    // A restored program picks up after the statement its snapshot was taken in
+    for (i = node == 0 ? state->first_statement : 0; i < num_children; i++) {
+        int child = ast->first_child[node] + i;
+
+        // Statements that have been compiled run natively instead
+        if ((ast->kind[node] == Node_Root || ast->kind[node] == Node_Block) && state->jit != NULL && jitRunStatement(state, child)) {
+            continue;
+        }
+
+        releaseValue(traverseAstnode(child, state));
+
+        if (state->returning) {
+            break;
+        }
+
+        if (node == 0 && state->snapshot_requested) {
+            takeSnapshot(state, i + 1);
+        }
+    }
+
+    return value_null;
 }
 
 /// @brief Initializes the interpreter and traverses the root node
-/// @param root The root node
-void interpretAst(AstNode* root) {
+/// @param ast The parsed program, with the root at node 0
+/// @param program The tokens the Ast refers to
+/// @param types What `typecheck` worked out about the program
+void interpretAst(Ast* ast, Program program, TypeInfo *types) {
     InterpreterState state = {
-        .current_function = NULL,
-        .in_fn_call = false,
-        .vars = init_Vars()
+        .program = program,
+        .ast = ast,
+        .types = types,
+        .jit = initJit(ast, program, types)
     };
 
-    traverseAstnode(root, &state);
+    initStack(&state);
+    startUsage();
+    releaseValue(traverseAstnode(0, &state));
+    freeStack(&state);
+    freeJit(state.jit);
 }
 
 #endif
\ No newline at end of file
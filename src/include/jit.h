@@ -0,0 +1,428 @@
+#ifndef JIT_IMPL
+
+#define JIT_IMPL
+
+#include <stddef.h>
+
+// The JIT emits x86-64 machine code, so it's only available there. Everywhere else
+// initJit returns NULL and the tree walker never tries to compile anything.
+#if defined(__x86_64__) && defined(__linux__)
+    #define JIT_SUPPORTED
+#endif
+
+#define JIT_THRESHOLD 64 // executions before a statement gets compiled
+#define JIT_CHUNK_SIZE (64 * 1024) // the size of the executable mappings compiled code is allocated from
+#define JIT_CODE_ALIGN 16
+
+typedef struct JitOptions {
+    bool enabled;
+    bool dump;
+    int threshold;
+} JitOptions;
+
+JitOptions jit_options = {
+    .enabled = true,
+    .dump = false,
+    .threshold = JIT_THRESHOLD
+};
+
+typedef enum JitStatus {
+    Jit_Cold, // still being counted
+    Jit_Compiled,
+    Jit_Failed // can't be compiled
+} JitStatus;
+
+// Compiled code is passed the running function's frame and the globals. The type checker has proven
+// the types of everything it touches, so it has no guards and always runs to the end
+typedef void (*JitCode)(Slot *frame, Slot *globals);
+
+/// @brief An executable mapping that compiled code is bump-allocated from, so statements share pages
+typedef struct JitChunk {
+    unsigned char *mem;
+    long size;
+    long used;
+} JitChunk;
+
+DEFINE_VEC(JitChunks, JitChunk)
+
+/// @brief Per-statement execution counts and compiled code, indexed by node id
+typedef struct JitState {
+    int *counts;
+    unsigned char *status;
+    JitCode *code;
+    JitChunks chunks; // every chunk mapped so far, the last one being filled
+
+    Ast *ast;
+    Program program;
+    TypeInfo *types;
+
+    int num_compiled;
+} JitState;
+
+/// @brief Machine code being emitted, before it's copied into executable memory
+typedef struct JitBuffer {
+    ByteVec code;
+} JitBuffer;
+
+/// @brief Creates the JIT state for a program
+/// @param ast The parsed program
+/// @param program The tokens the Ast refers to
+/// @param types What `typecheck` worked out about the program
+/// @return The JIT state, or NULL if the JIT is disabled or unsupported
+JitState *initJit(Ast *ast, Program program, TypeInfo *types) {
+    #ifndef JIT_SUPPORTED
+    return NULL;
+    #endif
+
+    if (!jit_options.enabled) {
+        return NULL;
+    }
+
+    JitState *jit = nmalloc(sizeof(JitState));
+
+    *jit = (JitState){
+        .counts = ncalloc(ast->len, sizeof(int)),
+        .status = ncalloc(ast->len, sizeof(unsigned char)),
+        .code = ncalloc(ast->len, sizeof(JitCode)),
+        .ast = ast,
+        .program = program,
+        .types = types,
+        .num_compiled = 0
+    };
+
+    return jit;
+}
+
+void emitByte(JitBuffer *buf, unsigned char byte) {
+    ByteVec_push(&buf->code, byte);
+}
+
+void emitInt32(JitBuffer *buf, int x) {
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        emitByte(buf, (unsigned char)(x >> (i * 8)));
+    }
+}
+
+void emitInt64(JitBuffer *buf, long x) {
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        emitByte(buf, (unsigned char)(x >> (i * 8)));
+    }
+}
+
+/// @brief Emits an instruction between eax and the `i` of a slot, `op eax, [base + slot]` or `op [base + slot], eax`.
+/// The base is rdi for the frame or rsi for the globals
+/// @param buf The buffer to emit into
+/// @param opcode 0x8B to load the slot into eax, 0x89 to store eax into the slot
+/// @param slot The id of the slot
+/// @param global Whether the slot is a global accessed from inside a function
+void emitSlotAccess(JitBuffer *buf, unsigned char opcode, int slot, bool global) {
+    emitByte(buf, opcode);
+    emitByte(buf, global ? 0x86 : 0x87); // eax, [rsi/rdi + disp32]
+    emitInt32(buf, slot * sizeof(Slot) + offsetof(Slot, i));
+}
+
+/// @brief Whether the JIT can hold values of a type in eax
+#define jitTypeSupported(type) ((type) == Type_int || (type) == Type_char)
+
+bool jitCompileExpr(JitState *jit, JitBuffer *buf, int node);
+
+/// @brief Returns the second byte of the `setcc` that a comparison operator compiles to, or 0 if it isn't one
+unsigned char jitSetcc(TokenType op) {
+    switch (op) {
+        case Tk_Less:
+            return 0x9C;
+        case Tk_LessEqual:
+            return 0x9E;
+        case Tk_Greater:
+            return 0x9F;
+        case Tk_GreaterEqual:
+            return 0x9D;
+        case Tk_Equal:
+            return 0x94;
+        case Tk_NotEqual:
+            return 0x95;
+        default:
+            return 0;
+    }
+}
+
+/// @brief Emits code that leaves the result of a binary operator on ints or chars in eax. Division, which can fail,
+/// and `&&` and `||`, which don't always evaluate their right operand, are left to the interpreter
+/// @param jit The JIT state
+/// @param buf The buffer to emit into
+/// @param node The id of the Node_Binary
+/// @param op The TokenType of the operator
+/// @return Whether the operator could be compiled
+bool jitCompileBinary(JitState *jit, JitBuffer *buf, int node, TokenType op) {
+    if (op != Tk_Plus && op != Tk_Minus && op != Tk_Star && jitSetcc(op) == 0) {
+        return false;
+    }
+
+    // The left operand is kept on the native stack while the right one is worked out
+    if (!jitCompileExpr(jit, buf, jit->ast->first_child[node])) {
+        return false;
+    }
+
+    emitByte(buf, 0x50); // push rax
+
+    if (!jitCompileExpr(jit, buf, jit->ast->first_child[node] + 1)) {
+        return false;
+    }
+
+    // mov ecx, eax; pop rax
+    emitByte(buf, 0x89);
+    emitByte(buf, 0xC1);
+    emitByte(buf, 0x58);
+
+    switch (op) {
+        case Tk_Plus:
+            // add eax, ecx
+            emitByte(buf, 0x01);
+            emitByte(buf, 0xC8);
+            break;
+        case Tk_Minus:
+            // sub eax, ecx
+            emitByte(buf, 0x29);
+            emitByte(buf, 0xC8);
+            break;
+        case Tk_Star:
+            // imul eax, ecx
+            emitByte(buf, 0x0F);
+            emitByte(buf, 0xAF);
+            emitByte(buf, 0xC1);
+            break;
+        default:
+            // cmp eax, ecx; setcc al; movzx eax, al
+            emitByte(buf, 0x39);
+            emitByte(buf, 0xC8);
+            emitByte(buf, 0x0F);
+            emitByte(buf, jitSetcc(op));
+            emitByte(buf, 0xC0);
+            emitByte(buf, 0x0F);
+            emitByte(buf, 0xB6);
+            emitByte(buf, 0xC0);
+    }
+
+    return true;
+}
+
+/// @brief Emits code that leaves the value of an int or char expression in eax
+/// @param jit The JIT state
+/// @param buf The buffer to emit into
+/// @param node The id of the expression's node
+/// @return Whether the expression could be compiled
+bool jitCompileExpr(JitState *jit, JitBuffer *buf, int node) {
+    Ast *ast = jit->ast;
+    Token *token = AstNodeToken(ast, jit->program, node);
+
+    if (!jitTypeSupported(jit->types->node_types[node])) {
+        return false;
+    }
+
+    if (ast->kind[node] == Node_Value && (token->token_type == Tk_Intliteral || token->token_type == Tk_Charliteral)) {
+        // mov eax, imm32
+        emitByte(buf, 0xB8);
+        emitInt32(buf, token->value);
+        return true;
+    }
+
+    if (ast->kind[node] == Node_Value && token->token_type == Tk_ID) {
+        // The slot's type is known, so it can be read without checking
+        emitSlotAccess(buf, 0x8B, jit->types->node_slots[node], jit->types->node_globals[node]);
+        return true;
+    }
+
+    if (ast->kind[node] == Node_Expr && token->token_type != Tk_Fncall && ast->child_count[node] == 1) {
+        return jitCompileExpr(jit, buf, ast->first_child[node]);
+    }
+
+    if (ast->kind[node] == Node_Unary) {
+        if (!jitCompileExpr(jit, buf, ast->first_child[node])) {
+            return false;
+        }
+
+        if (token->token_type == Tk_Minus) {
+            // neg eax
+            emitByte(buf, 0xF7);
+            emitByte(buf, 0xD8);
+        } else {
+            // test eax, eax; sete al; movzx eax, al
+            emitByte(buf, 0x85);
+            emitByte(buf, 0xC0);
+            emitByte(buf, 0x0F);
+            emitByte(buf, 0x94);
+            emitByte(buf, 0xC0);
+            emitByte(buf, 0x0F);
+            emitByte(buf, 0xB6);
+            emitByte(buf, 0xC0);
+        }
+
+        return true;
+    }
+
+    if (ast->kind[node] == Node_Binary) {
+        return jitCompileBinary(jit, buf, node, token->token_type);
+    }
+
+    return false;
+}
+
+/// @brief Copies emitted code into the last chunk, or into a new one if it doesn't fit there
+/// @param jit The JIT state
+/// @param buf The emitted code
+/// @return The executable code, or NULL if no memory could be mapped for it
+JitCode jitFinalize(JitState *jit, JitBuffer *buf) {
+    long len = (buf->code.len + JIT_CODE_ALIGN - 1) / JIT_CODE_ALIGN * JIT_CODE_ALIGN;
+    JitChunk *chunk = jit->chunks.len > 0 ? jit->chunks.ref + jit->chunks.len - 1 : NULL;
+
+    if (chunk == NULL || chunk->used + len > chunk->size) {
+        long page_size = sysconf(_SC_PAGESIZE);
+        long size = len > JIT_CHUNK_SIZE ? (len + page_size - 1) / page_size * page_size : JIT_CHUNK_SIZE;
+        unsigned char *mem = mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if ((void*)-1 == mem) {
+            return NULL;
+        }
+
+        JitChunks_push(&jit->chunks, (JitChunk){.mem = mem, .size = size, .used = 0});
+        chunk = jit->chunks.ref + jit->chunks.len - 1;
+    }
+
+    // The chunk is only writable while the code is copied in, so it's never writable and executable at once
+    if (mprotect(chunk->mem, chunk->size, PROT_READ | PROT_WRITE)) {
+        return NULL;
+    }
+
+    unsigned char *code = chunk->mem + chunk->used;
+
+    memcpy(code, buf->code.ref, buf->code.len);
+    chunk->used += len;
+
+    // The chunk already holds code that has run, which can't run again unless it's executable
+    if (mprotect(chunk->mem, chunk->size, PROT_READ | PROT_EXEC)) {
+        reportFatalError(NULL, "RuntimeError", "Could not make compiled code executable again.", 1);
+    }
+
+    return (JitCode)code;
+}
+
+/// @brief Prints the machine code of a compiled statement
+void jitDump(JitState *jit, int node, JitBuffer *buf) {
+    Token *token = AstNodeToken(jit->ast, jit->program, node);
+    int i;
+
+    printf("jit: compiled statement at %s (%d bytes)\n", formatTokenLoc(tokenLoc(token)), buf->code.len);
+
+    for (i = 0; i < buf->code.len; i++) {
+        printf(i % 16 == 0 ? "    %02x" : " %02x", buf->code.ref[i]);
+
+        if (i % 16 == 15 || i == buf->code.len - 1) {
+            printf("\n");
+        }
+    }
+}
+
+/// @brief Tries to compile a statement into machine code
+/// @param jit The JIT state
+/// @param node The id of the statement's node
+/// @return Jit_Compiled, or Jit_Failed if the statement can't be compiled
+JitStatus jitCompileStatement(JitState *jit, int node) {
+    Ast *ast = jit->ast;
+    Token *token = AstNodeToken(ast, jit->program, node);
+
+    if (ast->kind[node] != Node_Action || token->token_type != Tk_Assign || !jitTypeSupported(jit->types->node_types[node])) {
+        return Jit_Failed;
+    }
+
+    int target = getChildAst(ast, node, 0);
+
+    if (ast->kind[target] == Node_Index) {
+        return Jit_Failed;
+    }
+
+    JitBuffer buf = {
+        .code = ByteVec_new(64)
+    };
+
+    JitStatus status = Jit_Failed;
+
+    if (jitCompileExpr(jit, &buf, getChildAst(ast, node, 1))) {
+        // The type checker has made sure the slot holds an int or char, never an Object that would need releasing
+        emitSlotAccess(&buf, 0x89, jit->types->node_slots[target], jit->types->node_globals[target]);
+        emitByte(&buf, 0xC3); // ret
+
+        jit->code[node] = jitFinalize(jit, &buf);
+
+        if (jit->code[node] != NULL) {
+            status = Jit_Compiled;
+            jit->num_compiled++;
+
+            if (jit_options.dump) {
+                jitDump(jit, node, &buf);
+            }
+        }
+    }
+
+    ByteVec_free(&buf.code);
+
+    return status;
+}
+
+/// @brief Counts an execution of a statement and runs its compiled code if there is any
+/// @param state The Interpreter state
+/// @param node The id of the statement's node
+/// @return Whether the statement was executed natively. If not, the caller has to interpret it
+bool jitRunStatement(InterpreterState *state, int node) {
+    JitState *jit = state->jit;
+
+    switch (jit->status[node]) {
+        case Jit_Compiled:
+            countStep(AstNodeToken(jit->ast, jit->program, node));
+            jit->code[node](state->frame, state->stack);
+            return true;
+
+        case Jit_Failed:
+            return false;
+
+        default:
+            jit->counts[node]++;
+
+            if (jit->counts[node] < jit_options.threshold) {
+                return false;
+            }
+
+            jit->status[node] = jitCompileStatement(jit, node);
+
+            if (jit->status[node] != Jit_Compiled) {
+                return false;
+            }
+
+            return jitRunStatement(state, node);
+    }
+}
+
+/// @brief Unmaps all compiled code and frees the JIT state
+/// @param jit The JIT state, or NULL if the JIT was disabled
+void freeJit(JitState *jit) {
+    int i;
+
+    if (jit == NULL) {
+        return;
+    }
+
+    for (i = 0; i < jit->chunks.len; i++) {
+        munmap(jit->chunks.ref[i].mem, jit->chunks.ref[i].size);
+    }
+
+    JitChunks_free(&jit->chunks);
+    nfree(jit->counts);
+    nfree(jit->status);
+    nfree(jit->code);
+    nfree(jit);
+}
+
+#endif
@@ -1,10 +1,7 @@
-#ifndef LEXER_IMPL 
+#ifndef LEXER_IMPL
 
 #define LEXER_IMPL
 
-#define nextToken() state.num_tks_processed++;
-//printf("[%d]: Token (%s)\n", num_tks_processed, TokenTypeRepr(current_token->token_type));
-
 typedef struct TokenLocation {
     char *file;
     int line;
@@ -17,40 +14,131 @@ typedef enum TokenType {
     Tk_Type,
     Tk_Fncall,
     Tk_Intliteral,
+    Tk_Floatliteral,
+    Tk_Charliteral,
     Tk_Strliteral,
     Tk_Openparen,
     Tk_Closeparen,
+    Tk_Openbrace,
+    Tk_Closebrace,
+    Tk_Openbracket,
+    Tk_Closebracket,
+    Tk_While,
+    Tk_Return,
+    Tk_Import,
     Tk_Semicolon,
     Tk_Assign,
+    Tk_Comma,
+    Tk_Plus,
+    Tk_Minus,
+    Tk_Star,
+    Tk_Slash,
+    Tk_Percent,
+    Tk_Less,
+    Tk_LessEqual,
+    Tk_Greater,
+    Tk_GreaterEqual,
+    Tk_Equal,
+    Tk_NotEqual,
+    Tk_And,
+    Tk_Or,
+    Tk_Not,
     Tk_EOF
 }  TokenType;
 
+/// @brief A lexed token. Tokens only point back into their source file by offset;
+/// the line and column are worked out with `tokenLoc` when they're needed
 typedef struct Token {
-    void *values;
-    int num_values;
-    
-    TokenType token_type;
+    unsigned int offset;
+    unsigned int len;
+
+    unsigned short token_type;
+    unsigned short file; // index into `sources`
 
-    TokenLoc loc;
+    int value; // the int of an Intliteral, the char of a Charliteral, the index into `float_literals` of a Floatliteral, otherwise the intern id of the token's text
 } Token;
 
-typedef struct TokenList {
-    Token *ref;
-    int len;
-    int capacity;
-} Program;
-
-/// @brief Pushes a token to a Program dynamic array
-/// @param program A reference to the program
-/// @param token The token to push
-void push_token(Program *program, Token token) {
-    if (program->len >= program->capacity) {
-        program->capacity *= 2;
-        program->ref = realloc(program->ref, program->capacity * sizeof(Token));
+_Static_assert(sizeof(Token) == 16, "Token should stay 16 bytes");
+
+DEFINE_VEC(TokenList, Token)
+typedef TokenList Program;
+
+DEFINE_VEC(FloatLiterals, double)
+FloatLiterals float_literals; // the values of every Floatliteral, which don't fit in a Token
+
+typedef struct SourceFile {
+    char *path;
+    Astr text;
+
+    IntVec line_starts; // offset of the start of each line, built the first time a location is needed
+} SourceFile;
+
+DEFINE_VEC(SourceFiles, SourceFile)
+SourceFiles sources;
+
+/// @brief Registers a source file so tokens can refer to it by index
+/// @param path The path of the file, used in error messages
+/// @param text The contents of the file
+/// @return The index of the file in `sources`
+int addSourceFile(char *path, Astr text) {
+    SourceFiles_push(&sources, (SourceFile){
+        .path = path,
+        .text = text,
+        .line_starts = {0}
+    });
+
+    return sources.len - 1;
+}
+
+/// @brief Builds the line start index of a source file
+/// @param file The file to index
+void indexLines(SourceFile *file) {
+    int i;
+
+    file->line_starts = IntVec_new(64);
+    IntVec_push(&file->line_starts, 0);
+
+    for (i = 0; i < file->text.len; i++) {
+        if (file->text.str_ref[i] == '\n') {
+            IntVec_push(&file->line_starts, i + 1);
+        }
     }
+}
 
-    program->ref[program->len] = token;
-    program->len++;
+/// @brief Works out the file, line and column of a token
+/// @param token The token to locate
+/// @return The location of the token
+TokenLoc tokenLoc(Token *token) {
+    SourceFile *file = sources.ref + token->file;
+
+    if (file->line_starts.ref == NULL) {
+        indexLines(file);
+    }
+
+    // Binary search for the last line starting at or before the token
+    int low = 0;
+    int high = file->line_starts.len - 1;
+
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+
+        if (file->line_starts.ref[mid] <= (int)token->offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return (TokenLoc){
+        .file = file->path,
+        .line = low + 1,
+        .col = token->offset - file->line_starts.ref[low] + 1
+    };
+}
+
+/// @brief Returns the source text a token was lexed from
+Astr tokenText(Token *token) {
+    return substringRef(sources.ref[token->file].text, token->offset, token->offset + token->len);
 }
 
 /// @brief Returns a string to represent a token type enum
@@ -64,12 +152,30 @@ char *TokenTypeRepr(enum TokenType tokenType) {
             return "fncall";
         case Tk_Intliteral:
             return "intliteral";
+        case Tk_Floatliteral:
+            return "floatliteral";
+        case Tk_Charliteral:
+            return "charliteral";
         case Tk_Strliteral:
             return "strliteral";
         case Tk_Openparen:
             return "openparen";
         case Tk_Closeparen:
             return "closeparen";
+        case Tk_Openbrace:
+            return "openbrace";
+        case Tk_Closebrace:
+            return "closebrace";
+        case Tk_Openbracket:
+            return "openbracket";
+        case Tk_Closebracket:
+            return "closebracket";
+        case Tk_While:
+            return "while";
+        case Tk_Return:
+            return "return";
+        case Tk_Import:
+            return "import";
         case Tk_Semicolon:
             return "semicolon";
         case Tk_EOF:
@@ -78,6 +184,36 @@ char *TokenTypeRepr(enum TokenType tokenType) {
             return "null";
         case Tk_Assign:
             return "assign";
+        case Tk_Comma:
+            return "comma";
+        case Tk_Plus:
+            return "+";
+        case Tk_Minus:
+            return "-";
+        case Tk_Star:
+            return "*";
+        case Tk_Slash:
+            return "/";
+        case Tk_Percent:
+            return "%";
+        case Tk_Less:
+            return "<";
+        case Tk_LessEqual:
+            return "<=";
+        case Tk_Greater:
+            return ">";
+        case Tk_GreaterEqual:
+            return ">=";
+        case Tk_Equal:
+            return "==";
+        case Tk_NotEqual:
+            return "!=";
+        case Tk_And:
+            return "&&";
+        case Tk_Or:
+            return "||";
+        case Tk_Not:
+            return "!";
         case Tk_Type:
             return "type";
     }
@@ -88,9 +224,9 @@ char *TokenTypeRepr(enum TokenType tokenType) {
 char *formatTokenLoc(TokenLoc loc) {
     Astr combined = _Astr(loc.file);
 
-    combined = concat(combined, _Astr(":"));    
-    combined = concat(combined, fromInt(loc.line));    
-    combined = concat(combined, _Astr(":"));    
+    combined = concat(combined, _Astr(":"));
+    combined = concat(combined, fromInt(loc.line));
+    combined = concat(combined, _Astr(":"));
     combined = concat(combined, fromInt(loc.col));
 
     return AstrToStr(combined);
@@ -111,192 +247,384 @@ Token* TokenAtIndex(Program program, int index) {
     return program.ref + index;
 }
 
-#define TRACKER_CAPACITY 1024
 typedef struct LexerState {
-    char tracker[TRACKER_CAPACITY];
-    int tracker_index;
-    
-    bool escaped;
-    bool in_strliteral;
-    bool in_intliteral;
-
-    int num_tks_processed;
+    Astr input;
+    int index;
+    unsigned short file;
 
-    TokenLoc current_loc;
+    Program program;
 } Lexstate;
 
 /// @brief Determines the token type of an identifier
 /// @param id The identifier string
 /// @return The TokenType of the identifier
 TokenType idTokenType(char *id) {
-    if (streq(id, "int") || streq(id, "float") || streq(id, "char") || streq(id, "string")) {
+    if (streq(id, "int") || streq(id, "float") || streq(id, "char") || streq(id, "string") || streq(id, "void")
+        || streq(id, "int[]") || streq(id, "float[]") || streq(id, "string[]") || strncmp(id, "map[", 4) == 0) {
         return Tk_Type;
     }
 
+    if (streq(id, "while")) {
+        return Tk_While;
+    }
+
+    if (streq(id, "return")) {
+        return Tk_Return;
+    }
+
+    if (streq(id, "import")) {
+        return Tk_Import;
+    }
+
     return Tk_ID;
 }
 
-bool isTerminatingChar(char c) {
-    return (c == ' ' || c == '(' || c == ')' || c == ',' || c == ';');
+/// @brief Returns if `c` can be part of an identifier
+bool isIdChar(char c) {
+    return isUpperCase(c) || isLowerCase(c) || isDigit(c) || c == '_';
 }
 
-/// @brief Lexes a given Astr-type input into a series of Token structs
-/// @param input Input for the lexer to tokenize
-/// @param filename Filename for error reporting using Token locations
-/// @return A list of lexed Tokens
-Program lex(Astr input, char *filename) {
-    #define TOKEN_CAPACITY 1024
-    
-    char c = 'A'; // is null by default so set it to a non-null value to get the loop to start
-    int index = 0;
-
-    Token *tokens = malloc(TOKEN_CAPACITY * sizeof(Token));
-    // Token* current_token = tokens;
-    
-    Program program = {
-        .ref = tokens,
-        .len = 0,
-        .capacity = TOKEN_CAPACITY
-    };
+/// @brief Pushes a token spanning from `start` to the current index of the lexer
+/// @param state The lexer state
+/// @param token_type The type of the new token
+/// @param start The offset the token starts at
+/// @param value The value of the token
+void lexToken(Lexstate *state, TokenType token_type, int start, int value) {
+    TokenList_push(&state->program, (Token){
+        .offset = start,
+        .len = state->index - start,
+        .token_type = token_type,
+        .file = state->file,
+        .value = value
+    });
+}
 
-    Lexstate state = {
-        .escaped = false,
-        .in_strliteral = false,
-        .tracker_index = 0,
-        .current_loc = {
-            .file = filename,
-            .line = 1,
-            .col = 1
-        }   
+/// @brief Reports an error at the current index of the lexer
+void lexError(Lexstate *state, char *errorMsg) {
+    Token token = {
+        .offset = state->index,
+        .len = 1,
+        .token_type = Tk_Null,
+        .file = state->file
     };
 
-    while (c != '\0') {
-        c = input.str_ref[index];
-        state.tracker[state.tracker_index] = c;
+    reportError(&token, "SyntaxError", errorMsg);
+}
+
+/// @brief Returns the character an escape sequence stands for
+/// @param c The character after the backslash
+char escapedChar(char c) {
+    switch (c) {
+        case 'n':
+            return '\n';
+        case 't':
+            return '\t';
+        case '0':
+            return '\0';
+        default:
+            return c;
+    }
+}
+
+/// @brief Lexes a string literal whose opening quote is at the current index, resolving escapes
+/// @param state The lexer state
+void lexStrliteral(Lexstate *state) {
+    int start = state->index;
+    Astr rest = substringRef(state->input, start + 1, state->input.len);
+    int quote = AstrFindChar(rest, '"');
+
+    // Most literals have no escapes, so they can be interned straight from the source
+    if (quote != -1 && findByte(rest.str_ref, quote, '\\') == -1) {
+        state->index = start + 1 + quote + 1;
+        lexToken(state, Tk_Strliteral, start, internAstr(substringRef(rest, 0, quote)));
+        return;
+    }
 
-        // printf("char: %c, tracker: %s [%d]\n", c, state.tracker, state.tracker_index);
+    char *decoded = nmalloc(state->input.len - start);
+    int len = 0;
 
-        if (isWhiteSpace(c) && !state.in_strliteral && state.tracker_index != 1) state.tracker_index--;
+    state->index++;
 
-        if (c == '\n') {
-            state.current_loc.line++;
-            state.current_loc.col = 1;
+    while (true) {
+        if (state->index >= state->input.len) {
+            state->index = start;
+            lexError(state, "Unterminated string literal.");
         }
 
-        if (isTerminatingChar(c) && !state.in_strliteral && state.tracker_index > 0) {
-            if (isWhiteSpace(c)) state.tracker_index++;
+        char c = charat(state->input, state->index);
 
-            char *tk_val = strndup(state.tracker, state.tracker_index);
+        if (c == '"') {
+            break;
+        }
 
-            Token token = {
-                .token_type = idTokenType(tk_val),
-                .values = tk_val,
-                .num_values = 1,
-                .loc = state.current_loc
-            };
+        if (c == '\\' && state->index + 1 < state->input.len) {
+            state->index++;
+            c = escapedChar(charat(state->input, state->index));
+        }
 
-            if (AstrIsD(_Astr(tk_val))) {
-                token.token_type = Tk_Intliteral;
-                int *int_value = malloc(sizeof(int));
-                *int_value = AstrToD(_Astr(tk_val));
-                // printf("int literal: %d\n", *int_value);
-                token.values = int_value;
-            }
+        decoded[len] = c;
+        len++;
+        state->index++;
+    }
 
-            state.tracker_index = -1;
-            // printf("IDDDD: %d, %s, %s\n", AstrIsD(_Astr(tk_val)), TokenTypeRepr(token.token_type), tk_val);
-            push_token(&program, token);
+    state->index++;
+    lexToken(state, Tk_Strliteral, start, internAstr((Astr){.str_ref = decoded, .len = len}));
+    nfree(decoded);
+}
 
-            nextToken();
-        }
-        else if (c == '\\' && state.in_strliteral) {
-            state.escaped = true;
-        }
-        else if (c == '"' && !state.in_strliteral) {
-            state.in_strliteral = true;
-        }  
-        else if (c == '"' && state.in_strliteral && !state.escaped) {
-            char *tk_val = strndup(state.tracker + 1, state.tracker_index - 1); // exclude quotes
-
-            state.tracker_index = -1;
-
-            push_token(&program, (Token){
-                .token_type = Tk_Strliteral,
-                .values = tk_val,
-                .num_values = 1,
-                .loc = state.current_loc
-            });
-
-            nextToken();
-
-            state.in_strliteral = false;
-        } 
-        if (c == '(' && !state.in_strliteral) {
-            state.tracker_index = -1;
-
-            push_token(&program, (Token){
-                .token_type = Tk_Openparen,
-                .values = NULL,
-                .num_values = 0,
-                .loc = state.current_loc
-            });
-
-            nextToken();
+/// @brief Lexes a char literal like `'a'` or `'\n'` whose opening quote is at the current index
+/// @param state The lexer state
+void lexCharliteral(Lexstate *state) {
+    int start = state->index;
+    char c;
+
+    state->index++;
+
+    if (state->index >= state->input.len || charat(state->input, state->index) == '\'') {
+        lexError(state, "Expected a character.");
+    }
+
+    c = charat(state->input, state->index);
+
+    if (c == '\\' && state->index + 1 < state->input.len) {
+        state->index++;
+        c = escapedChar(charat(state->input, state->index));
+    }
+
+    state->index++;
+
+    if (state->index >= state->input.len || charat(state->input, state->index) != '\'') {
+        state->index = start;
+        lexError(state, "Unterminated char literal.");
+    }
+
+    state->index++;
+    lexToken(state, Tk_Charliteral, start, (unsigned char)c);
+}
+
+/// @brief Lexes an int or float literal starting at the current index
+/// @param state The lexer state
+void lexNumber(Lexstate *state) {
+    int start = state->index;
+    Astr input = state->input;
+
+    state->index++;
+
+    while (state->index < input.len && isDigit(charat(input, state->index))) {
+        state->index++;
+    }
+
+    if (state->index + 1 >= input.len || charat(input, state->index) != '.' || !isDigit(charat(input, state->index + 1))) {
+        int value = AstrToD(substringRef(input, start, state->index));
+
+        // Literals have no sign, so INT_MIN only comes back for one that's too big
+        if (value == INT_MIN) {
+            state->index = start;
+            lexError(state, "Integer literal is too big for an int.");
         }
-        else if (c == ')' && !state.in_strliteral) {
-            state.tracker_index = -1;
 
-            push_token(&program, (Token){
-                .token_type = Tk_Closeparen,
-                .values = NULL,
-                .num_values = 0,
-                .loc = state.current_loc
-            });
+        lexToken(state, Tk_Intliteral, start, value);
+        return;
+    }
+
+    state->index++;
+
+    while (state->index < input.len && isDigit(charat(input, state->index))) {
+        state->index++;
+    }
+
+    // The source isn't NUL-terminated, so strtod gets a copy
+    char *text = AstrToStr(substringRef(input, start, state->index));
+
+    FloatLiterals_push(&float_literals, strtod(text, NULL));
+    nfree(text);
+
+    lexToken(state, Tk_Floatliteral, start, float_literals.len - 1);
+}
+
+/// @brief Moves the lexer past any whitespace
+/// @param state The lexer state
+void skipWhiteSpace(Lexstate *state) {
+    while (state->index < state->input.len && (isWhiteSpace(charat(state->input, state->index)) || charat(state->input, state->index) == '\r')) {
+        state->index++;
+    }
+}
+
+/// @brief Skips whitespace, then lexes the token at the lexer's index. A token never depends on what came
+/// before it, so lexing can start at any token boundary
+/// @param state The lexer state
+/// @return Whether a token was lexed, or false at the end of the input
+bool lexNext(Lexstate *state) {
+    Astr input = state->input;
+
+    skipWhiteSpace(state);
+
+    if (state->index >= input.len || charat(input, state->index) == '\0') {
+        return false;
+    }
+
+    char c = charat(input, state->index);
+    int start = state->index;
+
+    // A `-` is always an operator, so `x-1` is a subtraction and `-1` is negated by the parser
+    if (isDigit(c)) {
+        lexNumber(state);
+    }
 
-            nextToken();
+    else if (isIdChar(c)) {
+        while (state->index < input.len && isIdChar(charat(input, state->index))) {
+            state->index++;
         }
-        else if (c == ';' && !state.in_strliteral) {
-            state.tracker_index = -1;
 
-            push_token(&program, (Token){
-                .token_type = Tk_Semicolon,
-                .values = NULL,
-                .num_values = 0,
-                .loc = state.current_loc
-            });
+        int id = internAstr(substringRef(input, start, state->index));
 
-            nextToken();
+        // Array types like `int[]` are a single type token
+        if ((streq(internedStr(id), "int") || streq(internedStr(id), "float") || streq(internedStr(id), "string"))
+            && state->index + 1 < input.len && charat(input, state->index) == '[' && charat(input, state->index + 1) == ']') {
+            state->index += 2;
+            id = internAstr(substringRef(input, start, state->index));
         }
-        else if (c == '=' && !state.in_strliteral) {
-            state.tracker_index = -1;
 
-            push_token(&program, (Token){
-                .token_type = Tk_Assign,
-                .values = NULL,
-                .num_values = 0,
-                .loc = state.current_loc
-            });
+        // And so are map types like `map[string]int`. A variable called `map` can still be indexed, since its index isn't a type
+        if (streq(internedStr(id), "map") && state->index < input.len && charat(input, state->index) == '[') {
+            int end = state->index + 1;
+
+            while (end < input.len && isIdChar(charat(input, end))) {
+                end++;
+            }
+
+            Astr key = substringRef(input, state->index + 1, end);
 
-            nextToken();
+            if (end < input.len && charat(input, end) == ']' && idTokenType(internedStr(internAstr(key))) == Tk_Type) {
+                end++;
+
+                while (end < input.len && isIdChar(charat(input, end))) {
+                    end++;
+                }
+
+                state->index = end;
+                id = internAstr(substringRef(input, start, state->index));
+            }
         }
 
-        if (state.escaped) state.escaped = false;
+        lexToken(state, idTokenType(internedStr(id)), start, id);
+    }
 
-        index++;
-        state.tracker_index++;
-        state.current_loc.col++;
+    else if (c == '"') {
+        lexStrliteral(state);
     }
 
-    push_token(&program, (Token){
-        .token_type = Tk_EOF,
-        .num_values = 0,
-        .values = NULL,
-        .loc = state.current_loc
-    });
+    else if (c == '\'') {
+        lexCharliteral(state);
+    }
+
+    else {
+        TokenType token_type;
+        char next = state->index + 1 < input.len ? charat(input, state->index + 1) : '\0';
+
+        switch (c) {
+            case '(':
+                token_type = Tk_Openparen;
+                break;
+            case ')':
+                token_type = Tk_Closeparen;
+                break;
+            case '{':
+                token_type = Tk_Openbrace;
+                break;
+            case '}':
+                token_type = Tk_Closebrace;
+                break;
+            case '[':
+                token_type = Tk_Openbracket;
+                break;
+            case ']':
+                token_type = Tk_Closebracket;
+                break;
+            case ';':
+                token_type = Tk_Semicolon;
+                break;
+            case '=':
+                token_type = next == '=' ? Tk_Equal : Tk_Assign;
+                break;
+            case ',':
+                token_type = Tk_Comma;
+                break;
+            case '+':
+                token_type = Tk_Plus;
+                break;
+            case '-':
+                token_type = Tk_Minus;
+                break;
+            case '*':
+                token_type = Tk_Star;
+                break;
+            case '/':
+                token_type = Tk_Slash;
+                break;
+            case '%':
+                token_type = Tk_Percent;
+                break;
+            case '<':
+                token_type = next == '=' ? Tk_LessEqual : Tk_Less;
+                break;
+            case '>':
+                token_type = next == '=' ? Tk_GreaterEqual : Tk_Greater;
+                break;
+            case '!':
+                token_type = next == '=' ? Tk_NotEqual : Tk_Not;
+                break;
+            case '&':
+                if (next != '&') {
+                    lexError(state, "Expected `&&`.");
+                }
+                token_type = Tk_And;
+                break;
+            case '|':
+                if (next != '|') {
+                    lexError(state, "Expected `||`.");
+                }
+                token_type = Tk_Or;
+                break;
+            default:
+                lexError(state, "Unexpected character.");
+        }
+
+        // The two-character operators all end with their second character
+        state->index += token_type == Tk_Equal || token_type == Tk_NotEqual || token_type == Tk_LessEqual
+                        || token_type == Tk_GreaterEqual || token_type == Tk_And || token_type == Tk_Or ? 2 : 1;
+        lexToken(state, token_type, start, 0);
+    }
+
+    return true;
+}
+
+/// @brief Lexes a registered source file into a series of Token structs
+/// @param file The index of the file in `sources`
+/// @return A list of lexed Tokens
+Program lexSource(int file) {
+    #define TOKEN_CAPACITY 1024
+
+    Lexstate state = {
+        .input = sources.ref[file].text,
+        .index = 0,
+        .file = file,
+        .program = TokenList_new(TOKEN_CAPACITY)
+    };
+
+    while (lexNext(&state));
 
-    state.num_tks_processed++;
+    lexToken(&state, Tk_EOF, state.index, 0);
 
-    return program;
+    return state.program;
+}
+
+/// @brief Lexes a given Astr-type input into a series of Token structs
+/// @param input Input for the lexer to tokenize
+/// @param filename Filename for error reporting using Token locations
+/// @return A list of lexed Tokens
+Program lex(Astr input, char *filename) {
+    return lexSource(addSourceFile(filename, input));
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,328 @@
+#ifndef MAP_IMPL
+
+#define MAP_IMPL
+
+// The hash tables behind `map` values. Tables use open addressing in the layout of Abseil's SwissTable:
+// slots are split into groups of MAP_GROUP, and each slot has a control byte that is either MAP_EMPTY,
+// MAP_DELETED, or, for a slot holding a key, the low 7 bits of the key's hash. A lookup hashes the key once,
+// starts at the group the rest of the hash picks, and compares the 7 bits with all the control bytes of a group
+// at once, so keys are only compared in slots that already match on 7 bits. Probing stops at the first group
+// with an empty slot. Deleted keys leave a MAP_DELETED behind only in groups that are full, since only those
+// can have been probed past.
+
+// While `runtime_shared` is set, functions run by parallel builtins may use the same map at once,
+// so every use of a map takes `map_lock` then, see `lockMaps`
+
+#define MAP_GROUP 16
+#define MAP_EMPTY ((signed char)-128)
+#define MAP_DELETED ((signed char)-2)
+
+typedef struct MapEntry {
+    Slot key;
+    Slot value;
+} MapEntry;
+
+/// @brief A map. Keys are ints, chars or strings and values are ints, floats, chars or strings, and a map holds
+/// a reference to every string in it. The table is only allocated once the first key is set
+typedef struct Map {
+    Object object;
+    int type; // see `mapType`
+    int len; // the number of keys
+    int capacity; // the number of slots, 0 or a power of 2 that's at least MAP_GROUP
+    int growth_left; // how many empty slots can still be filled before the table grows
+    MapEntry *entries; // one per slot
+    signed char *ctrl; // one control byte per slot, after the entries in the same allocation
+} Map;
+
+pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// @brief Takes `map_lock` if other threads may be using maps
+void lockMaps() {
+    if (runtime_shared) {
+        pthread_mutex_lock(&map_lock);
+    }
+}
+
+void unlockMaps() {
+    if (runtime_shared) {
+        pthread_mutex_unlock(&map_lock);
+    }
+}
+
+/// @brief Mixes the bits of a word, so that every bit of it affects every bit of the result (the finalizer of MurmurHash3)
+unsigned long mixHash(unsigned long x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdul;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ul;
+    x ^= x >> 33;
+
+    return x;
+}
+
+/// @brief Hashes bytes a word at a time
+unsigned long hashBytes(const char *bytes, int len) {
+    unsigned long hash = 0x9e3779b97f4a7c15ul ^ (unsigned long)len;
+    unsigned long word;
+    int i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&word, bytes + i, 8);
+        hash = mixHash(hash ^ word);
+    }
+
+    word = 0;
+    memcpy(&word, bytes + i, len - i);
+
+    return mixHash(hash ^ word);
+}
+
+/// @brief Hashes a key of a map
+/// @param key The key, an int, a char or a string
+unsigned long hashKey(NodeValue key) {
+    if (key.type == Type_str) {
+        return hashBytes(stringChars(asString(key)), asString(key)->len);
+    }
+
+    return mixHash((unsigned int)key.i);
+}
+
+/// @brief Returns whether two keys of the same type are equal
+bool keysEqual(NodeValue a, NodeValue b) {
+    return a.type == Type_str ? stringsEqual(asString(a), asString(b)) : a.i == b.i;
+}
+
+/// @brief Returns a bit for each control byte of a group that equals `byte`
+unsigned int matchGroup(const signed char *ctrl, signed char byte) {
+    #ifdef __x86_64__
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)ctrl), _mm_set1_epi8(byte)));
+    #else
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < MAP_GROUP; i++) {
+        mask |= (unsigned int)(ctrl[i] == byte) << i;
+    }
+
+    return mask;
+    #endif
+}
+
+/// @brief Returns a bit for each slot of a group that's empty or deleted, whose control bytes are the negative ones
+unsigned int matchGroupFree(const signed char *ctrl) {
+    #ifdef __x86_64__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+    #else
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < MAP_GROUP; i++) {
+        mask |= (unsigned int)(ctrl[i] < 0) << i;
+    }
+
+    return mask;
+    #endif
+}
+
+/// @brief The 7 bits of a hash that go in the control byte
+#define hashControl(hash) ((signed char)((hash) & 0x7F))
+
+/// @brief The group a hash starts probing at
+#define hashGroup(map, hash) (((hash) >> 7) & (unsigned long)((map)->capacity / MAP_GROUP - 1))
+
+/// @brief The next group to probe. Adding 1, 2, 3... visits every group once when their number is a power of 2
+#define nextGroup(map, group, step) (((group) + (step)) & (unsigned long)((map)->capacity / MAP_GROUP - 1))
+
+/// @brief Returns the type `keys` or `values` returns for keys or values of a type: an array of them, or a string for chars
+#define mapColumnType(type) ((type) == Type_char ? Type_str : (type) == Type_int ? Type_ptr_int : (type) == Type_float ? Type_ptr_float : Type_ptr_str)
+
+#define mapKey(map, slot) slotValue((map)->entries[slot].key, mapKeyType((map)->type))
+#define mapValue(map, slot) slotValue((map)->entries[slot].value, mapValueType((map)->type))
+
+/// @brief Finds the slot of a key
+/// @param hash The key's hash
+/// @return The slot, or -1 if the key isn't in the map
+int mapFind(Map *map, NodeValue key, unsigned long hash) {
+    unsigned long group;
+    int step;
+
+    if (map->len == 0) {
+        return -1;
+    }
+
+    group = hashGroup(map, hash);
+
+    for (step = 1; ; step++) {
+        signed char *ctrl = map->ctrl + group * MAP_GROUP;
+        unsigned int matches = matchGroup(ctrl, hashControl(hash));
+
+        while (matches != 0) {
+            int slot = group * MAP_GROUP + __builtin_ctz(matches);
+
+            if (keysEqual(mapKey(map, slot), key)) {
+                return slot;
+            }
+
+            matches &= matches - 1;
+        }
+
+        if (matchGroup(ctrl, MAP_EMPTY) != 0) {
+            return -1;
+        }
+
+        group = nextGroup(map, group, step);
+    }
+}
+
+/// @brief Finds the first empty or deleted slot a key with a hash would probe. There always is one
+int mapFreeSlot(Map *map, unsigned long hash) {
+    unsigned long group = hashGroup(map, hash);
+    int step;
+
+    for (step = 1; ; step++) {
+        unsigned int free_slots = matchGroupFree(map->ctrl + group * MAP_GROUP);
+
+        if (free_slots != 0) {
+            return group * MAP_GROUP + __builtin_ctz(free_slots);
+        }
+
+        group = nextGroup(map, group, step);
+    }
+}
+
+/// @brief Returns the size of the table of a map with `capacity` slots
+#define mapTableSize(capacity) ((long)(capacity) * (sizeof(MapEntry) + 1))
+
+/// @brief Moves the keys of a map into a new table, which drops its deleted slots. The table doubles
+/// when more than 7/16 of it is in use, so it's at most 7/8 full afterwards, and otherwise stays the same size
+void mapResize(Map *map) {
+    MapEntry *old_entries = map->entries;
+    signed char *old_ctrl = map->ctrl;
+    int old_capacity = map->capacity;
+    int capacity = old_capacity == 0 ? MAP_GROUP : (long)(map->len + 1) * 16 > (long)old_capacity * 7 ? old_capacity * 2 : old_capacity;
+    int i;
+
+    map->entries = runtimeAlloc(mapTableSize(capacity));
+    map->ctrl = (signed char*)(map->entries + capacity);
+    map->capacity = capacity;
+    map->growth_left = capacity - capacity / 8 - map->len;
+    memset(map->ctrl, MAP_EMPTY, capacity);
+
+    for (i = 0; i < old_capacity; i++) {
+        if (old_ctrl[i] >= 0) {
+            unsigned long hash = hashKey(slotValue(old_entries[i].key, mapKeyType(map->type)));
+            int slot = mapFreeSlot(map, hash);
+
+            map->ctrl[slot] = hashControl(hash);
+            map->entries[slot] = old_entries[i];
+        }
+    }
+
+    if (old_entries != NULL) {
+        runtimeFree(old_entries, mapTableSize(old_capacity));
+    }
+}
+
+/// @brief Returns the value of a key, without retaining it
+/// @param found Set to whether the key is in the map
+NodeValue mapGet(Map *map, NodeValue key, bool *found) {
+    int slot = mapFind(map, key, hashKey(key));
+
+    *found = slot != -1;
+
+    return slot != -1 ? mapValue(map, slot) : value_null;
+}
+
+/// @brief Sets the value of a key, adding the key if it isn't in the map yet. The map takes its own references
+void mapSet(Map *map, NodeValue key, NodeValue value) {
+    unsigned long hash = hashKey(key);
+    int slot = mapFind(map, key, hash);
+
+    retainValue(value);
+
+    if (slot != -1) {
+        releaseValue(mapValue(map, slot));
+        map->entries[slot].value.loc = value.loc;
+        return;
+    }
+
+    if (map->capacity == 0 || (map->growth_left == 0 && map->ctrl[mapFreeSlot(map, hash)] != MAP_DELETED)) {
+        mapResize(map);
+    }
+
+    slot = mapFreeSlot(map, hash);
+
+    if (map->ctrl[slot] == MAP_EMPTY) {
+        map->growth_left--;
+    }
+
+    retainValue(key);
+
+    map->ctrl[slot] = hashControl(hash);
+    map->entries[slot].key.loc = key.loc;
+    map->entries[slot].value.loc = value.loc;
+    map->len++;
+}
+
+/// @brief Removes a key and its value from a map
+/// @return Whether the key was in the map
+bool mapDelete(Map *map, NodeValue key) {
+    int slot = mapFind(map, key, hashKey(key));
+
+    if (slot == -1) {
+        return false;
+    }
+
+    NodeValue old_key = mapKey(map, slot);
+    NodeValue old_value = mapValue(map, slot);
+
+    // A group that still has an empty slot has never been probed past, so the slot can be empty again
+    if (matchGroup(map->ctrl + (slot & ~(MAP_GROUP - 1)), MAP_EMPTY) != 0) {
+        map->ctrl[slot] = MAP_EMPTY;
+        map->growth_left++;
+    } else {
+        map->ctrl[slot] = MAP_DELETED;
+    }
+
+    map->len--;
+
+    releaseValue(old_key);
+    releaseValue(old_value);
+
+    return true;
+}
+
+/// @brief Releases the keys and values of a map and frees its table
+void finalizeMap(Object *object) {
+    Map *map = (Map*)object;
+    int i;
+
+    for (i = 0; i < map->capacity; i++) {
+        if (map->ctrl[i] >= 0) {
+            releaseValue(mapKey(map, i));
+            releaseValue(mapValue(map, i));
+        }
+    }
+
+    if (map->entries != NULL) {
+        runtimeFree(map->entries, mapTableSize(map->capacity));
+    }
+}
+
+/// @brief Creates an empty map
+/// @param type The type of the map, see `mapType`
+/// @return A NodeValue holding the only reference to the new map
+NodeValue newMap(int type) {
+    Map *map = (Map*)newObject(sizeof(Map), finalizeMap);
+
+    map->type = type;
+    map->len = 0;
+    map->capacity = 0;
+    map->growth_left = 0;
+    map->entries = NULL;
+    map->ctrl = NULL;
+
+    return (NodeValue){.loc = map, .type = type};
+}
+
+#endif
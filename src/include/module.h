@@ -0,0 +1,363 @@
+#ifndef MODULE_IMPL
+
+#define MODULE_IMPL
+
+// Modules imported with `import "path.n";`. A module may only define functions and import other modules,
+// and its functions are linked into the program that imports it before the program is type checked.
+// Modules are loaded lazily: they're only read once the program calls a function it doesn't define itself,
+// and only parsed and linked once one of their functions is needed. Every module is lexed and parsed at most
+// once per process and cached by its canonical path and the hash of its contents, so a module imported by
+// many files, or the same file under different paths, is only loaded once.
+
+typedef struct Module {
+    char *path; // the canonical path
+    unsigned long hash; // FNV-1a of the contents
+    Astr text;
+    int file; // index into `sources`
+
+    Program program; // lexed when the module is first looked at
+    IntVec functions; // the intern ids of the functions it defines
+    IntVec imports; // the token indices of the paths it imports
+
+    bool parsed;
+    Ast ast; // parsed when one of its functions is first needed
+} Module;
+
+DEFINE_VEC(Modules, Module*)
+DEFINE_VEC(Imports, Token)
+
+Modules modules; // every module loaded by the process
+
+/// @brief The state of linking the modules a program needs into it
+typedef struct Linker {
+    Ast *ast;
+    Program program;
+
+    Imports imports; // the import tokens of the program and the modules linked so far, in order
+    ByteVec defined; // indexed by intern id, whether a function of that name is defined or has been looked for
+    ByteVec own; // indexed by intern id, whether the program itself defines a function of that name
+    IntVec wanted; // the intern ids of functions that are called but may not be defined yet
+    IntVec functions; // the linked functions, which become top-level statements
+} Linker;
+
+/// @brief Hashes a module's contents with 64-bit FNV-1a
+unsigned long hashModule(Astr text) {
+    unsigned long hash = 14695981039346656037ul;
+    int i;
+
+    for (i = 0; i < text.len; i++) {
+        hash ^= (unsigned char)text.str_ref[i];
+        hash *= 1099511628211ul;
+    }
+
+    return hash;
+}
+
+/// @brief Works out the canonical path of an imported module. Relative paths are relative to the importing file's directory
+/// @param import The Strliteral token of the import
+/// @return The path, or NULL if there's no such file
+char *resolveModule(Token *import) {
+    char *path = internedStr(import->value);
+    char *importer = sources.ref[import->file].path;
+    char *slash = strrchr(importer, '/');
+
+    if (path[0] == '/' || slash == NULL) {
+        return realpath(path, NULL);
+    }
+
+    int dir_len = slash - importer + 1;
+    char *joined = nmalloc(dir_len + strlen(path) + 1);
+
+    memcpy(joined, importer, dir_len);
+    strcpy(joined + dir_len, path);
+
+    char *resolved = realpath(joined, NULL);
+
+    nfree(joined);
+
+    return resolved;
+}
+
+/// @brief Finds the functions and imports of a freshly lexed module without parsing it
+void indexModule(Module *module) {
+    Token *tokens = module->program.ref;
+    int depth = 0;
+    int i;
+
+    module->functions = IntVec_new(16);
+    module->imports = IntVec_new(4);
+
+    for (i = 0; tokens[i].token_type != Tk_EOF; i++) {
+        if (tokens[i].token_type == Tk_Openbrace) {
+            depth++;
+        } else if (tokens[i].token_type == Tk_Closebrace) {
+            depth--;
+        } else if (depth == 0 && tokens[i].token_type == Tk_Type && tokens[i + 1].token_type == Tk_ID
+                   && tokens[i + 2].token_type == Tk_Openparen) {
+            IntVec_push(&module->functions, tokens[i + 1].value);
+        } else if (depth == 0 && tokens[i].token_type == Tk_Import && tokens[i + 1].token_type == Tk_Strliteral) {
+            IntVec_push(&module->imports, i + 1);
+        }
+    }
+}
+
+/// @brief Returns an imported module, reading and lexing it if no file with the same path or contents has been
+/// @param import The Strliteral token of the import
+Module *loadModule(Token *import) {
+    char *path = resolveModule(import);
+    int i;
+
+    if (path == NULL) {
+        Astr error_str = concat(_Astr("Cannot find module `"), _Astr(internedStr(import->value)));
+        error_str = concat(error_str, _Astr("`"));
+
+        reportError(import, "ImportError", AstrToStr(error_str));
+    }
+
+    for (i = 0; i < modules.len; i++) {
+        if (streq(modules.ref[i]->path, path)) {
+            free(path);
+            return modules.ref[i];
+        }
+    }
+
+    Astr text = fileToAstr(path);
+
+    if (text.str_ref == NULL) {
+        reportError(import, "ImportError", "Cannot read the module.");
+    }
+
+    unsigned long hash = hashModule(text);
+
+    // The same module under another path, like a copy or a link
+    for (i = 0; i < modules.len; i++) {
+        if (modules.ref[i]->hash == hash && modules.ref[i]->text.len == text.len
+            && bytesEqual(modules.ref[i]->text.str_ref, text.str_ref, text.len)) {
+            free(path);
+            return modules.ref[i];
+        }
+    }
+
+    Module *module = ncalloc(1, sizeof(Module));
+
+    module->path = nstrdup(path);
+    module->hash = hash;
+    module->text = text;
+    module->file = addSourceFile(module->path, text);
+    module->program = lexSource(module->file);
+    indexModule(module);
+    Modules_push(&modules, module);
+    free(path);
+
+    return module;
+}
+
+/// @brief Parses a module the first time one of its functions is needed
+void parseModule(Module *module) {
+    int i;
+
+    if (module->parsed) {
+        return;
+    }
+
+    module->ast = parse(module->program, NULL);
+    module->parsed = true;
+
+    for (i = 0; i < module->ast.child_count[0]; i++) {
+        int node = module->ast.first_child[0] + i;
+
+        if (module->ast.kind[node] != Node_Function && module->ast.kind[node] != Node_Import) {
+            reportError(AstNodeToken(&module->ast, module->program, node), "SyntaxError",
+                        "A module can only define functions and import other modules.");
+        }
+    }
+}
+
+/// @brief Returns the flag of an intern id in `flags`, growing it to fit new ids
+unsigned char *idFlag(ByteVec *flags, int id) {
+    while (flags->len <= id) {
+        ByteVec_push(flags, 0);
+    }
+
+    return flags->ref + id;
+}
+
+/// @brief Finds the module a function is linked from: the first import that defines it, in the order the imports
+/// were made. Imports made by linked modules come after the ones before them, so the owner of a name never changes
+/// @return The module, or NULL if the program defines the function itself or no import defines it
+Module *functionOwner(Linker *linker, int id) {
+    int i, j;
+
+    if (*idFlag(&linker->own, id)) {
+        return NULL;
+    }
+
+    for (i = 0; i < linker->imports.len; i++) {
+        Module *module = loadModule(linker->imports.ref + i);
+
+        for (j = 0; j < module->functions.len; j++) {
+            if (module->functions.ref[j] == id) {
+                return module;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/// @brief Adds the functions called under a node, including the ones named by a parallel builtin, to `linker->wanted`
+void collectCalls(Linker *linker, Ast *ast, Program program, int node) {
+    Token *token = AstNodeToken(ast, program, node);
+    int i;
+
+    if (ast->kind[node] == Node_Expr && token != NULL && token->token_type == Tk_Fncall) {
+        BuiltinEntry *builtin = findBuiltinEntry(internedStr(token->value));
+
+        if (builtin == NULL) {
+            IntVec_push(&linker->wanted, token->value);
+        } else if (builtin->callback != NULL) {
+            int args = getChildAst(ast, node, 0);
+
+            for (i = 0; i < ast->child_count[args]; i++) {
+                Token *arg = AstNodeToken(ast, program, ast->first_child[args] + i);
+
+                if (ast->kind[ast->first_child[args] + i] == Node_Value && arg->token_type == Tk_Strliteral) {
+                    IntVec_push(&linker->wanted, arg->value);
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < ast->child_count[node]; i++) {
+        collectCalls(linker, ast, program, ast->first_child[node] + i);
+    }
+}
+
+/// @brief Copies a module's tokens and nodes into the program, and queues the functions it calls and the modules it imports.
+/// Only the functions the module owns become top-level statements; ones the program or an earlier import also defines
+/// are left out, and calls to them go to the owner
+void linkModule(Linker *linker, Module *module) {
+    Ast *ast = linker->ast;
+    int first_token = linker->program.len;
+    int base = ast->len - 1; // module node n becomes node base + n, skipping its root
+    int i;
+
+    parseModule(module);
+
+    // The EOF token is copied too, but nothing refers to it
+    TokenList_append(&linker->program, module->program.ref, module->program.len);
+
+    for (i = 1; i < module->ast.len; i++) {
+        int token = module->ast.token[i];
+        int num_children = module->ast.child_count[i];
+
+        push_AstNode(ast, module->ast.kind[i], token == AST_NO_TOKEN ? AST_NO_TOKEN : first_token + token,
+                     num_children > 0 ? base + module->ast.first_child[i] : 0, num_children);
+    }
+
+    for (i = 0; i < module->ast.child_count[0]; i++) {
+        int node = module->ast.first_child[0] + i;
+
+        if (module->ast.kind[node] == Node_Function) {
+            int id = module->program.ref[module->ast.token[node]].value;
+
+            if (functionOwner(linker, id) == module) {
+                IntVec_push(&linker->functions, base + node);
+                *idFlag(&linker->defined, id) = true;
+                collectCalls(linker, &module->ast, module->program, node);
+            }
+        }
+    }
+
+    for (i = 0; i < module->imports.len; i++) {
+        Imports_push(&linker->imports, module->program.ref[module->imports.ref[i]]);
+    }
+}
+
+/// @brief Links the module that owns a function into the program
+/// @return Whether a module defines it
+bool linkFunction(Linker *linker, int id) {
+    Module *module = functionOwner(linker, id);
+
+    if (module == NULL) {
+        return false;
+    }
+
+    linkModule(linker, module);
+
+    return true;
+}
+
+/// @brief Links the functions a program needs from the modules it imports, directly or through other modules.
+/// A module is only read once the program calls something it doesn't define, and only parsed and linked once
+/// it defines something the program needs. Linked functions become top-level statements in front of the program's own
+/// @param ast The parsed program, which linked nodes are added to
+/// @param program The tokens the Ast refers to
+/// @return The tokens with the linked modules' tokens added, which may have moved
+Program linkImports(Ast *ast, Program program) {
+    int first_child = ast->first_child[0];
+    int num_statements = ast->child_count[0];
+    int i;
+
+    Linker linker = {
+        .ast = ast,
+        .program = program
+    };
+
+    for (i = 0; i < num_statements; i++) {
+        int node = first_child + i;
+
+        if (ast->kind[node] == Node_Import) {
+            Imports_push(&linker.imports, *AstNodeToken(ast, program, node));
+        } else if (ast->kind[node] == Node_Function) {
+            *idFlag(&linker.defined, program.ref[ast->token[node]].value) = true;
+            *idFlag(&linker.own, program.ref[ast->token[node]].value) = true;
+        }
+    }
+
+    if (linker.imports.len == 0) {
+        return program;
+    }
+
+    collectCalls(&linker, ast, program, 0);
+
+    while (linker.wanted.len > 0) {
+        int id = IntVec_pop(&linker.wanted);
+
+        // A function is only looked for once. One no module defines is left for the type checker to report
+        if (!*idFlag(&linker.defined, id)) {
+            *idFlag(&linker.defined, id) = true;
+            linkFunction(&linker, id);
+        }
+    }
+
+    if (linker.functions.len > 0) {
+        // The root's children have to be contiguous, so the linked functions and the program's statements are placed again after everything
+        int new_first_child = ast->len;
+
+        for (i = 0; i < linker.functions.len; i++) {
+            int node = linker.functions.ref[i];
+
+            push_AstNode(ast, ast->kind[node], ast->token[node], ast->first_child[node], ast->child_count[node]);
+        }
+
+        for (i = 0; i < num_statements; i++) {
+            int node = first_child + i;
+
+            push_AstNode(ast, ast->kind[node], ast->token[node], ast->first_child[node], ast->child_count[node]);
+        }
+
+        ast->first_child[0] = new_first_child;
+        ast->child_count[0] = linker.functions.len + num_statements;
+    }
+
+    Imports_free(&linker.imports);
+    ByteVec_free(&linker.defined);
+    ByteVec_free(&linker.own);
+    IntVec_free(&linker.wanted);
+    IntVec_free(&linker.functions);
+
+    return linker.program;
+}
+
+#endif
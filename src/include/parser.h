@@ -2,225 +2,573 @@
 
 #define PARSER_IMPL
 
-typedef struct AstChildren {
-    int capacity;
-    int length;
-    struct AstNode **loc;
-} AstChildren;
-
 typedef enum AstNodeType {
     Node_Root, // Currently only used for the root node
     Node_Expr, // node with 1+ children of Node_Expr or Node_Value
     Node_Args, // node with 0+ children of Node_Expr or Node_Value
-    Node_Declr, // Node with 2 children, a Node_Value type and a Node_Value id
+    Node_Declr, // Node with 1 child, a Node_Value type. The node's token is the id
     Node_Action, // Node with 2 children
-    Node_Value // node with no children
+    Node_Value, // node with no children
+    Node_Block, // node with 0+ statements as children
+    Node_While, // node with 2 children, the condition and a Node_Block
+    Node_Function, // node with 3 children: a Node_Value return type, a Node_Args of Node_Declr parameters and a Node_Block. The node's token is the name
+    Node_Return, // node with 0 or 1 children, the returned value
+    Node_Index, // node with 2 children, the array and the index
+    Node_Import, // node with no children. The node's token is the path of the module
+    Node_Binary, // node with 2 children, the operands. The node's token is the operator
+    Node_Unary // node with 1 child, the operand. The node's token is the operator
 } NodeType;
 
-typedef struct AstNode {
-    Token *token;
-
-    NodeType node_type;
-
-    AstChildren children;
-    struct AstNode *parent;
-} AstNode;
+#define AST_CAPACITY 256
+#define AST_NO_TOKEN -1
+
+/// @brief Every node of a program, stored as parallel arrays indexed by node id.
+///
+/// Node 0 is always the root. The children of a node occupy the contiguous range
+/// `[first_child, first_child + child_count)`, and tokens are referenced by their
+/// index into the Program, so the tree holds no pointers and can be copied or written out as-is.
+typedef struct Ast {
+    unsigned char *kind;
+    int *token;
+    int *first_child;
+    int *child_count;
+
+    int len;
+    int capacity;
+} Ast;
+
+/// @brief Allocates the arrays of an empty Ast, with node 0 reserved for the root
+/// @return The new Ast
+Ast init_Ast() {
+    Ast ast = {
+        .kind = nmalloc(AST_CAPACITY * sizeof(unsigned char)),
+        .token = nmalloc(AST_CAPACITY * sizeof(int)),
+        .first_child = nmalloc(AST_CAPACITY * sizeof(int)),
+        .child_count = nmalloc(AST_CAPACITY * sizeof(int)),
+        .len = 1,
+        .capacity = AST_CAPACITY
+    };
 
-/// @brief Adds an AstNode as a child to another given AstNode
-/// @param parent The AstNode to add the child to
-/// @param new_child The AstNode to be added as a child
-void addChildAst(AstNode *parent, AstNode *new_child) {
-    AstChildren *children = &(parent->children);
-    
-    children->length++;
+    ast.kind[0] = Node_Root;
+    ast.token[0] = AST_NO_TOKEN;
+    ast.first_child[0] = 0;
+    ast.child_count[0] = 0;
 
-    if (children->length > children->capacity) {
-        children->capacity *= 2;
-        children->loc = realloc(children->loc, children->capacity * sizeof(AstNode*));
-    }
-    
-    // Pointer arithmetic: advance by (index) elements, not bytes.
-    AstNode **insert_loc = (children->loc + (children->length - 1));
-    new_child->parent = parent;
-    *insert_loc = new_child;
+    return ast;
 }
 
-/// @brief Removes an AstNode's `index`th child
-/// @param parent The node to remove the child from
-/// @param index The index the child is at
-void removeChildAst(AstNode *parent, int index) {
-    if (parent->children.length == 0 || index >= parent->children.length || index < 0) {
-        return;
+/// @brief Appends a node to the end of an Ast
+/// @param ast The Ast to append to
+/// @param kind The NodeType of the new node
+/// @param token The index of the node's token, or AST_NO_TOKEN
+/// @param first_child The id of the node's first child
+/// @param child_count The number of children the node has
+/// @return The id of the new node
+int push_AstNode(Ast *ast, NodeType kind, int token, int first_child, int child_count) {
+    if (ast->len >= ast->capacity) {
+        // The columns share one length, so they grow together rather than as four vectors
+        ast->capacity = vecGrowCapacity(ast->capacity, ast->len + 1);
+        ast->kind = nrealloc(ast->kind, ast->capacity * sizeof(unsigned char));
+        ast->token = nrealloc(ast->token, ast->capacity * sizeof(int));
+        ast->first_child = nrealloc(ast->first_child, ast->capacity * sizeof(int));
+        ast->child_count = nrealloc(ast->child_count, ast->capacity * sizeof(int));
     }
 
-    parent->children.length--;
-    parent->children.loc[index] = NULL;
+    ast->kind[ast->len] = kind;
+    ast->token[ast->len] = token;
+    ast->first_child[ast->len] = first_child;
+    ast->child_count[ast->len] = child_count;
+
+    return ast->len++;
 }
 
-/// @brief Get's an AstNode's `index`th child
-/// @param parent The parent node to get the child from
+/// @brief Get's a node's `index`th child
+/// @param ast The Ast the node belongs to
+/// @param node The id of the parent node
 /// @param index The index of the child
-/// @return The child at `index`
-AstNode *getChildAst(AstNode parent, int index) {
-    if (index < 0 || index >= parent.children.length) {
-        return (AstNode*)(-1);
+/// @return The id of the child at `index`, or -1 if there is none
+int getChildAst(Ast *ast, int node, int index) {
+    if (index < 0 || index >= ast->child_count[node]) {
+        return -1;
     }
 
-    if (parent.children.loc == NULL) {
-        return (AstNode*)(-1);
+    return ast->first_child[node] + index;
+}
+
+/// @brief Returns the token of a node
+/// @param ast The Ast the node belongs to
+/// @param program The Program the Ast was parsed from
+/// @param node The id of the node
+/// @return A pointer to the node's token, or NULL if it has none
+Token *AstNodeToken(Ast *ast, Program program, int node) {
+    if (ast->token[node] == AST_NO_TOKEN) {
+        return NULL;
     }
 
-    return parent.children.loc[index];
+    return program.ref + ast->token[node];
 }
 
-/// @brief Allocates and initializes an AstNode
-/// @return A pointer to the new node
-AstNode *new_AstNode() {
-    AstNode *node = calloc(1, sizeof(AstNode));
-    node->children.loc = malloc(sizeof(AstNode*));
-    node->children.capacity = 1;
-    node->children.length = 0;
-    
-    return node;
-}
+// A node whose children have been placed in the Ast, but which hasn't been placed itself yet
+typedef struct PendingNode {
+    NodeType kind;
+    int token;
+    int first_child;
+    int child_count;
+} PendingNode;
+
+DEFINE_VEC(PendingNodes, PendingNode)
+
+#define PENDING_CAPACITY 64
+
+/// @brief The tokens and nodes of a top-level statement, so it can be parsed again on its own
+typedef struct StatementSpan {
+    int first_token;
+    int end_token; // one past the statement's last token
+
+    // The nodes below the statement. The statement's own node is one of the root's children
+    int first_node;
+    int end_node;
+} StatementSpan;
+
+DEFINE_VEC(StatementSpans, StatementSpan)
 
 // Stores useful info about the current parser state
 typedef struct ParserState {
-    bool inExpr;
-    bool inArgs;
+    Program program;
+    int loc;
 
-    AstNode *node_ref;
-    int node_ref_index;
-    AstNode *scope_ref;
+    Ast ast;
+    PendingNodes pending;
 } Parsestate;
 
-/// @brief Parses a program (list of tokens) into an Abstract Syntax Tree
-/// @param program The list of tokens to convert into AST
-/// @return The root node of the AST
-AstNode *parse(Program program) {
-    AstNode *root = new_AstNode();
-    AstNode *current_node = root; 
+/// @brief Pushes a node with no children onto the pending stack
+/// @param state The parser state
+/// @param kind The NodeType of the node
+/// @param token The index of the node's token
+void pushPending(Parsestate *state, NodeType kind, int token) {
+    PendingNodes_push(&state->pending, (PendingNode){
+        .kind = kind,
+        .token = token,
+        .first_child = 0,
+        .child_count = 0
+    });
+}
 
-    root->node_type = Node_Root;
-    root->token = NULL;
-    root->parent = NULL;
+/// @brief Places the top `num_children` pending nodes into the Ast next to each other, then pushes their parent as a pending node
+/// @param state The parser state
+/// @param kind The NodeType of the parent
+/// @param token The index of the parent's token
+/// @param num_children How many pending nodes belong to the parent
+void reduceNode(Parsestate *state, NodeType kind, int token, int num_children) {
+    int first_child = state->ast.len;
+    int i;
+
+    for (i = state->pending.len - num_children; i < state->pending.len; i++) {
+        PendingNode child = state->pending.ref[i];
+        push_AstNode(&state->ast, child.kind, child.token, child.first_child, child.child_count);
+    }
 
-    Parsestate state = {
-        .inArgs = false,
-        .inExpr = false,
-        .node_ref = NULL,
-        .scope_ref = root
-    };
+    state->pending.len -= num_children;
+    pushPending(state, kind, token);
+    state->pending.ref[state->pending.len - 1].first_child = first_child;
+    state->pending.ref[state->pending.len - 1].child_count = num_children;
+}
 
-    Token *current_token = program.ref;
-    Token *prev_token = NULL;
-    int loc = 0;
+/// @brief Returns the token the parser is currently on
+Token *currentToken(Parsestate *state) {
+    return TokenAtIndex(state->program, state->loc);
+}
 
-    while (current_token->token_type != Tk_EOF) {
-        // printf("current node: %d, tt: %s\n", current_node->node_type, TokenTypeRepr(current_token->token_type));
+/// @brief Reports an error if the current token isn't of type `token_type`, otherwise moves past it
+/// @param state The parser state
+/// @param token_type The TokenType that is expected
+/// @param errorMsg The message to report if the token is missing
+void expectToken(Parsestate *state, TokenType token_type, char *errorMsg) {
+    if (currentToken(state)->token_type != token_type) {
+        reportError(currentToken(state), "SyntaxError", errorMsg);
+    }
 
-        if (current_token->token_type == Tk_ID) {
-            AstNode *new = new_AstNode();
-            bool declaration = false;
+    state->loc++;
+}
 
-            if (prev_token != NULL) { 
-                declaration = (prev_token->token_type == Tk_Type);
-            }
+void parseExpr(Parsestate *state);
 
-            new->token = current_token;
-            new->node_type = declaration ? Node_Declr : Node_Value;
-            state.node_ref = new;
-            state.node_ref_index = current_node->children.length + 1;
+/// @brief Parses the arguments of a function call, up to and including the closing paren
+/// @param state The parser state
+/// @return The number of arguments parsed
+int parseArgs(Parsestate *state) {
+    int num_args = 0;
 
-            if (declaration) {
-                AstNode *type_node = new_AstNode();
+    while (currentToken(state)->token_type != Tk_Closeparen) {
+        if (currentToken(state)->token_type == Tk_EOF) {
+            reportError(currentToken(state), "SyntaxError", "Unclosed argument list.");
+        }
 
-                type_node->token = prev_token;
-                type_node->node_type = Node_Value;
+        if (num_args > 0) {
+            expectToken(state, Tk_Comma, "Expected `,` between arguments.");
+        }
 
-                addChildAst(new, type_node);
-            }
+        parseExpr(state);
+        num_args++;
+    }
 
-            addChildAst(current_node, new);
-        }
+    state->loc++;
 
-        else if (current_token->token_type == Tk_Assign) {
-            AstNode *new = new_AstNode();
-            new->token = current_token;
-            new->node_type = Node_Action;
-            
-            if (state.node_ref == NULL) {
-                reportError(current_token, "SyntaxError", "Improper assignment.");
-                exit(1); 
+    return num_args;
+}
+
+void parsePrimary(Parsestate *state);
+
+/// @brief Returns how tightly a binary operator binds, or 0 if the token isn't one
+int binaryPrecedence(TokenType token_type) {
+    switch (token_type) {
+        case Tk_Or:
+            return 1;
+        case Tk_And:
+            return 2;
+        case Tk_Equal:
+        case Tk_NotEqual:
+            return 3;
+        case Tk_Less:
+        case Tk_LessEqual:
+        case Tk_Greater:
+        case Tk_GreaterEqual:
+            return 4;
+        case Tk_Plus:
+        case Tk_Minus:
+            return 5;
+        case Tk_Star:
+        case Tk_Slash:
+        case Tk_Percent:
+            return 6;
+        default:
+            return 0;
+    }
+}
+
+void parseOperand(Parsestate *state);
+
+/// @brief Parses an expression whose binary operators all bind at least as tightly as `min_precedence`.
+/// Every operand is parsed before its operator's node is reduced, so each node is placed once, in a single pass
+/// @param state The parser state
+/// @param min_precedence The precedence of the loosest operator that belongs to this expression
+void parseBinary(Parsestate *state, int min_precedence) {
+    int precedence;
+
+    parseOperand(state);
+
+    while ((precedence = binaryPrecedence(currentToken(state)->token_type)) >= min_precedence) {
+        int index = state->loc;
+
+        state->loc++;
+
+        // Operators are left associative, so the right operand only takes operators that bind tighter
+        parseBinary(state, precedence + 1);
+        reduceNode(state, Node_Binary, index, 2);
+    }
+}
+
+/// @brief Parses an expression, including any binary operators in it
+/// @param state The parser state
+void parseExpr(Parsestate *state) {
+    parseBinary(state, 1);
+}
+
+/// @brief Parses an operand of a binary operator: a negated or inverted operand, or a single expression
+/// (a literal, an id, a function call or a parenthesized expression) and any indexing after it
+/// @param state The parser state
+void parseOperand(Parsestate *state) {
+    int index = state->loc;
+
+    if (currentToken(state)->token_type == Tk_Minus || currentToken(state)->token_type == Tk_Not) {
+        state->loc++;
+        parseOperand(state);
+        reduceNode(state, Node_Unary, index, 1);
+        return;
+    }
+
+    parsePrimary(state);
+
+    while (currentToken(state)->token_type == Tk_Openbracket) {
+        int index = state->loc;
+
+        state->loc++;
+        parseExpr(state);
+        expectToken(state, Tk_Closebracket, "Expected `]`.");
+        reduceNode(state, Node_Index, index, 2);
+    }
+}
+
+/// @brief Parses an expression that isn't indexed
+/// @param state The parser state
+void parsePrimary(Parsestate *state) {
+    int index = state->loc;
+    Token *token = currentToken(state);
+
+    state->loc++;
+
+    switch (token->token_type) {
+        case Tk_Intliteral:
+        case Tk_Floatliteral:
+        case Tk_Charliteral:
+        case Tk_Strliteral:
+            pushPending(state, Node_Value, index);
+            return;
+        case Tk_ID:
+        case Tk_Fncall: // already marked when a statement is parsed again
+            if (currentToken(state)->token_type == Tk_Openparen) {
+                int args_index = state->loc;
+
+                state->loc++;
+                token->token_type = Tk_Fncall;
+
+                reduceNode(state, Node_Args, args_index, parseArgs(state));
+                reduceNode(state, Node_Expr, index, 1);
+                return;
             }
 
-            removeChildAst(current_node, state.node_ref_index);
-            addChildAst(new, state.node_ref);
-            addChildAst(current_node, new);
+            token->token_type = Tk_ID;
+            pushPending(state, Node_Value, index);
+            return;
+        case Tk_Openparen:
+            parseExpr(state);
+            expectToken(state, Tk_Closeparen, "Expected `)`.");
+            reduceNode(state, Node_Expr, index, 1);
+            return;
+        default:
+            reportError(token, "SyntaxError", "Expected an expression.");
+    }
+}
+
+void parseStatement(Parsestate *state);
+
+/// @brief Parses a block of statements between braces
+/// @param state The parser state
+void parseBlock(Parsestate *state) {
+    int index = state->loc;
+    int num_statements = 0;
+
+    expectToken(state, Tk_Openbrace, "Expected `{`.");
 
-            state.node_ref = NULL;
+    while (currentToken(state)->token_type != Tk_Closebrace) {
+        if (currentToken(state)->token_type == Tk_EOF) {
+            reportError(TokenAtIndex(state->program, index), "SyntaxError", "Unclosed block.");
         }
 
-        else if (current_token->token_type == Tk_Openparen) {
-            AstNode *new = new_AstNode();
-            new->token = current_token;
-            new->node_type = Node_Expr;
+        if (currentToken(state)->token_type == Tk_Semicolon) {
+            state->loc++;
+            continue;
+        }
 
-            if (prev_token != NULL) {
-                if (prev_token->token_type == Tk_ID) {
-                    new->node_type = Node_Args;
-                    state.inArgs = true;
-                }
-            }
+        parseStatement(state);
+        num_statements++;
+    }
 
-            if (state.inArgs) {
-                addChildAst(state.node_ref, new);
-                state.node_ref->token->token_type = Tk_Fncall;
-                state.node_ref->node_type = Node_Expr;
-            } else {
-                addChildAst(current_node, new);
-            }
-            
-            current_node = new;
+    state->loc++;
+    reduceNode(state, Node_Block, index, num_statements);
+}
+
+/// @brief Parses a function definition, starting at its return type
+/// @param state The parser state
+void parseFunction(Parsestate *state) {
+    int index = state->loc;
+    int params_index = index + 2;
+    int num_params = 0;
+
+    pushPending(state, Node_Value, index);
+    state->loc += 3;
+
+    while (currentToken(state)->token_type != Tk_Closeparen) {
+        if (num_params > 0) {
+            expectToken(state, Tk_Comma, "Expected `,` between parameters.");
         }
 
-        else if (current_token->token_type == Tk_Strliteral) {
-            AstNode *new = new_AstNode();
-            new->token = current_token;
-            new->node_type = Node_Value;
-            // printf("str literal: %s\n", TokenTypeRepr(new->token->token_type));
+        if (currentToken(state)->token_type != Tk_Type || TokenAtIndex(state->program, state->loc + 1)->token_type != Tk_ID) {
+            reportError(currentToken(state), "SyntaxError", "Expected a parameter type and name.");
+        }
 
-            addChildAst(current_node, new);
+        pushPending(state, Node_Value, state->loc);
+        reduceNode(state, Node_Declr, state->loc + 1, 1);
+        state->loc += 2;
+        num_params++;
+    }
+
+    state->loc++;
+    reduceNode(state, Node_Args, params_index, num_params);
+
+    parseBlock(state);
+    reduceNode(state, Node_Function, index + 1, 3);
+}
+
+/// @brief Parses a while loop
+/// @param state The parser state
+void parseWhile(Parsestate *state) {
+    int index = state->loc;
+
+    state->loc++;
+    expectToken(state, Tk_Openparen, "Expected `(` after `while`.");
+    parseExpr(state);
+    expectToken(state, Tk_Closeparen, "Expected `)`.");
+
+    parseBlock(state);
+    reduceNode(state, Node_While, index, 2);
+}
+
+/// @brief Parses a statement (a declaration, an assignment, a return, a loop, a function definition or an expression).
+/// Statements that don't end with a block end with a semicolon
+/// @param state The parser state
+void parseStatement(Parsestate *state) {
+    int index = state->loc;
+    Token *token = currentToken(state);
+
+    if (token->token_type == Tk_Type && TokenAtIndex(state->program, index + 1)->token_type == Tk_ID
+        && TokenAtIndex(state->program, index + 2)->token_type == Tk_Openparen) {
+        parseFunction(state);
+        return;
+    }
+
+    if (token->token_type == Tk_While) {
+        parseWhile(state);
+        return;
+    }
+
+    if (token->token_type == Tk_Import) {
+        reportError(token, "SyntaxError", "Modules can only be imported at the top level.");
+    }
+
+    if (token->token_type == Tk_Return) {
+        state->loc++;
+
+        if (currentToken(state)->token_type == Tk_Semicolon) {
+            reduceNode(state, Node_Return, index, 0);
+        } else {
+            parseExpr(state);
+            reduceNode(state, Node_Return, index, 1);
+        }
+    }
+
+    else if (token->token_type == Tk_Type) {
+        if (TokenAtIndex(state->program, index + 1)->token_type != Tk_ID) {
+            reportError(token, "SyntaxError", "Expected an identifier after the type.");
         }
 
-        else if (current_token->token_type == Tk_Intliteral) {
-            AstNode *new = new_AstNode();
-            new->token = current_token;
-            new->node_type = Node_Value;
-            // printf("str literal: %s\n", TokenTypeRepr(new->token->token_type));
+        pushPending(state, Node_Value, index);
+        reduceNode(state, Node_Declr, index + 1, 1);
+        state->loc += 2;
 
-            addChildAst(current_node, new);
+        if (currentToken(state)->token_type == Tk_Assign) {
+            int assign_index = state->loc;
+
+            state->loc++;
+            parseExpr(state);
+            reduceNode(state, Node_Action, assign_index, 2);
         }
+    }
 
-        else if (current_token->token_type == Tk_Closeparen) {
-            if (state.inExpr) {
-                state.inExpr = false;
-            }
-            if (state.inArgs) {
-                state.inArgs = false;
-            }
+    else if (token->token_type == Tk_ID && TokenAtIndex(state->program, index + 1)->token_type == Tk_Assign) {
+        pushPending(state, Node_Value, index);
+        state->loc += 2;
+        parseExpr(state);
+        reduceNode(state, Node_Action, index + 1, 2);
+    }
+
+    else if (token->token_type == Tk_Assign) {
+        reportError(token, "SyntaxError", "Improper assignment.");
+    }
+
+    else {
+        parseExpr(state);
+
+        // An indexed array can be assigned to
+        if (currentToken(state)->token_type == Tk_Assign && state->pending.ref[state->pending.len - 1].kind == Node_Index) {
+            int assign_index = state->loc;
+
+            state->loc++;
+            parseExpr(state);
+            reduceNode(state, Node_Action, assign_index, 2);
         }
+    }
+
+    expectToken(state, Tk_Semicolon, "Expected `;`.");
+}
+
+/// @brief Parses a top-level statement, leaving it pending, and skips the semicolons after it
+/// @param state The parser state
+/// @param spans Where to record the statement's span, or NULL
+void parseTopLevelStatement(Parsestate *state, StatementSpans *spans) {
+    StatementSpan span = {
+        .first_token = state->loc,
+        .first_node = state->ast.len
+    };
+
+    if (currentToken(state)->token_type == Tk_Import) {
+        state->loc++;
 
-        else if (current_token->token_type == Tk_Semicolon) {
-            current_node = state.scope_ref;
+        if (currentToken(state)->token_type != Tk_Strliteral) {
+            reportError(currentToken(state), "SyntaxError", "Expected the path of a module after `import`.");
         }
 
-        loc++;
-        prev_token = current_token;
-        current_token = TokenAtIndex(program, loc);
+        pushPending(state, Node_Import, state->loc);
+        state->loc++;
+        expectToken(state, Tk_Semicolon, "Expected `;`.");
+    } else {
+        parseStatement(state);
+    }
+
+    span.end_token = state->loc;
+    span.end_node = state->ast.len;
+
+    if (spans != NULL) {
+        StatementSpans_push(spans, span);
+    }
+
+    while (currentToken(state)->token_type == Tk_Semicolon) {
+        state->loc++;
+    }
+}
+
+/// @brief Places every pending statement into the Ast as the root's children
+/// @param state The parser state
+void placeRootChildren(Parsestate *state) {
+    int first_child = state->ast.len;
+    int i;
+
+    for (i = 0; i < state->pending.len; i++) {
+        PendingNode child = state->pending.ref[i];
+        push_AstNode(&state->ast, child.kind, child.token, child.first_child, child.child_count);
+    }
+
+    state->ast.first_child[0] = first_child;
+    state->ast.child_count[0] = state->pending.len;
+    state->pending.len = 0;
+}
+
+/// @brief Parses a program (list of tokens) into an Abstract Syntax Tree
+/// @param program The list of tokens to convert into AST
+/// @param spans Where to record the span of every top-level statement, or NULL
+/// @return The Ast, with the root at node 0
+Ast parse(Program program, StatementSpans *spans) {
+    Parsestate state = {
+        .program = program,
+        .loc = 0,
+        .ast = init_Ast(),
+        .pending = PendingNodes_new(PENDING_CAPACITY)
+    };
+
+    while (currentToken(&state)->token_type == Tk_Semicolon) {
+        state.loc++;
     }
 
-    return root;
+    while (currentToken(&state)->token_type != Tk_EOF) {
+        parseTopLevelStatement(&state, spans);
+    }
+
+    // Every statement is still pending, so they become the root's children
+    placeRootChildren(&state);
+
+    PendingNodes_free(&state.pending);
+
+    return state.ast;
 }
 
-#endif
\ No newline at end of file
+#endif
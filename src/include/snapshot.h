@@ -0,0 +1,653 @@
+#ifndef SNAPSHOT_IMPL
+
+#define SNAPSHOT_IMPL
+
+#define SNAPSHOT_MAGIC "NITROIMG"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_BUILD __DATE__ " " __TIME__ // when this build was compiled, images are only valid for the build that wrote them
+#define SNAPSHOT_ALIGN 64 // every section starts on a cache line, which also keeps array data ARRAY_ALIGN-aligned
+
+/// @brief Where a section of an image is, as an offset from the start of the image
+typedef struct SnapshotSection {
+    long offset;
+    long count;
+} SnapshotSection;
+
+/// @brief The start of an image. An image holds no pointers, only offsets from its start, so it can be mapped anywhere
+typedef struct SnapshotHeader {
+    char magic[8];
+    int version;
+    char build[24]; // SNAPSHOT_BUILD of the build that wrote the image
+    unsigned long checksum; // see `snapshotChecksum`
+    int token_size;
+    int slot_size;
+
+    int first_statement; // the top-level statement to continue from
+
+    SnapshotSection sources; // SnapshotSources
+    SnapshotSection strings; // SnapshotStrings, in intern id order
+    SnapshotSection buckets; // the intern table's buckets
+    SnapshotSection float_literals;
+
+    SnapshotSection tokens;
+    SnapshotSection ast_kind;
+    SnapshotSection ast_token;
+    SnapshotSection ast_first_child;
+    SnapshotSection ast_child_count;
+
+    SnapshotSection node_types;
+    SnapshotSection node_slots;
+    SnapshotSection node_globals;
+    SnapshotSection node_functions;
+    SnapshotSection slot_types;
+    SnapshotSection functions; // FunctionInfos whose slot_types point into the image
+    int max_frame_slots;
+
+    SnapshotSection globals; // Slots, with strings as intern ids plus 1 and arrays and maps as offsets
+} SnapshotHeader;
+
+typedef struct SnapshotSource {
+    long path;
+    long text;
+    int text_len;
+} SnapshotSource;
+
+typedef struct SnapshotString {
+    long offset;
+    int len;
+} SnapshotString;
+
+/// @brief How a map is stored in an image. Maps grow, so unlike arrays they aren't used in place, but built again from their entries
+typedef struct SnapshotMap {
+    Map *restored; // NULL in the image, then the map that's been built from it, so every global holding it gets the same one
+    int len;
+    long entries; // the MapEntries, with strings as intern ids plus 1
+} SnapshotMap;
+
+typedef struct SnapshotArray {
+    Object *object; // an Array or a Map
+    long offset;
+} SnapshotArray;
+
+DEFINE_VEC(SnapshotArrays, SnapshotArray)
+
+/// @brief An image being written
+typedef struct SnapshotWriter {
+    ByteVec image;
+
+    // The arrays and maps written so far, so one held by several globals is written once.
+    // There are at most as many as there are globals, so they're searched linearly
+    SnapshotArrays arrays;
+} SnapshotWriter;
+
+/// @brief Appends data to an image, starting at the next SNAPSHOT_ALIGN boundary
+/// @param count The number of items in the data, stored in the section
+/// @return Where the data is in the image
+SnapshotSection snapshotAppend(SnapshotWriter *writer, const void *data, long size, long count) {
+    long offset = (writer->image.len + SNAPSHOT_ALIGN - 1) & ~(long)(SNAPSHOT_ALIGN - 1);
+
+    ByteVec_reserve(&writer->image, offset + size);
+    memset(writer->image.ref + writer->image.len, 0, offset - writer->image.len);
+
+    if (size > 0) {
+        memcpy(writer->image.ref + offset, data, size);
+    }
+
+    writer->image.len = offset + size;
+
+    return (SnapshotSection){.offset = offset, .count = count};
+}
+
+/// @brief Returns the checksum of an image: `hashBytes` of the whole image, with the header's `checksum` taken as 0
+unsigned long snapshotChecksum(char *image, int size) {
+    SnapshotHeader *header = (SnapshotHeader*)image;
+    unsigned long stored = header->checksum;
+
+    header->checksum = 0;
+
+    unsigned long checksum = hashBytes(image, size);
+
+    header->checksum = stored;
+
+    return checksum;
+}
+
+/// @brief Returns how a string is stored in an image: the intern id of its characters plus 1, or 0 for NULL
+long snapshotStringId(String *string) {
+    return string == NULL ? 0 : internAstr((Astr){.str_ref = stringChars(string), .len = string->len}) + 1;
+}
+
+/// @brief Appends an array to an image, unless it has been appended already
+/// @return Where the array's header is in the image
+long snapshotArray(SnapshotWriter *writer, Array *array, int type) {
+    SnapshotArray *written;
+
+    vecForEach(&writer->arrays, written) {
+        if (written->object == (Object*)array) {
+            return written->offset;
+        }
+    }
+
+    void *elements = array->data;
+    int i;
+
+    // Like string globals, the strings of a `string[]` are stored as the intern id of their characters plus 1
+    if (type == Type_ptr_str) {
+        elements = nmalloc((array->len > 0 ? array->len : 1) * sizeof(void*));
+
+        for (i = 0; i < array->len; i++) {
+            ((long*)elements)[i] = snapshotStringId(((String**)array->data)[i]);
+        }
+    }
+
+    // The data goes first, so the header can point at it. A refcount of 0 marks the header as not relocated yet
+    long data = snapshotAppend(writer, elements, array->len * elementSize(type), array->len).offset;
+
+    if (elements != array->data) {
+        nfree(elements);
+    }
+
+    Array header = {.object = {.refcount = 0, .size = sizeof(Array), .finalize = NULL}, .len = array->len, .data = (void*)data};
+    long offset = snapshotAppend(writer, &header, sizeof(Array), 1).offset;
+
+    SnapshotArrays_push(&writer->arrays, (SnapshotArray){.object = (Object*)array, .offset = offset});
+
+    return offset;
+}
+
+/// @brief Appends the entries of a map to an image, unless they have been appended already
+/// @return Where the map's SnapshotMap is in the image
+long snapshotMap(SnapshotWriter *writer, Map *map) {
+    SnapshotArray *written;
+    int len = 0;
+    int i;
+
+    vecForEach(&writer->arrays, written) {
+        if (written->object == (Object*)map) {
+            return written->offset;
+        }
+    }
+
+    MapEntry *entries = nmalloc((map->len > 0 ? map->len : 1) * sizeof(MapEntry));
+
+    for (i = 0; i < map->capacity; i++) {
+        if (map->ctrl[i] >= 0) {
+            entries[len] = map->entries[i];
+
+            if (mapKeyType(map->type) == Type_str) {
+                entries[len].key.loc = (void*)snapshotStringId(map->entries[i].key.loc);
+            }
+
+            if (mapValueType(map->type) == Type_str) {
+                entries[len].value.loc = (void*)snapshotStringId(map->entries[i].value.loc);
+            }
+
+            len++;
+        }
+    }
+
+    SnapshotMap record = {.restored = NULL, .len = len, .entries = snapshotAppend(writer, entries, len * sizeof(MapEntry), len).offset};
+    long offset = snapshotAppend(writer, &record, sizeof(SnapshotMap), 1).offset;
+
+    nfree(entries);
+    SnapshotArrays_push(&writer->arrays, (SnapshotArray){.object = (Object*)map, .offset = offset});
+
+    return offset;
+}
+
+/// @brief Interns the characters of the strings a global holds, directly or in an array or a map,
+/// so they're in the string table before it's written
+void internSnapshotStrings(NodeValue global) {
+    int i;
+
+    if (global.loc == NULL) {
+        return;
+    }
+
+    if (global.type == Type_str) {
+        snapshotStringId(global.loc);
+    } else if (global.type == Type_ptr_str) {
+        for (i = 0; i < arrayLen(global); i++) {
+            snapshotStringId(arrayStrings(global)[i]);
+        }
+    } else if (typeIsMap(global.type)) {
+        Map *map = global.loc;
+
+        for (i = 0; i < map->capacity; i++) {
+            if (map->ctrl[i] >= 0 && mapKeyType(map->type) == Type_str) {
+                snapshotStringId(map->entries[i].key.loc);
+            }
+
+            if (map->ctrl[i] >= 0 && mapValueType(map->type) == Type_str) {
+                snapshotStringId(map->entries[i].value.loc);
+            }
+        }
+    }
+}
+
+/// @brief Writes the state of a program between two top-level statements to `snapshot_path` and exits.
+/// Everything the program needs to continue is written, so `restoreSnapshot` doesn't lex, parse or type check anything
+/// @param state The Interpreter state, at the top level
+/// @param resume_at The top-level statement to continue from
+void takeSnapshot(InterpreterState *state, int resume_at) {
+    SnapshotWriter writer = {0};
+    SnapshotHeader header = {
+        .version = SNAPSHOT_VERSION,
+        .token_size = sizeof(Token),
+        .slot_size = sizeof(Slot),
+        .first_statement = resume_at,
+        .max_frame_slots = state->types->max_frame_slots
+    };
+    TypeInfo *types = state->types;
+    Ast *ast = state->ast;
+    int i;
+
+    // Open files and I/O operations live in other threads and the kernel, which an image can't hold
+    if (io_files.len > 0) {
+        reportError(state->call_token, "SnapshotError", "Cannot take a snapshot of a program that has opened files.");
+    }
+
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    strncpy(header.build, SNAPSHOT_BUILD, sizeof(header.build) - 1);
+    snapshotAppend(&writer, &header, sizeof(header), 1);
+
+    // Strings are stored as the intern id of their characters plus 1, so they're interned before the table is written
+    for (i = 0; i < types->slot_types.len; i++) {
+        internSnapshotStrings(slotValue(state->stack[i], types->slot_types.ref[i]));
+    }
+
+    SnapshotSource source_records[sources.len > 0 ? sources.len : 1];
+
+    for (i = 0; i < sources.len; i++) {
+        source_records[i].path = snapshotAppend(&writer, sources.ref[i].path, strlen(sources.ref[i].path) + 1, 1).offset;
+        source_records[i].text = snapshotAppend(&writer, sources.ref[i].text.str_ref, sources.ref[i].text.len, 1).offset;
+        source_records[i].text_len = sources.ref[i].text.len;
+    }
+
+    header.sources = snapshotAppend(&writer, source_records, sources.len * sizeof(SnapshotSource), sources.len);
+
+    SnapshotString *string_records = nmalloc((interned.strs.len > 0 ? interned.strs.len : 1) * sizeof(SnapshotString));
+
+    for (i = 0; i < interned.strs.len; i++) {
+        string_records[i].offset = snapshotAppend(&writer, interned.strs.ref[i].str_ref, interned.strs.ref[i].len + 1, 1).offset;
+        string_records[i].len = interned.strs.ref[i].len;
+    }
+
+    header.strings = snapshotAppend(&writer, string_records, interned.strs.len * sizeof(SnapshotString), interned.strs.len);
+    header.buckets = snapshotAppend(&writer, interned.buckets, interned.num_buckets * sizeof(int), interned.num_buckets);
+    header.float_literals = snapshotAppend(&writer, float_literals.ref, float_literals.len * sizeof(double), float_literals.len);
+    nfree(string_records);
+
+    header.tokens = snapshotAppend(&writer, state->program.ref, state->program.len * sizeof(Token), state->program.len);
+    header.ast_kind = snapshotAppend(&writer, ast->kind, ast->len * sizeof(unsigned char), ast->len);
+    header.ast_token = snapshotAppend(&writer, ast->token, ast->len * sizeof(int), ast->len);
+    header.ast_first_child = snapshotAppend(&writer, ast->first_child, ast->len * sizeof(int), ast->len);
+    header.ast_child_count = snapshotAppend(&writer, ast->child_count, ast->len * sizeof(int), ast->len);
+
+    header.node_types = snapshotAppend(&writer, types->node_types, ast->len * sizeof(unsigned char), ast->len);
+    header.node_slots = snapshotAppend(&writer, types->node_slots, ast->len * sizeof(int), ast->len);
+    header.node_globals = snapshotAppend(&writer, types->node_globals, ast->len * sizeof(unsigned char), ast->len);
+    header.node_functions = snapshotAppend(&writer, types->node_functions, ast->len * sizeof(int), ast->len);
+    header.slot_types = snapshotAppend(&writer, types->slot_types.ref, types->slot_types.len, types->slot_types.len);
+
+    FunctionInfo function_records[types->functions.len > 0 ? types->functions.len : 1];
+
+    for (i = 0; i < types->functions.len; i++) {
+        FunctionInfo *function = types->functions.ref + i;
+
+        function_records[i] = *function;
+        function_records[i].slot_types.ref = (void*)snapshotAppend(&writer, function->slot_types.ref, function->slot_types.len, function->slot_types.len).offset;
+        function_records[i].slot_types.capacity = function->slot_types.len;
+    }
+
+    header.functions = snapshotAppend(&writer, function_records, types->functions.len * sizeof(FunctionInfo), types->functions.len);
+
+    Slot globals[types->slot_types.len > 0 ? types->slot_types.len : 1];
+
+    for (i = 0; i < types->slot_types.len; i++) {
+        Slot slot = state->stack[i];
+        int type = types->slot_types.ref[i];
+
+        if (type == Type_str) {
+            globals[i].loc = (void*)snapshotStringId(slot.loc);
+        } else if (typeIsMap(type) && slot.loc != NULL) {
+            globals[i].loc = (void*)snapshotMap(&writer, slot.loc);
+        } else if (typeIsObject(type) && slot.loc != NULL) {
+            globals[i].loc = (void*)snapshotArray(&writer, slot.loc, type);
+        } else {
+            globals[i] = slot;
+        }
+    }
+
+    header.globals = snapshotAppend(&writer, globals, types->slot_types.len * sizeof(Slot), types->slot_types.len);
+    memcpy(writer.image.ref, &header, sizeof(header));
+    ((SnapshotHeader*)writer.image.ref)->checksum = snapshotChecksum((char*)writer.image.ref, writer.image.len);
+
+    FILE *image = fopen(snapshot_path, "wb");
+
+    if (image == NULL || fwrite(writer.image.ref, 1, writer.image.len, image) != (size_t)writer.image.len || fclose(image) != 0) {
+        reportError(NULL, "SnapshotError", AstrToStr(concat(_Astr("Could not write the image "), _Astr(snapshot_path))));
+    }
+
+    fflush(stdout);
+    fprintf(stderr, "Wrote a snapshot of %d bytes to %s\n", writer.image.len, snapshot_path);
+
+    // The snapshot run ends here, so the program's objects are left for the OS to free
+    exit(0);
+}
+
+/// @brief The program a snapshot was taken of, ready to run
+typedef struct RestoredProgram {
+    Program program;
+    Ast ast;
+    TypeInfo types;
+} RestoredProgram;
+
+/// @brief Builds a map again from its entries in an image
+/// @param base The start of the mapped image
+/// @return A new reference to the map
+Map *restoreMap(char *base, SnapshotMap *record, int type) {
+    MapEntry *entries = (MapEntry*)(base + record->entries);
+    int i;
+
+    if (record->restored != NULL) {
+        retainValue((NodeValue){.loc = record->restored, .type = type});
+        return record->restored;
+    }
+
+    NodeValue map = newMap(type);
+
+    for (i = 0; i < record->len; i++) {
+        NodeValue key = slotValue(entries[i].key, mapKeyType(type));
+        NodeValue value = slotValue(entries[i].value, mapValueType(type));
+
+        if (key.type == Type_str) {
+            key.loc = entries[i].key.loc == NULL ? NULL : literalString((long)entries[i].key.loc - 1);
+        }
+
+        if (value.type == Type_str) {
+            value.loc = entries[i].value.loc == NULL ? NULL : literalString((long)entries[i].value.loc - 1);
+        }
+
+        mapSet(map.loc, key, value);
+    }
+
+    record->restored = map.loc;
+
+    return map.loc;
+}
+
+/// @brief Returns whether `count` items of `size` bytes starting at `offset` are inside an image of `image_size` bytes.
+/// Everything in an image was added by `snapshotAppend`, so it also has to start on a SNAPSHOT_ALIGN boundary
+bool snapshotFits(long offset, long count, long size, long image_size) {
+    return offset >= 0 && offset <= image_size && offset % SNAPSHOT_ALIGN == 0
+        && count >= 0 && count <= INT_MAX && count <= (image_size - offset) / size;
+}
+
+/// @brief Returns whether a string stored in an image as an intern id plus 1 (or 0 for NULL) names one of its strings
+#define snapshotStringValid(header, id) ((long)(id) >= 0 && (long)(id) <= (header)->strings.count)
+
+/// @brief Checks that every section of an image, and everything the records in them point at, is inside the image,
+/// so a truncated or corrupted image is turned down instead of being read past its end
+/// @param base The start of the mapped image, whose header has already been checked
+/// @param image_size The size of the image
+bool snapshotValid(char *base, long image_size) {
+    SnapshotHeader *header = (SnapshotHeader*)base;
+    struct {
+        SnapshotSection *section;
+        long size;
+    } sections[] = {
+        {&header->sources, sizeof(SnapshotSource)}, {&header->strings, sizeof(SnapshotString)},
+        {&header->buckets, sizeof(int)}, {&header->float_literals, sizeof(double)}, {&header->tokens, sizeof(Token)},
+        {&header->ast_kind, sizeof(unsigned char)}, {&header->ast_token, sizeof(int)}, {&header->ast_first_child, sizeof(int)},
+        {&header->ast_child_count, sizeof(int)}, {&header->node_types, sizeof(unsigned char)}, {&header->node_slots, sizeof(int)},
+        {&header->node_globals, sizeof(unsigned char)}, {&header->node_functions, sizeof(int)},
+        {&header->slot_types, sizeof(unsigned char)}, {&header->functions, sizeof(FunctionInfo)}, {&header->globals, sizeof(Slot)}
+    };
+    long nodes = header->ast_kind.count;
+    int max_frame_slots = 0;
+    int i, j;
+
+    for (i = 0; i < (int)(sizeof(sections) / sizeof(sections[0])); i++) {
+        if (!snapshotFits(sections[i].section->offset, sections[i].section->count, sections[i].size, image_size)) {
+            return false;
+        }
+    }
+
+    // The Ast and the type information have an item for every node, and there's a global for every global slot type
+    if (header->ast_token.count != nodes || header->ast_first_child.count != nodes || header->ast_child_count.count != nodes
+            || header->node_types.count != nodes || header->node_slots.count != nodes || header->node_globals.count != nodes
+            || header->node_functions.count != nodes || header->globals.count != header->slot_types.count || nodes == 0) {
+        return false;
+    }
+
+    #define imageAt(section, type) ((type*)(base + header->section.offset))
+
+    SnapshotSource *source_records = imageAt(sources, SnapshotSource);
+
+    for (i = 0; i < header->sources.count; i++) {
+        long path = source_records[i].path;
+
+        if (!snapshotFits(path, 1, 1, image_size) || memchr(base + path, '\0', image_size - path) == NULL
+                || !snapshotFits(source_records[i].text, source_records[i].text_len, 1, image_size)) {
+            return false;
+        }
+    }
+
+    SnapshotString *string_records = imageAt(strings, SnapshotString);
+
+    for (i = 0; i < header->strings.count; i++) {
+        // Each string is written with a NUL after it
+        if (!snapshotFits(string_records[i].offset, (long)string_records[i].len + 1, 1, image_size)) {
+            return false;
+        }
+    }
+
+    FunctionInfo *function_records = imageAt(functions, FunctionInfo);
+
+    for (i = 0; i < header->functions.count; i++) {
+        if (!snapshotFits((long)function_records[i].slot_types.ref, function_records[i].slot_types.len, 1, image_size)) {
+            return false;
+        }
+
+        if (function_records[i].slot_types.len > max_frame_slots) {
+            max_frame_slots = function_records[i].slot_types.len;
+        }
+    }
+
+    // The frame stack is sized from these, and the program continues from a top-level statement
+    if (header->max_frame_slots != max_frame_slots || header->first_statement < 0 || header->first_statement > imageAt(ast_child_count, int)[0]) {
+        return false;
+    }
+
+    unsigned char *slot_types = imageAt(slot_types, unsigned char);
+    Slot *globals = imageAt(globals, Slot);
+
+    for (i = 0; i < header->globals.count; i++) {
+        int type = slot_types[i];
+        long offset = (long)globals[i].loc;
+
+        if (type == Type_str && !snapshotStringValid(header, offset)) {
+            return false;
+        }
+
+        if (type == Type_str || !typeIsObject(type) || offset == 0) {
+            continue;
+        }
+
+        if (typeIsMap(type)) {
+            if (!snapshotFits(offset, 1, sizeof(SnapshotMap), image_size)) {
+                return false;
+            }
+
+            SnapshotMap *record = (SnapshotMap*)(base + offset);
+            MapEntry *entries = (MapEntry*)(base + record->entries);
+
+            // Maps and arrays are only marked as restored once they're in memory
+            if (record->restored != NULL || !snapshotFits(record->entries, record->len, sizeof(MapEntry), image_size)) {
+                return false;
+            }
+
+            for (j = 0; j < record->len; j++) {
+                if ((mapKeyType(type) == Type_str && !snapshotStringValid(header, entries[j].key.loc))
+                        || (mapValueType(type) == Type_str && !snapshotStringValid(header, entries[j].value.loc))) {
+                    return false;
+                }
+            }
+        } else {
+            if (!snapshotFits(offset, 1, sizeof(Array), image_size)) {
+                return false;
+            }
+
+            Array *array = (Array*)(base + offset);
+
+            if (array->object.refcount != 0 || !snapshotFits((long)array->data, array->len, elementSize(type), image_size)) {
+                return false;
+            }
+
+            for (j = 0; type == Type_ptr_str && j < array->len; j++) {
+                if (!snapshotStringValid(header, ((long*)(base + (long)array->data))[j])) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    #undef imageAt
+
+    return true;
+}
+
+/// @brief Maps an image written by `takeSnapshot` and sets everything up to continue where it was taken.
+/// Tokens, the Ast and the type information are used from the mapping in place. Only what the
+/// runtime may grow or free is copied out, and arrays become immortal objects inside the mapping.
+/// `start_point` is moved to the statement after the snapshot
+/// @param path The path of the image
+/// @param restored Where the program is stored
+/// @return Whether the image could be restored
+bool restoreSnapshot(char *path, RestoredProgram *restored) {
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+
+    // Images are written from a ByteVec, so they're never bigger than INT_MAX
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size < (long)sizeof(SnapshotHeader) || info.st_size > INT_MAX) {
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        return false;
+    }
+
+    // Private, so relocating arrays in place never writes back to the image
+    char *base = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    SnapshotHeader *header = (SnapshotHeader*)base;
+    int i;
+
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != SNAPSHOT_VERSION
+            || strncmp(header->build, SNAPSHOT_BUILD, sizeof(header->build)) != 0
+            || header->token_size != sizeof(Token) || header->slot_size != sizeof(Slot)
+            || header->checksum != snapshotChecksum(base, info.st_size) || !snapshotValid(base, info.st_size)) {
+        munmap(base, info.st_size);
+        return false;
+    }
+
+    #define imageAt(section, type) ((type*)(base + header->section.offset))
+
+    SnapshotSource *source_records = imageAt(sources, SnapshotSource);
+
+    for (i = 0; i < header->sources.count; i++) {
+        addSourceFile(base + source_records[i].path, (Astr){.str_ref = base + source_records[i].text, .len = source_records[i].text_len});
+    }
+
+    SnapshotString *string_records = imageAt(strings, SnapshotString);
+
+    interned.strs = AstrVec_new(header->strings.count > INTERN_CAPACITY ? header->strings.count : INTERN_CAPACITY);
+
+    for (i = 0; i < header->strings.count; i++) {
+        AstrVec_push(&interned.strs, (Astr){.str_ref = base + string_records[i].offset, .len = string_records[i].len});
+    }
+
+    interned.num_buckets = header->buckets.count;
+    interned.buckets = nmalloc(interned.num_buckets * sizeof(int));
+    memcpy(interned.buckets, imageAt(buckets, int), interned.num_buckets * sizeof(int));
+
+    if (header->float_literals.count > 0) {
+        FloatLiterals_append(&float_literals, imageAt(float_literals, double), header->float_literals.count);
+    }
+
+    restored->program = (Program){.ref = imageAt(tokens, Token), .len = header->tokens.count, .capacity = header->tokens.count};
+    restored->ast = (Ast){
+        .kind = imageAt(ast_kind, unsigned char),
+        .token = imageAt(ast_token, int),
+        .first_child = imageAt(ast_first_child, int),
+        .child_count = imageAt(ast_child_count, int),
+        .len = header->ast_kind.count,
+        .capacity = header->ast_kind.count
+    };
+
+    TypeInfo *types = &restored->types;
+
+    *types = (TypeInfo){
+        .node_types = imageAt(node_types, unsigned char),
+        .node_slots = imageAt(node_slots, int),
+        .node_globals = imageAt(node_globals, unsigned char),
+        .node_functions = imageAt(node_functions, int),
+        .slot_types = {.ref = imageAt(slot_types, unsigned char), .len = header->slot_types.count, .capacity = header->slot_types.count},
+        .functions = {0},
+        .max_frame_slots = header->max_frame_slots
+    };
+
+    if (header->functions.count > 0) {
+        FunctionInfos_append(&types->functions, imageAt(functions, FunctionInfo), header->functions.count);
+    }
+
+    for (i = 0; i < types->functions.len; i++) {
+        types->functions.ref[i].slot_types.ref = (unsigned char*)(base + (long)types->functions.ref[i].slot_types.ref);
+    }
+
+    Slot *globals = imageAt(globals, Slot);
+
+    for (i = 0; i < header->globals.count; i++) {
+        int type = types->slot_types.ref[i];
+
+        if (type == Type_str && globals[i].loc != NULL) {
+            // Restored strings live as long as the program, like literals
+            globals[i].loc = literalString((long)globals[i].loc - 1);
+        } else if (typeIsMap(type) && globals[i].loc != NULL) {
+            globals[i].loc = restoreMap(base, (SnapshotMap*)(base + (long)globals[i].loc), type);
+        } else if (typeIsObject(type) && globals[i].loc != NULL) {
+            Array *array = (Array*)(base + (long)globals[i].loc);
+
+            if (array->object.refcount != OBJECT_IMMORTAL) {
+                array->object.refcount = OBJECT_IMMORTAL;
+                array->data = base + (long)array->data;
+
+                if (type == Type_ptr_str) {
+                    int j;
+
+                    for (j = 0; j < array->len; j++) {
+                        long id = ((long*)array->data)[j];
+
+                        ((String**)array->data)[j] = id == 0 ? NULL : literalString(id - 1);
+                    }
+                }
+            }
+
+            globals[i].loc = array;
+        }
+    }
+
+    #undef imageAt
+
+    start_point = (StartPoint){.globals = globals, .first_statement = header->first_statement};
+
+    return true;
+}
+
+#endif
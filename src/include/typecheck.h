@@ -0,0 +1,959 @@
+#ifndef TYPECHECK_IMPL
+
+#define TYPECHECK_IMPL
+
+#define NO_FUNCTION -1
+
+// Stores useful info about the current type checker state
+typedef struct TypeChecker {
+    Ast *ast;
+    Program program;
+
+    TypeInfo info;
+
+    // These are indexed by intern id
+    IntVec global_slots; // the global slot of the variable with each name, or -1
+    IntVec local_slots; // the slot in the current function's frame of the variable with each name, or -1
+    IntVec function_ids; // the user-defined function with each name, or NO_FUNCTION
+
+    int function; // the function being checked, or NO_FUNCTION at the top level
+    IntVec parallel_callbacks; // the nodes naming the functions passed to parallel builtins
+} TypeChecker;
+
+char map_type_names[Type_char + 1][Type_char + 1][24]; // the names of map types, filled in by `typeName`
+
+/// @brief Returns the name a type is written with in Nitrogen
+char *typeName(int type) {
+    if (typeIsMap(type)) {
+        char *name = map_type_names[mapKeyType(type)][mapValueType(type)];
+
+        snprintf(name, sizeof(map_type_names[0][0]), "map[%s]%s", typeName(mapKeyType(type)), typeName(mapValueType(type)));
+
+        return name;
+    }
+
+    switch (type) {
+        case Type_int:
+            return "int";
+        case Type_float:
+            return "float";
+        case Type_char:
+            return "char";
+        case Type_str:
+            return "string";
+        case Type_ptr_int:
+            return "int[]";
+        case Type_ptr_float:
+            return "float[]";
+        case Type_ptr_str:
+            return "string[]";
+        case Type_null:
+            return "void";
+    }
+
+    return "unknown";
+}
+
+/// @brief Returns the type of the keys or values of a map type named `map[KEY]VALUE`, reporting an error if maps can't have it
+/// @param token The token of the map type
+/// @param name The name of the key or value type
+/// @param len The length of the name
+/// @param allowed The types the keys or values can have
+int mapPartType(Token *token, char *name, int len, int allowed[], int num_allowed) {
+    int i;
+
+    for (i = 0; i < num_allowed; i++) {
+        if ((int)strlen(typeName(allowed[i])) == len && strncmp(typeName(allowed[i]), name, len) == 0) {
+            return allowed[i];
+        }
+    }
+
+    reportError(token, "TypeError", "Maps can only have int, char or string keys, and int, float, char or string values.");
+    return Type_null;
+}
+
+/// @brief Returns the type a Tk_Type token names
+/// @param token The type's token
+int typeFromToken(Token *token) {
+    char *name = internedStr(token->value);
+
+    if (strncmp(name, "map[", 4) == 0) {
+        int key_types[] = {Type_int, Type_char, Type_str};
+        int value_types[] = {Type_int, Type_float, Type_char, Type_str};
+        char *close = strchr(name, ']');
+        int key_type = mapPartType(token, name + 4, close - name - 4, key_types, 3);
+        int value_type = mapPartType(token, close + 1, strlen(close + 1), value_types, 4);
+
+        return mapType(key_type, value_type);
+    }
+
+    if (streq(name, "int")) {
+        return Type_int;
+    } else if (streq(name, "float")) {
+        return Type_float;
+    } else if (streq(name, "char")) {
+        return Type_char;
+    } else if (streq(name, "void")) {
+        return Type_null;
+    } else if (streq(name, "int[]")) {
+        return Type_ptr_int;
+    } else if (streq(name, "float[]")) {
+        return Type_ptr_float;
+    } else if (streq(name, "string[]")) {
+        return Type_ptr_str;
+    }
+
+    return Type_str;
+}
+
+/// @brief Returns the function being checked, or NULL at the top level
+FunctionInfo *checkedFunction(TypeChecker *checker) {
+    if (checker->function == NO_FUNCTION) {
+        return NULL;
+    }
+
+    return checker->info.functions.ref + checker->function;
+}
+
+/// @brief Fills an IntVec with one -1 per interned string
+void initNameTable(IntVec *table) {
+    int i;
+
+    // Every name was interned while lexing, so no intern id can be out of range
+    *table = IntVec_new(interned.strs.len);
+
+    for (i = 0; i < interned.strs.len; i++) {
+        IntVec_push(table, -1);
+    }
+}
+
+/// @brief Gives a new variable a slot, in the current function's frame or among the globals
+/// @param checker The type checker state
+/// @param token The token of the variable's name
+/// @param type The type the variable will always have
+/// @return The id of the new slot
+int addSlot(TypeChecker *checker, Token *token, int type) {
+    FunctionInfo *function = checkedFunction(checker);
+
+    if (type == Type_null) {
+        Astr error_str = concat(_Astr("`"), _Astr(internedStr(token->value)));
+        error_str = concat(error_str, _Astr("` can't have type void."));
+
+        reportError(token, "TypeError", AstrToStr(error_str));
+    }
+
+    if (function != NULL) {
+        ByteVec_push(&function->slot_types, type);
+        checker->local_slots.ref[token->value] = function->slot_types.len - 1;
+
+        return function->slot_types.len - 1;
+    }
+
+    ByteVec_push(&checker->info.slot_types, type);
+    checker->global_slots.ref[token->value] = checker->info.slot_types.len - 1;
+
+    return checker->info.slot_types.len - 1;
+}
+
+/// @brief Finds the slot of a variable, looking in the current function before the globals
+/// @param checker The type checker state
+/// @param node The node that reads or assigns the variable
+/// @param name The intern id of the variable's name
+/// @return The id of the slot, or -1 if there's no such variable
+int findSlot(TypeChecker *checker, int node, int name) {
+    if (checker->function != NO_FUNCTION && checker->local_slots.ref[name] != -1) {
+        return checker->local_slots.ref[name];
+    }
+
+    checker->info.node_globals[node] = checker->function != NO_FUNCTION;
+
+    return checker->global_slots.ref[name];
+}
+
+/// @brief Returns the type of a slot
+/// @param checker The type checker state
+/// @param node The node whose slot it is
+int slotType(TypeChecker *checker, int node) {
+    int slot = checker->info.node_slots[node];
+
+    if (checker->info.node_globals[node] || checker->function == NO_FUNCTION) {
+        return checker->info.slot_types.ref[slot];
+    }
+
+    return checkedFunction(checker)->slot_types.ref[slot];
+}
+
+/// @brief Gives the variable a Node_Declr declares a slot, reporting an error if it already has one
+/// @param checker The type checker state
+/// @param node The id of the Node_Declr
+/// @return The id of the variable's slot
+int declareVariable(TypeChecker *checker, int node) {
+    Token *token = AstNodeToken(checker->ast, checker->program, node);
+    Token *type_token = AstNodeToken(checker->ast, checker->program, getChildAst(checker->ast, node, 0));
+    IntVec *slots = checker->function != NO_FUNCTION ? &(checker->local_slots) : &(checker->global_slots);
+
+    if (slots->ref[token->value] != -1) {
+        Astr error_str = concat(_Astr("`"), _Astr(internedStr(token->value)));
+        error_str = concat(error_str, _Astr("` is already declared."));
+
+        reportError(token, "TypeError", AstrToStr(error_str));
+    }
+
+    checker->info.node_slots[node] = addSlot(checker, token, typeFromToken(type_token));
+
+    return checker->info.node_slots[node];
+}
+
+/// @brief Reports that a value has the wrong type
+/// @param token Where to report the error
+/// @param what What was given the value, like "assign a value of type int to `x`, which has type"
+/// @param expected_type The type the value should have had
+void reportTypeMismatch(Token *token, Astr what, int expected_type) {
+    Astr error_str = concat(_Astr("Cannot "), what);
+    error_str = concat(error_str, _Astr(" "));
+    error_str = concat(error_str, _Astr(typeName(expected_type)));
+    error_str = concat(error_str, _Astr("."));
+
+    reportError(token, "TypeError", AstrToStr(error_str));
+}
+
+int checkNode(TypeChecker *checker, int node);
+
+/// @brief Checks an indexing of an array or a map
+/// @param checker The type checker state
+/// @param node The id of the Node_Index
+/// @return The type of the array's elements or the map's values
+int checkIndexing(TypeChecker *checker, int node) {
+    Token *token = AstNodeToken(checker->ast, checker->program, node);
+    int array_type = checkNode(checker, checker->ast->first_child[node]);
+    int index_type = checkNode(checker, checker->ast->first_child[node] + 1);
+
+    if (typeIsMap(array_type)) {
+        if (index_type != mapKeyType(array_type)) {
+            Astr what = concat(_Astr("use a value of type "), _Astr(typeName(index_type)));
+            what = concat(what, _Astr(" as a key of a "));
+            what = concat(what, _Astr(typeName(array_type)));
+            what = concat(what, _Astr(", which has type"));
+
+            reportTypeMismatch(token, what, mapKeyType(array_type));
+        }
+
+        return mapValueType(array_type);
+    }
+
+    if (array_type != Type_ptr_int && array_type != Type_ptr_float && array_type != Type_ptr_str) {
+        Astr error_str = concat(_Astr("Cannot index a value of type "), _Astr(typeName(array_type)));
+        error_str = concat(error_str, _Astr(", only arrays and maps."));
+
+        reportError(token, "TypeError", AstrToStr(error_str));
+    }
+
+    if (index_type != Type_int) {
+        Astr what = concat(_Astr("use a value of type "), _Astr(typeName(index_type)));
+        what = concat(what, _Astr(" as an index, which has to have type"));
+
+        reportTypeMismatch(token, what, Type_int);
+    }
+
+    return elementType(array_type);
+}
+
+/// @brief Returns whether an operator can be used on values of a type
+/// @param op The TokenType of the operator
+/// @param type The type of its operands
+bool operatorAccepts(TokenType op, int type) {
+    switch (op) {
+        case Tk_Plus:
+            return type == Type_int || type == Type_float || type == Type_str;
+        case Tk_Minus:
+        case Tk_Star:
+        case Tk_Slash:
+            return type == Type_int || type == Type_float;
+        case Tk_Percent:
+            return type == Type_int;
+        case Tk_Less:
+        case Tk_LessEqual:
+        case Tk_Greater:
+        case Tk_GreaterEqual:
+            return type == Type_int || type == Type_float || type == Type_char;
+        case Tk_Equal:
+        case Tk_NotEqual:
+            return type == Type_int || type == Type_float || type == Type_char || type == Type_str;
+        case Tk_And:
+        case Tk_Or:
+        case Tk_Not:
+            return type == Type_int || type == Type_char;
+        default:
+            return false;
+    }
+}
+
+/// @brief Checks a binary or unary operator. Both operands of a binary operator have to have the same type,
+/// since values are never converted implicitly
+/// @param checker The type checker state
+/// @param node The id of the Node_Binary or Node_Unary
+/// @return The type of the result: the operands' type for arithmetic, otherwise int
+int checkOperator(TypeChecker *checker, int node) {
+    Ast *ast = checker->ast;
+    Token *token = AstNodeToken(ast, checker->program, node);
+    int type = checkNode(checker, ast->first_child[node]);
+
+    if (ast->kind[node] == Node_Binary) {
+        int right_type = checkNode(checker, ast->first_child[node] + 1);
+
+        if (right_type != type) {
+            Astr error_str = concat(_Astr("Cannot use `"), tokenText(token));
+            error_str = concat(error_str, _Astr("` on a value of type "));
+            error_str = concat(error_str, _Astr(typeName(type)));
+            error_str = concat(error_str, _Astr(" and a value of type "));
+            error_str = concat(error_str, _Astr(typeName(right_type)));
+            error_str = concat(error_str, _Astr("."));
+
+            reportError(token, "TypeError", AstrToStr(error_str));
+        }
+    }
+
+    if (!operatorAccepts(token->token_type, type)) {
+        Astr error_str = concat(_Astr("Cannot use `"), tokenText(token));
+        error_str = concat(error_str, _Astr("` on values of type "));
+        error_str = concat(error_str, _Astr(typeName(type)));
+        error_str = concat(error_str, _Astr("."));
+
+        reportError(token, "TypeError", AstrToStr(error_str));
+    }
+
+    switch (token->token_type) {
+        case Tk_Plus:
+        case Tk_Minus:
+        case Tk_Star:
+        case Tk_Slash:
+        case Tk_Percent:
+            return type;
+        default:
+            return Type_int;
+    }
+}
+
+/// @brief Checks an assignment, inferring the type of the variable if this is the first time it's assigned
+/// @param checker The type checker state
+/// @param node The id of the Node_Action
+/// @return The type of the variable
+int checkAssignment(TypeChecker *checker, int node) {
+    Ast *ast = checker->ast;
+    int target = getChildAst(ast, node, 0);
+    Token *target_token = AstNodeToken(ast, checker->program, target);
+
+    // The value is checked first, so a variable can't be used in its own declaration
+    int value_type = checkNode(checker, getChildAst(ast, node, 1));
+
+    if (ast->kind[target] == Node_Index) {
+        int element_type = checkIndexing(checker, target);
+
+        if (element_type != value_type) {
+            Astr what = concat(_Astr("assign a value of type "), _Astr(typeName(value_type)));
+            what = concat(what, _Astr(" to an element of type"));
+
+            reportTypeMismatch(AstNodeToken(ast, checker->program, node), what, element_type);
+        }
+
+        return element_type;
+    }
+
+    if (ast->kind[target] == Node_Declr) {
+        declareVariable(checker, target);
+    } else {
+        checker->info.node_slots[target] = findSlot(checker, target, target_token->value);
+
+        if (checker->info.node_slots[target] == -1) {
+            checker->info.node_globals[target] = false;
+
+            if (value_type == Type_null) {
+                Astr error_str = concat(_Astr("Cannot infer the type of `"), _Astr(internedStr(target_token->value)));
+                error_str = concat(error_str, _Astr("` from a value of type void."));
+
+                reportError(target_token, "TypeError", AstrToStr(error_str));
+            }
+
+            checker->info.node_slots[target] = addSlot(checker, target_token, value_type);
+        }
+    }
+
+    int slot_type = slotType(checker, target);
+
+    if (slot_type != value_type) {
+        Astr what = concat(_Astr("assign a value of type "), _Astr(typeName(value_type)));
+        what = concat(what, _Astr(" to `"));
+        what = concat(what, _Astr(internedStr(target_token->value)));
+        what = concat(what, _Astr("`, which has type"));
+
+        reportTypeMismatch(AstNodeToken(ast, checker->program, node), what, slot_type);
+    }
+
+    return slot_type;
+}
+
+/// @brief Returns the type a character of a builtin's `callback` stands for
+/// @param code The character
+/// @param arg_types The types of the builtin's arguments
+int callbackType(char code, int arg_types[]) {
+    switch (code) {
+        case 'E':
+            return elementType(arg_types[0]);
+        case 'e':
+            return elementType(arg_types[1]);
+        case 'i':
+            return Type_int;
+    }
+
+    return Type_null;
+}
+
+/// @brief Checks that the argument of a builtin's `F` parameter names a function with the signature in the builtin's `callback`
+/// @param checker The type checker state
+/// @param builtin The builtin
+/// @param arg The id of the argument's node
+/// @param arg_types The types of the builtin's arguments
+void checkCallback(TypeChecker *checker, BuiltinEntry *builtin, int arg, int arg_types[]) {
+    Token *token = AstNodeToken(checker->ast, checker->program, arg);
+
+    if (token->token_type != Tk_Strliteral || checker->function_ids.ref[token->value] == NO_FUNCTION) {
+        Astr error_str = concat(_Astr("`"), _Astr(builtin->name));
+        error_str = concat(error_str, _Astr("` needs the name of a function, in quotes."));
+
+        reportError(token, "TypeError", AstrToStr(error_str));
+    }
+
+    FunctionInfo *function = checker->info.functions.ref + checker->function_ids.ref[token->value];
+    char *signature = builtin->callback;
+    bool matches = (int)strlen(signature + 1) == function->num_params;
+    int i;
+
+    if (signature[0] != '*' && function->return_type != callbackType(signature[0], arg_types)) {
+        matches = false;
+    }
+
+    for (i = 0; matches && i < function->num_params; i++) {
+        matches = function->slot_types.ref[i] == callbackType(signature[i + 1], arg_types);
+    }
+
+    if (!matches) {
+        Astr error_str = concat(_Astr("`"), _Astr(builtin->name));
+        error_str = concat(error_str, _Astr("` needs a function that takes ("));
+
+        for (i = 1; signature[i] != '\0'; i++) {
+            error_str = concat(error_str, _Astr(typeName(callbackType(signature[i], arg_types))));
+            error_str = concat(error_str, _Astr(signature[i + 1] != '\0' ? ", " : ""));
+        }
+
+        error_str = concat(error_str, _Astr(")"));
+
+        if (signature[0] != '*') {
+            error_str = concat(error_str, _Astr(" and returns "));
+            error_str = concat(error_str, _Astr(typeName(callbackType(signature[0], arg_types))));
+        }
+
+        error_str = concat(error_str, _Astr("."));
+
+        reportError(token, "TypeError", AstrToStr(error_str));
+    }
+
+    // Only parallel builtins take functions, and what those functions may do is checked once every body has been
+    IntVec_push(&checker->parallel_callbacks, arg);
+}
+
+/// @brief Finds an assignment to a global under a node, looking into the bodies of the functions it calls
+/// @param checker The type checker state
+/// @param node The id of the node to search
+/// @param visited Which functions have already been searched
+/// @return The id of the assigned variable's node, or -1 if there's none
+int findGlobalAssignment(TypeChecker *checker, int node, unsigned char *visited) {
+    Ast *ast = checker->ast;
+    int function = checker->info.node_functions[node];
+    int i;
+
+    if (ast->kind[node] == Node_Action && checker->info.node_globals[getChildAst(ast, node, 0)]) {
+        return getChildAst(ast, node, 0);
+    }
+
+    if (function != NO_FUNCTION && !visited[function]) {
+        visited[function] = true;
+
+        int found = findGlobalAssignment(checker, checker->info.functions.ref[function].body, visited);
+
+        if (found != -1) {
+            return found;
+        }
+    }
+
+    for (i = 0; i < ast->child_count[node]; i++) {
+        int found = findGlobalAssignment(checker, ast->first_child[node] + i, visited);
+
+        if (found != -1) {
+            return found;
+        }
+    }
+
+    return -1;
+}
+
+/// @brief Reports an error if a function passed to a parallel builtin, or one it calls, assigns a global.
+///
+/// The threads running a parallel builtin share the globals, so assigning one would race: an int could lose
+/// updates, and a string, array or map could be released by two threads or while another is still reading it.
+/// Elements of global arrays and maps can still be assigned, since arrays are split between the threads and
+/// maps are locked while they're used.
+/// @param checker The type checker state
+void checkParallelCallbacks(TypeChecker *checker) {
+    unsigned char *visited = nmalloc(checker->info.functions.len);
+    int i;
+
+    for (i = 0; i < checker->parallel_callbacks.len; i++) {
+        Token *token = AstNodeToken(checker->ast, checker->program, checker->parallel_callbacks.ref[i]);
+        int function = checker->function_ids.ref[token->value];
+
+        memset(visited, false, checker->info.functions.len);
+        visited[function] = true;
+
+        int found = findGlobalAssignment(checker, checker->info.functions.ref[function].body, visited);
+
+        if (found != -1) {
+            Token *target_token = AstNodeToken(checker->ast, checker->program, found);
+            Astr error_str = concat(_Astr("`"), _Astr(internedStr(target_token->value)));
+            error_str = concat(error_str, _Astr("` is a global, and `"));
+            error_str = concat(error_str, _Astr(internedStr(token->value)));
+            error_str = concat(error_str, _Astr("` is run on several threads at once by a parallel builtin, so it can't be assigned."));
+
+            reportError(target_token, "TypeError", AstrToStr(error_str));
+        }
+    }
+
+    nfree(visited);
+}
+
+/// @brief Checks a call to a builtin against the builtin's parameters
+/// @param checker The type checker state
+/// @param node The id of the call's Node_Expr
+/// @return The type the builtin returns
+int checkBuiltinCall(TypeChecker *checker, int node) {
+    Ast *ast = checker->ast;
+    Token *token = AstNodeToken(ast, checker->program, node);
+    int args = getChildAst(ast, node, 0);
+    BuiltinEntry *builtin = findBuiltinEntry(internedStr(token->value));
+    int first_type = Type_null;
+    int callback = -1;
+    int i;
+
+    if (builtin == NULL) {
+        reportUnknownFunction(token);
+    }
+
+    int arg_types[ast->child_count[args] > 0 ? ast->child_count[args] : 1];
+
+    if (ast->child_count[args] != (int)strlen(builtin->params)) {
+        Astr error_str = concat(_Astr("`"), _Astr(builtin->name));
+        error_str = concat(error_str, _Astr("` takes "));
+        error_str = concat(error_str, fromInt(strlen(builtin->params)));
+        error_str = concat(error_str, _Astr(strlen(builtin->params) == 1 ? " argument, but " : " arguments, but "));
+        error_str = concat(error_str, fromInt(ast->child_count[args]));
+        error_str = concat(error_str, _Astr(" were given."));
+
+        reportError(token, "TypeError", AstrToStr(error_str));
+    }
+
+    for (i = 0; i < ast->child_count[args]; i++) {
+        int arg = ast->first_child[args] + i;
+        int arg_type = checkNode(checker, arg);
+        int expected_type = arg_type;
+        char *accepts = NULL; // what the parameter takes, if it takes more than one type
+
+        if (i == 0) {
+            first_type = arg_type;
+        }
+
+        arg_types[i] = arg_type;
+
+        switch (builtin->params[i]) {
+            case 'i':
+                expected_type = Type_int;
+                break;
+            case 's':
+                expected_type = Type_str;
+                break;
+            case 'F':
+                expected_type = Type_str;
+                callback = arg;
+                break;
+            case 'A':
+                if (arg_type != Type_ptr_int && arg_type != Type_ptr_float) {
+                    accepts = "an int[] or a float[]";
+                }
+                break;
+            case 'L':
+                if (arg_type != Type_ptr_int && arg_type != Type_ptr_float && arg_type != Type_ptr_str && arg_type != Type_str && !typeIsMap(arg_type)) {
+                    accepts = "an array, a string or a map";
+                }
+                break;
+            case 'M':
+                if (!typeIsMap(arg_type)) {
+                    accepts = "a map";
+                }
+                break;
+            case 'K':
+                expected_type = mapKeyType(first_type);
+                break;
+            case 'S':
+                expected_type = first_type;
+                break;
+            case 'E':
+                expected_type = elementType(first_type);
+                break;
+        }
+
+        if (accepts != NULL) {
+            Astr error_str = concat(_Astr("Cannot pass a value of type "), _Astr(typeName(arg_type)));
+            error_str = concat(error_str, _Astr(" as argument "));
+            error_str = concat(error_str, fromInt(i + 1));
+            error_str = concat(error_str, _Astr(" of `"));
+            error_str = concat(error_str, _Astr(builtin->name));
+            error_str = concat(error_str, _Astr("`, which has to be "));
+            error_str = concat(error_str, _Astr(accepts));
+            error_str = concat(error_str, _Astr("."));
+
+            reportError(AstNodeToken(ast, checker->program, arg), "TypeError", AstrToStr(error_str));
+        }
+
+        if (arg_type != expected_type) {
+            Astr what = concat(_Astr("pass a value of type "), _Astr(typeName(arg_type)));
+            what = concat(what, _Astr(" as argument "));
+            what = concat(what, fromInt(i + 1));
+            what = concat(what, _Astr(" of `"));
+            what = concat(what, _Astr(builtin->name));
+            what = concat(what, _Astr("`, which has type"));
+
+            reportTypeMismatch(AstNodeToken(ast, checker->program, arg), what, expected_type);
+        }
+    }
+
+    if (callback != -1) {
+        checkCallback(checker, builtin, callback, arg_types);
+    }
+
+    switch (builtin->return_type) {
+        case RETURNS_ELEMENT:
+            return elementType(first_type);
+        case RETURNS_KEYS:
+            return mapColumnType(mapKeyType(first_type));
+        case RETURNS_VALUES:
+            return mapColumnType(mapValueType(first_type));
+    }
+
+    return builtin->return_type;
+}
+
+/// @brief Checks a function call against the builtin or user-defined function it calls
+/// @param checker The type checker state
+/// @param node The id of the call's Node_Expr
+/// @return The type the function returns
+int checkCall(TypeChecker *checker, int node) {
+    Ast *ast = checker->ast;
+    Token *token = AstNodeToken(ast, checker->program, node);
+    int args = getChildAst(ast, node, 0);
+    int function = checker->function_ids.ref[token->value];
+    int i;
+
+    checker->info.node_functions[node] = function;
+
+    if (function == NO_FUNCTION) {
+        return checkBuiltinCall(checker, node);
+    }
+
+    FunctionInfo *info = checker->info.functions.ref + function;
+
+    if (ast->child_count[args] != info->num_params) {
+        Astr error_str = concat(_Astr("`"), _Astr(internedStr(token->value)));
+        error_str = concat(error_str, _Astr("` takes "));
+        error_str = concat(error_str, fromInt(info->num_params));
+        error_str = concat(error_str, _Astr(" arguments, but "));
+        error_str = concat(error_str, fromInt(ast->child_count[args]));
+        error_str = concat(error_str, _Astr(" were given."));
+
+        reportError(token, "TypeError", AstrToStr(error_str));
+    }
+
+    for (i = 0; i < info->num_params; i++) {
+        int arg = ast->first_child[args] + i;
+        int arg_type = checkNode(checker, arg);
+
+        if (arg_type != info->slot_types.ref[i]) {
+            Astr what = concat(_Astr("pass a value of type "), _Astr(typeName(arg_type)));
+            what = concat(what, _Astr(" as argument "));
+            what = concat(what, fromInt(i + 1));
+            what = concat(what, _Astr(" of `"));
+            what = concat(what, _Astr(internedStr(token->value)));
+            what = concat(what, _Astr("`, which has type"));
+
+            reportTypeMismatch(AstNodeToken(ast, checker->program, arg), what, info->slot_types.ref[i]);
+        }
+    }
+
+    return info->return_type;
+}
+
+/// @brief Adds a function's signature, so it can be called from anywhere in the program
+/// @param checker The type checker state
+/// @param node The id of the Node_Function
+void declareFunction(TypeChecker *checker, int node) {
+    Ast *ast = checker->ast;
+    Token *token = AstNodeToken(ast, checker->program, node);
+    int params = getChildAst(ast, node, 1);
+    int i;
+
+    if (checker->function_ids.ref[token->value] != NO_FUNCTION || findBuiltinEntry(internedStr(token->value)) != NULL) {
+        Astr error_str = concat(_Astr("Function `"), _Astr(internedStr(token->value)));
+        error_str = concat(error_str, _Astr("` is already defined."));
+
+        reportError(token, "TypeError", AstrToStr(error_str));
+    }
+
+    FunctionInfos_push(&checker->info.functions, (FunctionInfo){
+        .node = node,
+        .body = getChildAst(ast, node, 2),
+        .return_type = typeFromToken(AstNodeToken(ast, checker->program, getChildAst(ast, node, 0))),
+        .num_params = ast->child_count[params],
+        .slot_types = ByteVec_new(ast->child_count[params] + 8)
+    });
+
+    checker->function_ids.ref[token->value] = checker->info.functions.len - 1;
+
+    // The parameter types are needed to check calls, so they're added now and named when the body is checked
+    for (i = 0; i < ast->child_count[params]; i++) {
+        int type_node = getChildAst(ast, ast->first_child[params] + i, 0);
+        ByteVec_push(&(checker->info.functions.ref[checker->info.functions.len - 1].slot_types), typeFromToken(AstNodeToken(ast, checker->program, type_node)));
+    }
+}
+
+/// @brief Checks the body of a function in a scope of its own
+/// @param checker The type checker state
+/// @param node The id of the Node_Function
+void checkFunction(TypeChecker *checker, int node) {
+    Ast *ast = checker->ast;
+    Token *token = AstNodeToken(ast, checker->program, node);
+    int params = getChildAst(ast, node, 1);
+    int i;
+
+    checker->function = checker->function_ids.ref[token->value];
+
+    FunctionInfo *info = checkedFunction(checker);
+
+    for (i = 0; i < checker->local_slots.len; i++) {
+        checker->local_slots.ref[i] = -1;
+    }
+
+    // The parameters already have slots, so declaring them again only names them
+    info->slot_types.len = 0;
+
+    for (i = 0; i < info->num_params; i++) {
+        declareVariable(checker, ast->first_child[params] + i);
+    }
+
+    checkNode(checker, info->body);
+
+    // Falling off the end of a function is only allowed if it doesn't return anything
+    int last = getChildAst(ast, info->body, ast->child_count[info->body] - 1);
+
+    if (info->return_type != Type_null && (last == -1 || ast->kind[last] != Node_Return)) {
+        Astr error_str = concat(_Astr("Function `"), _Astr(internedStr(token->value)));
+        error_str = concat(error_str, _Astr("` has to end with a return."));
+
+        reportError(token, "TypeError", AstrToStr(error_str));
+    }
+
+    if (info->slot_types.len > checker->info.max_frame_slots) {
+        checker->info.max_frame_slots = info->slot_types.len;
+    }
+
+    checker->function = NO_FUNCTION;
+}
+
+/// @brief Works out the type of a node and everything under it, reporting any type errors
+/// @param checker The type checker state
+/// @param node The id of the node to check
+/// @return The type of the node's value
+int checkNode(TypeChecker *checker, int node) {
+    Ast *ast = checker->ast;
+    Token *token = AstNodeToken(ast, checker->program, node);
+    int type = Type_null;
+    int i;
+
+    switch (ast->kind[node]) {
+        case Node_Root:
+            // Functions can be called before they're defined, so every signature is added first
+            for (i = 0; i < ast->child_count[node]; i++) {
+                if (ast->kind[ast->first_child[node] + i] == Node_Function) {
+                    declareFunction(checker, ast->first_child[node] + i);
+                }
+            }
+
+            for (i = 0; i < ast->child_count[node]; i++) {
+                if (ast->kind[ast->first_child[node] + i] == Node_Function) {
+                    checkFunction(checker, ast->first_child[node] + i);
+                } else {
+                    checkNode(checker, ast->first_child[node] + i);
+                }
+            }
+            break;
+
+        case Node_Block:
+            for (i = 0; i < ast->child_count[node]; i++) {
+                checkNode(checker, ast->first_child[node] + i);
+            }
+            break;
+
+        case Node_Value:
+            if (token->token_type == Tk_Intliteral) {
+                type = Type_int;
+            } else if (token->token_type == Tk_Floatliteral) {
+                type = Type_float;
+            } else if (token->token_type == Tk_Charliteral) {
+                type = Type_char;
+            } else if (token->token_type == Tk_Strliteral) {
+                type = Type_str;
+            } else if (token->token_type == Tk_ID) {
+                checker->info.node_slots[node] = findSlot(checker, node, token->value);
+
+                if (checker->info.node_slots[node] == -1) {
+                    Astr error_str = concat(_Astr("Cannot find variable `"), _Astr(internedStr(token->value)));
+                    error_str = concat(error_str, _Astr("`"));
+
+                    reportError(token, "ReferenceError", AstrToStr(error_str));
+                }
+
+                type = slotType(checker, node);
+            }
+            break;
+
+        case Node_Expr:
+            if (token->token_type == Tk_Fncall) {
+                type = checkCall(checker, node);
+            } else {
+                type = checkNode(checker, ast->first_child[node]);
+            }
+            break;
+
+        case Node_Declr:
+            declareVariable(checker, node);
+            type = slotType(checker, node);
+            break;
+
+        case Node_Action:
+            if (token->token_type == Tk_Assign) {
+                type = checkAssignment(checker, node);
+            }
+            break;
+
+        case Node_While:
+            type = checkNode(checker, ast->first_child[node]);
+
+            if (type != Type_int && type != Type_char) {
+                Astr what = concat(_Astr("use a value of type "), _Astr(typeName(type)));
+                what = concat(what, _Astr(" as a condition, which has to have type"));
+
+                reportTypeMismatch(token, what, Type_int);
+            }
+
+            checkNode(checker, ast->first_child[node] + 1);
+            type = Type_null;
+            break;
+
+        case Node_Return:
+            if (checker->function == NO_FUNCTION) {
+                reportError(token, "TypeError", "Cannot return from outside a function.");
+            }
+
+            if (ast->child_count[node] > 0) {
+                type = checkNode(checker, ast->first_child[node]);
+            }
+
+            if (type != checkedFunction(checker)->return_type) {
+                Astr what = concat(_Astr("return a value of type "), _Astr(typeName(type)));
+                what = concat(what, _Astr(" from a function that returns"));
+
+                reportTypeMismatch(token, what, checkedFunction(checker)->return_type);
+            }
+
+            type = Type_null;
+            break;
+
+        case Node_Function:
+            reportError(token, "SyntaxError", "Functions can only be defined at the top level.");
+            break;
+
+        case Node_Index:
+            type = checkIndexing(checker, node);
+            break;
+
+        case Node_Binary:
+        case Node_Unary:
+            type = checkOperator(checker, node);
+            break;
+
+        case Node_Args:
+        case Node_Import:
+            // Imports have already been linked in by `linkImports`
+            break;
+    }
+
+    checker->info.node_types[node] = type;
+
+    return type;
+}
+
+/// @brief Checks the types of a whole program before it runs, and gives each variable a slot.
+///
+/// Every variable has one type for its whole life: the one it's declared with, or
+/// the type of the first value assigned to it. Knowing that up front lets the engines
+/// keep variables as raw ints, floats and chars, and read them without checking their type.
+/// Globals get slots at the bottom of the frame stack, and the parameters and locals of a
+/// function get slots at fixed offsets in its frame.
+/// @param ast The parsed program, with the root at node 0
+/// @param program The tokens the Ast refers to
+/// @return The type of every node, the slot of every variable and the layout of every function's frame
+TypeInfo typecheck(Ast *ast, Program program) {
+    TypeChecker checker = {
+        .ast = ast,
+        .program = program,
+        .info = {
+            .node_types = ncalloc(ast->len, sizeof(unsigned char)),
+            .node_slots = nmalloc(ast->len * sizeof(int)),
+            .node_globals = ncalloc(ast->len, sizeof(unsigned char)),
+            .node_functions = nmalloc(ast->len * sizeof(int)),
+            .slot_types = ByteVec_new(16),
+            .functions = FunctionInfos_new(8),
+            .max_frame_slots = 0
+        },
+        .function = NO_FUNCTION
+    };
+    int i;
+
+    for (i = 0; i < ast->len; i++) {
+        checker.info.node_slots[i] = -1;
+        checker.info.node_functions[i] = NO_FUNCTION;
+    }
+
+    initNameTable(&checker.global_slots);
+    initNameTable(&checker.local_slots);
+    initNameTable(&checker.function_ids);
+    checker.parallel_callbacks = IntVec_new(4);
+
+    checkNode(&checker, 0);
+    checkParallelCallbacks(&checker);
+
+    IntVec_free(&checker.global_slots);
+    IntVec_free(&checker.local_slots);
+    IntVec_free(&checker.function_ids);
+    IntVec_free(&checker.parallel_callbacks);
+
+    return checker.info;
+}
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef ALLOC_IMPL
+
+#define ALLOC_IMPL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Every allocation the project makes goes through these macros, so that `-trace-alloc` can
+// attribute it to the line that made it and to the phase the program was in at the time.
+#define nmalloc(size) trackedMalloc((size), __FILE__, __LINE__)
+#define ncalloc(count, size) trackedCalloc((count), (size), __FILE__, __LINE__)
+#define nrealloc(ptr, size) trackedRealloc((ptr), (size), __FILE__, __LINE__)
+#define nstrdup(str) trackedStrndup((str), strlen(str), __FILE__, __LINE__)
+#define nstrndup(str, len) trackedStrndup((str), (len), __FILE__, __LINE__)
+#define nfree(ptr) trackedFree(ptr)
+
+typedef enum AllocPhase {
+    Phase_Other,
+    Phase_Lex,
+    Phase_Parse,
+    Phase_Check,
+    Phase_Interpret,
+    NUM_PHASES
+} AllocPhase;
+
+typedef struct AllocCounts {
+    long count;
+    long bytes;
+    long live_bytes;
+    long live_blocks;
+} AllocCounts;
+
+typedef struct AllocSite {
+    const char *file; // NULL if the slot is empty
+    int line;
+    AllocCounts counts;
+} AllocSite;
+
+// Stored in front of every block, so a free knows how big the block was and who allocated it.
+// 16 bytes keeps the block itself aligned the same way malloc's result is
+typedef struct AllocHeader {
+    size_t size;
+    int site; // index into alloc_sites, or -1 if the block was allocated while tracing was off
+    int phase;
+} AllocHeader;
+
+#define ALLOC_SITES_CAPACITY 1024 // must be a power of 2
+#define ALLOC_REPORT_TOP 10
+
+bool alloc_tracing = false;
+pthread_mutex_t alloc_tracing_lock = PTHREAD_MUTEX_INITIALIZER; // the I/O threads allocate too
+AllocPhase alloc_phase = Phase_Other;
+AllocSite alloc_sites[ALLOC_SITES_CAPACITY];
+AllocCounts alloc_phases[NUM_PHASES];
+
+/// @brief Sets the phase new allocations are attributed to
+void setAllocPhase(AllocPhase phase) {
+    alloc_phase = phase;
+}
+
+/// @brief Finds (or adds) the site table entry of a file and line
+/// @return The index of the site, or -1 if the table is full
+int allocSite(const char *file, int line) {
+    unsigned int hash = ((unsigned int)(unsigned long)file * 31u + (unsigned int)line) * 2654435761u;
+    int i;
+
+    for (i = 0; i < ALLOC_SITES_CAPACITY; i++) {
+        int slot = (hash + i) & (ALLOC_SITES_CAPACITY - 1);
+
+        if (alloc_sites[slot].file == NULL) {
+            alloc_sites[slot].file = file;
+            alloc_sites[slot].line = line;
+            return slot;
+        }
+
+        if (alloc_sites[slot].file == file && alloc_sites[slot].line == line) {
+            return slot;
+        }
+    }
+
+    return -1;
+}
+
+void countAlloc(AllocHeader *header, size_t size, const char *file, int line) {
+    header->size = size;
+    header->site = -1;
+    header->phase = alloc_phase;
+
+    if (!alloc_tracing) {
+        return;
+    }
+
+    pthread_mutex_lock(&alloc_tracing_lock);
+    header->site = allocSite(file, line);
+
+    AllocCounts *counts[2] = {
+        alloc_phases + alloc_phase,
+        header->site == -1 ? NULL : &(alloc_sites[header->site].counts)
+    };
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (counts[i] == NULL) {
+            continue;
+        }
+
+        counts[i]->count++;
+        counts[i]->bytes += size;
+        counts[i]->live_bytes += size;
+        counts[i]->live_blocks++;
+    }
+
+    pthread_mutex_unlock(&alloc_tracing_lock);
+}
+
+void countFree(AllocHeader *header) {
+    if (header->site == -1) {
+        return;
+    }
+
+    AllocCounts *counts[2] = {alloc_phases + header->phase, &(alloc_sites[header->site].counts)};
+    int i;
+
+    pthread_mutex_lock(&alloc_tracing_lock);
+
+    for (i = 0; i < 2; i++) {
+        counts[i]->live_bytes -= header->size;
+        counts[i]->live_blocks--;
+    }
+
+    pthread_mutex_unlock(&alloc_tracing_lock);
+}
+
+void *trackedMalloc(size_t size, const char *file, int line) {
+    AllocHeader *header = malloc(sizeof(AllocHeader) + size);
+
+    if (header == NULL) {
+        return NULL;
+    }
+
+    countAlloc(header, size, file, line);
+
+    return header + 1;
+}
+
+void *trackedCalloc(size_t count, size_t size, const char *file, int line) {
+    void *ptr = trackedMalloc(count * size, file, line);
+
+    if (ptr != NULL) {
+        memset(ptr, 0, count * size);
+    }
+
+    return ptr;
+}
+
+void *trackedRealloc(void *ptr, size_t size, const char *file, int line) {
+    if (ptr == NULL) {
+        return trackedMalloc(size, file, line);
+    }
+
+    AllocHeader *header = (AllocHeader*)ptr - 1;
+
+    countFree(header);
+    header = realloc(header, sizeof(AllocHeader) + size);
+
+    if (header == NULL) {
+        return NULL;
+    }
+
+    countAlloc(header, size, file, line);
+
+    return header + 1;
+}
+
+char *trackedStrndup(const char *str, size_t len, const char *file, int line) {
+    char *copy = trackedMalloc(len + 1, file, line);
+
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+
+    return copy;
+}
+
+void trackedFree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    AllocHeader *header = (AllocHeader*)ptr - 1;
+
+    countFree(header);
+    free(header);
+}
+
+/// @brief Prints where memory was allocated: totals per phase, the sites that allocated the most, and what was never freed
+void printAllocReport() {
+    char *phase_names[NUM_PHASES] = {"other", "lex", "parse", "check", "interpret"};
+    int top[ALLOC_REPORT_TOP];
+    int num_top = 0;
+    long leaked_bytes = 0;
+    long leaked_blocks = 0;
+    int i, j;
+
+    fprintf(stderr, "allocation report\n");
+    fprintf(stderr, "  %-12s %10s %12s %12s\n", "phase", "allocs", "bytes", "live bytes");
+
+    for (i = 0; i < NUM_PHASES; i++) {
+        fprintf(stderr, "  %-12s %10ld %12ld %12ld\n", phase_names[i], alloc_phases[i].count, alloc_phases[i].bytes, alloc_phases[i].live_bytes);
+
+        leaked_bytes += alloc_phases[i].live_bytes;
+        leaked_blocks += alloc_phases[i].live_blocks;
+    }
+
+    // Insertion sort the sites with the most bytes into `top`
+    for (i = 0; i < ALLOC_SITES_CAPACITY; i++) {
+        if (alloc_sites[i].file == NULL) {
+            continue;
+        }
+
+        for (j = num_top; j > 0 && alloc_sites[top[j - 1]].counts.bytes < alloc_sites[i].counts.bytes; j--) {
+            if (j < ALLOC_REPORT_TOP) {
+                top[j] = top[j - 1];
+            }
+        }
+
+        if (j < ALLOC_REPORT_TOP) {
+            top[j] = i;
+
+            if (num_top < ALLOC_REPORT_TOP) {
+                num_top++;
+            }
+        }
+    }
+
+    fprintf(stderr, "  top allocation sites:\n");
+    fprintf(stderr, "  %-36s %10s %12s %12s\n", "site", "allocs", "bytes", "live bytes");
+
+    for (i = 0; i < num_top; i++) {
+        AllocSite *site = alloc_sites + top[i];
+        char location[256];
+
+        snprintf(location, sizeof(location), "%s:%d", site->file, site->line);
+        fprintf(stderr, "  %-36s %10ld %12ld %12ld\n", location, site->counts.count, site->counts.bytes, site->counts.live_bytes);
+    }
+
+    fprintf(stderr, "  leaked: %ld bytes in %ld blocks\n", leaked_bytes, leaked_blocks);
+}
+
+/// @brief Starts tracing allocations, and prints a report when the program exits
+void startAllocTracing() {
+    alloc_tracing = true;
+    atexit(printAllocReport);
+}
+
+#endif
@@ -19,8 +19,16 @@ typedef struct AstringList {
     #include <stdlib.h>
     #include <stdbool.h>
     #include <math.h>
+    #include <errno.h>
+    #include <limits.h>
+    #ifdef __x86_64__
+        #include <immintrin.h>
+    #endif
 #endif
 
+#include "alloc.h"
+#include "format.h"
+
 #ifndef ASTR_IMPL
 
 #define ASTR_IMPL
@@ -38,7 +46,7 @@ bool file_exists(char *filename) {
 /// @param _string The Astr to convert
 /// @return The converted string
 char *AstrToStr(Astr _string) {
-    char *str_loc = malloc(_string.len + 1);
+    char *str_loc = nmalloc(_string.len + 1);
     if (!str_loc) return NULL;
 
     memcpy(str_loc, _string.str_ref, _string.len);
@@ -71,7 +79,7 @@ Astr substring(Astr _string, int start, int end) {
     Astr _substring;
     int len = end - start;
     char *str_start = _string.str_ref + start;
-    char *new_ref = malloc(len + 1);
+    char *new_ref = nmalloc(len + 1);
 
     memcpy(new_ref, str_start, len);
 
@@ -103,7 +111,7 @@ Astr substringRef(Astr _string, int start, int end) {
 /// @return A + B concatenated
 Astr concat(Astr a, Astr b) {
 	int new_size = a.len + b.len;
-	char *new_ref = malloc(new_size);
+	char *new_ref = nmalloc(new_size);
 	
 	memcpy(new_ref, a.str_ref, a.len);
 	memcpy(new_ref + a.len, b.str_ref, b.len);
@@ -124,13 +132,13 @@ Astr concat(Astr a, Astr b) {
 /// @return A + B concatenated
 Astr concatFree(Astr a, Astr b) {
 	int new_size = a.len + b.len;
-	Astr *new = malloc(new_size);
+	Astr *new = nmalloc(new_size);
 	
 	memcpy(new, a.str_ref, a.len);
 	memcpy(new + a.len, b.str_ref, b.len);
 
-    free(a.str_ref);
-    // free(b.str_ref);
+    nfree(a.str_ref);
+    // nfree(b.str_ref);
 	
 	return *new;
 }
@@ -139,7 +147,7 @@ Astr concatFree(Astr a, Astr b) {
 /// @param a The 1st string to concat and where the result will be stored
 /// @param b The 2nd string to concat
 void concatAppend(Astr a, Astr b) {
-    char *a_ref = realloc(a.str_ref, a.len + b.len + 1);
+    char *a_ref = nrealloc(a.str_ref, a.len + b.len + 1);
 
     memcpy(a_ref, a.str_ref, a.len);
 	memcpy(a_ref + a.len, b.str_ref, b.len);
@@ -195,7 +203,7 @@ void makeUpperCase(Astr _string) {
 /// @param _string The Astr to copy
 /// @return A pointer to the newly created copy
 Astr* Astrcpy(Astr _string) {
-	Astr* b = malloc(_string.len);
+	Astr* b = nmalloc(_string.len);
 	memcpy(b, &_string, _string.len);
 
 	return b;
@@ -206,16 +214,47 @@ bool isDigit(char c) {
     return (c >= '0' && c <= '9');
 }
 
-/// @brief Returns whether or not an Astr `_string` is an integer
-/// @param _string The Astr to check
-/// @return Is `_string` an integer?
-bool AstrIsD(Astr _string) {
+// Vectorized string kernels. Each one has a scalar reference version, an SSE2 version
+// (always available on x86-64) and an AVX2 version that is picked at runtime when the CPU supports it.
+// The vector loops only ever load whole blocks inside the string, and hand the tail to the scalar version.
+
+#define ASTR_SIMD_SCALAR 0
+#define ASTR_SIMD_SSE2 1
+#define ASTR_SIMD_AVX2 2
+
+int astr_simd_level = -1;
+
+/// @brief Returns the best set of vector instructions the CPU supports
+int astrSimdLevel() {
+    if (astr_simd_level == -1) {
+        #ifdef __x86_64__
+        __builtin_cpu_init();
+        astr_simd_level = __builtin_cpu_supports("avx2") ? ASTR_SIMD_AVX2 : ASTR_SIMD_SSE2;
+        #else
+        astr_simd_level = ASTR_SIMD_SCALAR;
+        #endif
+    }
+
+    return astr_simd_level;
+}
+
+bool bytesEqualScalar(const char *a, const char *b, int len) {
     int i;
 
-    for (i = 0; i < _string.len; i++) {
-        char c = charat(_string, i);
+    for (i = 0; i < len; i++) {
+        if (a[i] != b[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool bytesDigitsScalar(const char *str, int len) {
+    int i;
 
-        if (!isDigit(c) && c != '-') {
+    for (i = 0; i < len; i++) {
+        if (!isDigit(str[i]) && str[i] != '-') {
             return false;
         }
     }
@@ -223,13 +262,289 @@ bool AstrIsD(Astr _string) {
     return true;
 }
 
+int findByteScalar(const char *str, int len, char c) {
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if (str[i] == c) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int findBytesScalar(const char *haystack, int len, const char *needle, int needle_len) {
+    int i;
+
+    for (i = 0; i + needle_len <= len; i++) {
+        if (haystack[i] == needle[0] && memcmp(haystack + i + 1, needle + 1, needle_len - 1) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+#ifdef __x86_64__
+bool bytesEqualSse2(const char *a, const char *b, int len) {
+    int i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xFFFF) {
+            return false;
+        }
+    }
+
+    return bytesEqualScalar(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2")))
+bool bytesEqualAvx2(const char *a, const char *b, int len) {
+    int i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+
+        if ((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)) != 0xFFFFFFFFu) {
+            return false;
+        }
+    }
+
+    return bytesEqualSse2(a + i, b + i, len - i);
+}
+
+bool bytesDigitsSse2(const char *str, int len) {
+    __m128i zero = _mm_set1_epi8('0');
+    __m128i nine = _mm_set1_epi8(9);
+    __m128i minus = _mm_set1_epi8('-');
+    int i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(str + i));
+        __m128i d = _mm_sub_epi8(v, zero);
+
+        // (c - '0') <= 9 as an unsigned compare: min(d, 9) == d
+        __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(d, nine), d);
+        __m128i ok = _mm_or_si128(is_digit, _mm_cmpeq_epi8(v, minus));
+
+        if (_mm_movemask_epi8(ok) != 0xFFFF) {
+            return false;
+        }
+    }
+
+    return bytesDigitsScalar(str + i, len - i);
+}
+
+__attribute__((target("avx2")))
+bool bytesDigitsAvx2(const char *str, int len) {
+    __m256i zero = _mm256_set1_epi8('0');
+    __m256i nine = _mm256_set1_epi8(9);
+    __m256i minus = _mm256_set1_epi8('-');
+    int i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(str + i));
+        __m256i d = _mm256_sub_epi8(v, zero);
+        __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d);
+        __m256i ok = _mm256_or_si256(is_digit, _mm256_cmpeq_epi8(v, minus));
+
+        if ((unsigned int)_mm256_movemask_epi8(ok) != 0xFFFFFFFFu) {
+            return false;
+        }
+    }
+
+    return bytesDigitsSse2(str + i, len - i);
+}
+
+int findByteSse2(const char *str, int len, char c) {
+    __m128i needle = _mm_set1_epi8(c);
+    int i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(str + i)), needle));
+
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    int found = findByteScalar(str + i, len - i, c);
+
+    return found == -1 ? -1 : i + found;
+}
+
+__attribute__((target("avx2")))
+int findByteAvx2(const char *str, int len, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    int i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(str + i)), needle));
+
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    int found = findByteSse2(str + i, len - i, c);
+
+    return found == -1 ? -1 : i + found;
+}
+
+// Substring search compares a block of candidate starts with the needle's first byte and the block `needle_len - 1`
+// bytes further on with its last byte. Only the starts where both match are compared in full, which in most text is
+// almost none of them, so the search runs close to the speed of `findByte`.
+// The needle is at least 2 bytes long; shorter ones are searched for with `findByte`
+
+int findBytesSse2(const char *haystack, int len, const char *needle, int needle_len) {
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+    int i;
+
+    for (i = 0; i + needle_len - 1 + 16 <= len; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(haystack + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i*)(haystack + i + needle_len - 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+
+        while (mask != 0) {
+            int start = i + __builtin_ctz(mask);
+
+            if (memcmp(haystack + start + 1, needle + 1, needle_len - 2) == 0) {
+                return start;
+            }
+
+            mask &= mask - 1;
+        }
+    }
+
+    int found = findBytesScalar(haystack + i, len - i, needle, needle_len);
+
+    return found == -1 ? -1 : i + found;
+}
+
+__attribute__((target("avx2")))
+int findBytesAvx2(const char *haystack, int len, const char *needle, int needle_len) {
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+    int i;
+
+    for (i = 0; i + needle_len - 1 + 32 <= len; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i*)(haystack + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i*)(haystack + i + needle_len - 1));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+
+        while (mask != 0) {
+            int start = i + __builtin_ctz(mask);
+
+            if (memcmp(haystack + start + 1, needle + 1, needle_len - 2) == 0) {
+                return start;
+            }
+
+            mask &= mask - 1;
+        }
+    }
+
+    int found = findBytesSse2(haystack + i, len - i, needle, needle_len);
+
+    return found == -1 ? -1 : i + found;
+}
+#endif
+
+/// @brief Checks if `len` bytes at `a` and `b` are equal
+bool bytesEqual(const char *a, const char *b, int len) {
+    #ifdef __x86_64__
+    if (len >= 32 && astrSimdLevel() == ASTR_SIMD_AVX2) {
+        return bytesEqualAvx2(a, b, len);
+    }
+
+    return bytesEqualSse2(a, b, len);
+    #else
+    return bytesEqualScalar(a, b, len);
+    #endif
+}
+
+/// @brief Checks if `len` bytes at `str` are all digits or `-`
+bool bytesDigits(const char *str, int len) {
+    #ifdef __x86_64__
+    if (len >= 32 && astrSimdLevel() == ASTR_SIMD_AVX2) {
+        return bytesDigitsAvx2(str, len);
+    }
+
+    return bytesDigitsSse2(str, len);
+    #else
+    return bytesDigitsScalar(str, len);
+    #endif
+}
+
+/// @brief Finds the first occurence of `c` in the `len` bytes at `str`
+/// @return The index of `c`, or -1 if it isn't there
+int findByte(const char *str, int len, char c) {
+    #ifdef __x86_64__
+    if (len >= 32 && astrSimdLevel() == ASTR_SIMD_AVX2) {
+        return findByteAvx2(str, len, c);
+    }
+
+    return findByteSse2(str, len, c);
+    #else
+    return findByteScalar(str, len, c);
+    #endif
+}
+
+/// @brief Finds the first occurence of `needle_len` bytes at `needle` in the `len` bytes at `haystack`
+/// @return The index of the needle, or -1 if it isn't there. An empty needle is found at 0
+int findBytes(const char *haystack, int len, const char *needle, int needle_len) {
+    if (needle_len <= 1) {
+        return needle_len == 0 ? 0 : findByte(haystack, len, needle[0]);
+    }
+
+    #ifdef __x86_64__
+    if (len >= 32 + needle_len - 1 && astrSimdLevel() == ASTR_SIMD_AVX2) {
+        return findBytesAvx2(haystack, len, needle, needle_len);
+    }
+
+    return findBytesSse2(haystack, len, needle, needle_len);
+    #else
+    return findBytesScalar(haystack, len, needle, needle_len);
+    #endif
+}
+
+/// @brief Returns the length of a NUL-terminated string, looking at no more than `max` bytes
+/// @param str The string to measure
+/// @param max The most bytes that may be read from `str`
+/// @return The index of the first NUL, or `max` if there's none
+int boundedStrlen(const char *str, int max) {
+    int len = findByte(str, max, '\0');
+
+    return len == -1 ? max : len;
+}
+
+/// @brief Finds the first occurence of a char in an Astr
+/// @param _string The string to search
+/// @param c The char to find
+/// @return The index of `c`, or -1 if `_string` doesn't contain it
+int AstrFindChar(Astr _string, char c) {
+    return findByte(_string.str_ref, _string.len, c);
+}
+
+/// @brief Returns whether or not an Astr `_string` is an integer
+/// @param _string The Astr to check
+/// @return Is `_string` an integer?
+bool AstrIsD(Astr _string) {
+    return bytesDigits(_string.str_ref, _string.len);
+}
+
 /// @brief Converts an Astr into an integer
 /// @param _string The Astr to convert
-/// @return The converted integer. Returns INT_MIN in case of failiure.
+/// @return The converted integer. Returns INT_MIN in case of failiure, or if it doesn't fit in an int.
 int AstrToD(Astr _string) {
     if (!AstrIsD(_string)) {
         printf("Please pass a valid int to AstrToD\n");
-        return _SC_INT_MIN;
+        return INT_MIN;
     }
 
     int ret = 0;
@@ -244,16 +559,20 @@ int AstrToD(Astr _string) {
                 isNegative = true;
             }
 
+            continue;
         }
 
-        int charnum = (int)c - 48;
-        int place = _string.len - 1 - i - isNegative;
-        int placeFactor = pow(10, place);
-
-        ret += (charnum * placeFactor);
+        // Accumulated as a negative number, since INT_MIN has no positive counterpart
+        if (__builtin_mul_overflow(ret, 10, &ret) || __builtin_sub_overflow(ret, (int)c - 48, &ret)) {
+            return INT_MIN;
+        }
     }
 
-    if (isNegative) {
+    if (!isNegative) {
+        if (ret == INT_MIN) {
+            return INT_MIN;
+        }
+
         ret = -ret;
     }
     return ret;
@@ -262,46 +581,19 @@ int AstrToD(Astr _string) {
 /// @brief Generates an Astr from a number
 /// @param x The number to convert into an Astr
 /// @return `x` as an Astr
-Astr fromInt(int x) { 
-	char res[10];
-    Astr ret = {
-        .len = 0,
-        .str_ref = NULL
-    };
-
-    int prev_x = x;
-
-	while (x != 0) {
-        int place = log10(x); // 0 is ones, 1 is tens, etc. 1
-        int val = x / pow(10, place);
-
-        res[ret.len] = (char)(val + 48);
-
-        x -=  val * pow(10, place);
-        
-        int num_zeroes;
-        if (x == 0) {
-            num_zeroes = log10(prev_x);
-        } else {
-            num_zeroes = log10(prev_x) - log10(x); 
-        }
+Astr fromInt(int x) {
+    char res[FORMAT_INT_MAX];
+    int len = formatInt(res, x);
 
-        for (int i = 0; i < num_zeroes; i++) {
-            ret.len++;
-            res[ret.len] = '0';
-        }
-
-        ret.len++;
-    }
+    char *_res = nmalloc(len);
+    memcpy(_res, res, len);
 
-    char *_res = malloc(ret.len);
-    memcpy(_res, &res, ret.len);
-    ret.str_ref = _res;
-
-    return ret;
+    return (Astr){
+        .len = len,
+        .str_ref = _res
+    };
 }
 
-
 /// @brief Converts a regular c-style (null-terminated) string into an Astr
 /// @param _string The c-style string to convert
 /// @return The converted Astr
@@ -318,18 +610,7 @@ bool Astreq(Astr a, Astr b) {
         return false;
     }
 
-    int i;
-
-    for (i = 0; i < a.len; i++) {
-        char c_a = *(a.str_ref + i);
-        char c_b = *(b.str_ref + i);
-
-        if (c_a != c_b) {
-            return false;
-        }
-    }
-
-    return true;
+    return bytesEqual(a.str_ref, b.str_ref, a.len);
 }
 
 /// @brief Returns an Astr at a given index in a list of Astrs
@@ -345,10 +626,62 @@ Astr *AstrAtIndex(Astr_l _string_list, int index) {
     return _string_list.astr_ref + index;
 }
 
-/// @brief Reads a file from a path and converts it into an Astr
-/// @param path The file to read from
-/// @return An Astr of the file contents or (Astr){} in case of failiure
+#define STREAM_BLOCK_SIZE (64 * 1024) // smallest read from a pipe or terminal
+
+/// @brief Reads everything left in a file descriptor that can't be mapped, like a pipe or stdin.
+/// The buffer grows geometrically, so each read asks for at least STREAM_BLOCK_SIZE bytes
+/// @param fd The file descriptor to read from. It isn't closed
+/// @return An Astr of the contents (not NUL-terminated) or (Astr){} in case of failiure
+Astr streamToAstr(int fd) {
+    int cap = STREAM_BLOCK_SIZE;
+    int len = 0;
+    char *buf = nmalloc(cap);
+
+    while (true) {
+        if (cap - len < STREAM_BLOCK_SIZE) {
+            cap *= 2;
+            buf = nrealloc(buf, cap);
+        }
+
+        ssize_t got = read(fd, buf + len, cap - len);
+
+        if (got == 0) {
+            break;
+        }
+
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            printf("Read error\n");
+            nfree(buf);
+            return (Astr){};
+        }
+
+        len += got;
+    }
+
+    if (len == 0) {
+        nfree(buf);
+        return (Astr){.str_ref = "", .len = 0};
+    }
+
+    return (Astr){
+        .str_ref = buf,
+        .len = len
+    };
+}
+
+/// @brief Reads a file from a path and converts it into an Astr. Regular files are mapped
+/// without copying; pipes, terminals and other streams are read in blocks
+/// @param path The file to read from, or "-" for stdin
+/// @return An Astr of the file contents (not NUL-terminated) or (Astr){} in case of failiure
 Astr fileToAstr(const char *path) {
+    if (streq(path, "-")) {
+        return streamToAstr(STDIN_FILENO);
+    }
+
     int fd;
     fd = open(path, O_RDONLY);
     struct stat statbuf;
@@ -364,18 +697,34 @@ Astr fileToAstr(const char *path) {
         return (Astr){};
     }
 
+    // Pipes, /dev/stdin and process substitution have no size to map, and files in /proc
+    // claim to be empty, so all of them are streamed instead
+    if (!S_ISREG(statbuf.st_mode) || statbuf.st_size == 0) {
+        Astr text = streamToAstr(fd);
+        close(fd);
+        return text;
+    }
+
     void* start_addr;
 
     start_addr = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
     if ((void *) -1 == start_addr) {
         printf("Could not map memory\n");
+        close(fd);
         return (Astr){};
     }
 
     close(fd);
 
-    return _Astr(start_addr);
+    // The lexer makes a single pass from start to end
+    madvise(start_addr, statbuf.st_size, MADV_SEQUENTIAL);
+
+    // The mapping isn't NUL-terminated, so the length has to come from the file size
+    return (Astr){
+        .str_ref = start_addr,
+        .len = statbuf.st_size
+    };
 }
 
 /// @brief Returns if a char is a tab, newline, or space
@@ -0,0 +1,542 @@
+#ifndef FORMAT_IMPL
+
+#define FORMAT_IMPL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <stdbool.h>
+
+// The longest strings the formatters below can write
+#define FORMAT_INT_MAX 11 // -2147483648
+#define FORMAT_HEX_MAX 18 // 0x and 16 digits
+#define FORMAT_DOUBLE_MAX 24 // -2.2250738585072014e-308
+
+/// @brief Output that values are formatted into. Nothing is allocated: when the buffer fills up it's
+/// written out to `flush_to`, or if that's NULL, anything that doesn't fit is dropped
+typedef struct FormatBuffer {
+    char *ref;
+    int len;
+    int capacity;
+
+    FILE *flush_to;
+    bool truncated;
+} FormatBuffer;
+
+/// @brief Writes out everything in a buffer that flushes to a file
+void formatFlush(FormatBuffer *out) {
+    if (out->flush_to != NULL && out->len > 0) {
+        fwrite(out->ref, 1, out->len, out->flush_to);
+        out->len = 0;
+    }
+}
+
+/// @brief Makes room for `len` more bytes, flushing if needed
+/// @return Whether there's room
+bool formatReserve(FormatBuffer *out, int len) {
+    if (out->len + len > out->capacity) {
+        formatFlush(out);
+    }
+
+    if (out->len + len > out->capacity) {
+        out->truncated = true;
+        return false;
+    }
+
+    return true;
+}
+
+/// @brief Appends bytes to a buffer. Runs longer than the buffer are written out in pieces
+void formatBytes(FormatBuffer *out, const char *bytes, int len) {
+    while (len > 0) {
+        int room = out->capacity - out->len;
+
+        if (room == 0) {
+            formatFlush(out);
+            room = out->capacity - out->len;
+
+            if (room == 0) {
+                out->truncated = true;
+                return;
+            }
+        }
+
+        int n = len < room ? len : room;
+
+        memcpy(out->ref + out->len, bytes, n);
+        out->len += n;
+        bytes += n;
+        len -= n;
+    }
+}
+
+static const char format_digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/// @brief Writes the decimal digits of an unsigned number
+/// @param buf Where to write the digits, which has room for 10
+/// @return The number of digits
+int formatUnsigned(char *buf, uint32_t x) {
+    char digits[10];
+    int i = sizeof(digits);
+
+    // Two digits at a time from the end
+    while (x >= 100) {
+        i -= 2;
+        memcpy(digits + i, format_digit_pairs + (x % 100) * 2, 2);
+        x /= 100;
+    }
+
+    if (x >= 10) {
+        i -= 2;
+        memcpy(digits + i, format_digit_pairs + x * 2, 2);
+    } else {
+        digits[--i] = (char)('0' + x);
+    }
+
+    memcpy(buf, digits + i, sizeof(digits) - i);
+
+    return sizeof(digits) - i;
+}
+
+/// @brief Writes an int in decimal
+/// @param buf Where to write the int, which has room for FORMAT_INT_MAX chars. It isn't NUL-terminated
+/// @return The number of chars written
+int formatInt(char *buf, int x) {
+    if (x < 0) {
+        buf[0] = '-';
+        return 1 + formatUnsigned(buf + 1, -(uint32_t)x);
+    }
+
+    return formatUnsigned(buf, x);
+}
+
+/// @brief Writes a number in lowercase hex, without a prefix or leading zeros
+/// @param buf Where to write the digits, which has room for 16
+/// @return The number of digits
+int formatHex(char *buf, uint64_t x) {
+    int len = x == 0 ? 1 : (64 - __builtin_clzll(x) + 3) / 4;
+    int i;
+
+    for (i = len - 1; i >= 0; i--) {
+        buf[i] = "0123456789abcdef"[x & 15];
+        x >>= 4;
+    }
+
+    return len;
+}
+
+/// @brief Writes a pointer like `0x7ffd1234`
+/// @param buf Where to write the pointer, which has room for FORMAT_HEX_MAX chars
+/// @return The number of chars written
+int formatPointer(char *buf, const void *ptr) {
+    buf[0] = '0';
+    buf[1] = 'x';
+
+    return 2 + formatHex(buf + 2, (uintptr_t)ptr);
+}
+
+/// @brief A floating point number with a 64-bit significand, `f * 2^e`, used by the Grisu algorithm
+typedef struct DiyFp {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+/// @brief A cached power of ten, `10^decimal_exponent ~= f * 2^e`
+typedef struct CachedPower {
+    uint64_t f;
+    int e;
+    int decimal_exponent;
+} CachedPower;
+
+#define CACHED_POWERS_OFFSET 348 // minus the exponent of the first cached power
+#define CACHED_POWERS_DISTANCE 8 // decimal exponents between cached powers
+
+// Normalized and rounded to nearest, 10^-348 to 10^340
+static const CachedPower cached_powers[] = {
+{0xfa8fd5a0081c0288ULL, -1220, -348},
+    {0xbaaee17fa23ebf76ULL, -1193, -340},
+    {0x8b16fb203055ac76ULL, -1166, -332},
+    {0xcf42894a5dce35eaULL, -1140, -324},
+    {0x9a6bb0aa55653b2dULL, -1113, -316},
+    {0xe61acf033d1a45dfULL, -1087, -308},
+    {0xab70fe17c79ac6caULL, -1060, -300},
+    {0xff77b1fcbebcdc4fULL, -1034, -292},
+    {0xbe5691ef416bd60cULL, -1007, -284},
+    {0x8dd01fad907ffc3cULL, -980, -276},
+    {0xd3515c2831559a83ULL, -954, -268},
+    {0x9d71ac8fada6c9b5ULL, -927, -260},
+    {0xea9c227723ee8bcbULL, -901, -252},
+    {0xaecc49914078536dULL, -874, -244},
+    {0x823c12795db6ce57ULL, -847, -236},
+    {0xc21094364dfb5637ULL, -821, -228},
+    {0x9096ea6f3848984fULL, -794, -220},
+    {0xd77485cb25823ac7ULL, -768, -212},
+    {0xa086cfcd97bf97f4ULL, -741, -204},
+    {0xef340a98172aace5ULL, -715, -196},
+    {0xb23867fb2a35b28eULL, -688, -188},
+    {0x84c8d4dfd2c63f3bULL, -661, -180},
+    {0xc5dd44271ad3cdbaULL, -635, -172},
+    {0x936b9fcebb25c996ULL, -608, -164},
+    {0xdbac6c247d62a584ULL, -582, -156},
+    {0xa3ab66580d5fdaf6ULL, -555, -148},
+    {0xf3e2f893dec3f126ULL, -529, -140},
+    {0xb5b5ada8aaff80b8ULL, -502, -132},
+    {0x87625f056c7c4a8bULL, -475, -124},
+    {0xc9bcff6034c13053ULL, -449, -116},
+    {0x964e858c91ba2655ULL, -422, -108},
+    {0xdff9772470297ebdULL, -396, -100},
+    {0xa6dfbd9fb8e5b88fULL, -369, -92},
+    {0xf8a95fcf88747d94ULL, -343, -84},
+    {0xb94470938fa89bcfULL, -316, -76},
+    {0x8a08f0f8bf0f156bULL, -289, -68},
+    {0xcdb02555653131b6ULL, -263, -60},
+    {0x993fe2c6d07b7facULL, -236, -52},
+    {0xe45c10c42a2b3b06ULL, -210, -44},
+    {0xaa242499697392d3ULL, -183, -36},
+    {0xfd87b5f28300ca0eULL, -157, -28},
+    {0xbce5086492111aebULL, -130, -20},
+    {0x8cbccc096f5088ccULL, -103, -12},
+    {0xd1b71758e219652cULL, -77, -4},
+    {0x9c40000000000000ULL, -50, 4},
+    {0xe8d4a51000000000ULL, -24, 12},
+    {0xad78ebc5ac620000ULL, 3, 20},
+    {0x813f3978f8940984ULL, 30, 28},
+    {0xc097ce7bc90715b3ULL, 56, 36},
+    {0x8f7e32ce7bea5c70ULL, 83, 44},
+    {0xd5d238a4abe98068ULL, 109, 52},
+    {0x9f4f2726179a2245ULL, 136, 60},
+    {0xed63a231d4c4fb27ULL, 162, 68},
+    {0xb0de65388cc8ada8ULL, 189, 76},
+    {0x83c7088e1aab65dbULL, 216, 84},
+    {0xc45d1df942711d9aULL, 242, 92},
+    {0x924d692ca61be758ULL, 269, 100},
+    {0xda01ee641a708deaULL, 295, 108},
+    {0xa26da3999aef774aULL, 322, 116},
+    {0xf209787bb47d6b85ULL, 348, 124},
+    {0xb454e4a179dd1877ULL, 375, 132},
+    {0x865b86925b9bc5c2ULL, 402, 140},
+    {0xc83553c5c8965d3dULL, 428, 148},
+    {0x952ab45cfa97a0b3ULL, 455, 156},
+    {0xde469fbd99a05fe3ULL, 481, 164},
+    {0xa59bc234db398c25ULL, 508, 172},
+    {0xf6c69a72a3989f5cULL, 534, 180},
+    {0xb7dcbf5354e9beceULL, 561, 188},
+    {0x88fcf317f22241e2ULL, 588, 196},
+    {0xcc20ce9bd35c78a5ULL, 614, 204},
+    {0x98165af37b2153dfULL, 641, 212},
+    {0xe2a0b5dc971f303aULL, 667, 220},
+    {0xa8d9d1535ce3b396ULL, 694, 228},
+    {0xfb9b7cd9a4a7443cULL, 720, 236},
+    {0xbb764c4ca7a44410ULL, 747, 244},
+    {0x8bab8eefb6409c1aULL, 774, 252},
+    {0xd01fef10a657842cULL, 800, 260},
+    {0x9b10a4e5e9913129ULL, 827, 268},
+    {0xe7109bfba19c0c9dULL, 853, 276},
+    {0xac2820d9623bf429ULL, 880, 284},
+    {0x80444b5e7aa7cf85ULL, 907, 292},
+    {0xbf21e44003acdd2dULL, 933, 300},
+    {0x8e679c2f5e44ff8fULL, 960, 308},
+    {0xd433179d9c8cb841ULL, 986, 316},
+    {0x9e19db92b4e31ba9ULL, 1013, 324},
+    {0xeb96bf6ebadf77d9ULL, 1039, 332},
+    {0xaf87023b9bf0ee6bULL, 1066, 340}
+};
+
+#define DOUBLE_SIGNIFICAND_BITS 52
+#define DOUBLE_HIDDEN_BIT (1ULL << DOUBLE_SIGNIFICAND_BITS)
+#define DOUBLE_EXPONENT_BIAS (0x3FF + DOUBLE_SIGNIFICAND_BITS)
+#define DOUBLE_DENORMAL_EXPONENT (1 - DOUBLE_EXPONENT_BIAS)
+
+/// @brief Multiplies two DiyFps, rounding the 128-bit product to its top 64 bits
+DiyFp diyFpTimes(DiyFp a, DiyFp b) {
+    unsigned __int128 product = (unsigned __int128)a.f * b.f;
+    uint64_t f = (uint64_t)(product >> 64) + (uint64_t)((product >> 63) & 1);
+
+    return (DiyFp){.f = f, .e = a.e + b.e + 64};
+}
+
+/// @brief Shifts a DiyFp left until its top bit is set
+DiyFp diyFpNormalize(DiyFp x) {
+    int shift = __builtin_clzll(x.f);
+
+    return (DiyFp){.f = x.f << shift, .e = x.e - shift};
+}
+
+/// @brief Decides whether a digit string is the closest shortest one, stepping its last digit down towards `w` if needed.
+/// The names follow Loitsch's "Printing Floating-Point Numbers Quickly and Accurately with Integers"
+/// @return Whether the digits are known to be correct. If not, the caller has to fall back to an exact method
+bool roundWeed(char *digits, int len, uint64_t distance_too_high_w, uint64_t unsafe_interval, uint64_t rest, uint64_t ten_kappa, uint64_t unit) {
+    uint64_t small_distance = distance_too_high_w - unit;
+    uint64_t big_distance = distance_too_high_w + unit;
+
+    while (rest < small_distance && unsafe_interval - rest >= ten_kappa
+        && (rest + ten_kappa < small_distance || small_distance - rest >= rest + ten_kappa - small_distance)) {
+        digits[len - 1]--;
+        rest += ten_kappa;
+    }
+
+    if (rest < big_distance && unsafe_interval - rest >= ten_kappa
+        && (rest + ten_kappa < big_distance || big_distance - rest > rest + ten_kappa - big_distance)) {
+        return false;
+    }
+
+    return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+}
+
+/// @brief Generates the shortest digits in the interval (low, high) around w, which are all scaled so high's exponent is between -60 and -32
+/// @return Whether the digits could be proven correct
+bool grisuDigits(DiyFp low, DiyFp w, DiyFp high, char *digits, int *len, int *kappa) {
+    uint64_t unit = 1;
+    DiyFp too_low = {.f = low.f - unit, .e = low.e};
+    DiyFp too_high = {.f = high.f + unit, .e = high.e};
+    uint64_t unsafe_interval = too_high.f - too_low.f;
+
+    int shift = -w.e;
+    uint64_t one = 1ULL << shift;
+    uint32_t integrals = (uint32_t)(too_high.f >> shift);
+    uint64_t fractionals = too_high.f & (one - 1);
+    uint32_t divisor = 1;
+
+    *kappa = 1;
+
+    while (integrals / divisor >= 10) {
+        divisor *= 10;
+        (*kappa)++;
+    }
+
+    *len = 0;
+
+    while (*kappa > 0) {
+        digits[(*len)++] = (char)('0' + integrals / divisor);
+        integrals %= divisor;
+        (*kappa)--;
+
+        uint64_t rest = ((uint64_t)integrals << shift) + fractionals;
+
+        if (rest < unsafe_interval) {
+            return roundWeed(digits, *len, too_high.f - w.f, unsafe_interval, rest, (uint64_t)divisor << shift, unit);
+        }
+
+        divisor /= 10;
+    }
+
+    while (true) {
+        fractionals *= 10;
+        unit *= 10;
+        unsafe_interval *= 10;
+
+        digits[(*len)++] = (char)('0' + (fractionals >> shift));
+        fractionals &= one - 1;
+        (*kappa)--;
+
+        if (fractionals < unsafe_interval) {
+            return roundWeed(digits, *len, (too_high.f - w.f) * unit, unsafe_interval, fractionals, one, unit);
+        }
+    }
+}
+
+/// @brief Finds the shortest digits that read back as a positive, finite double with Grisu3
+/// @param digits Where to write the digits, which has room for 18
+/// @param len Set to the number of digits
+/// @param exponent Set so the double is `digits * 10^exponent`
+/// @return Whether Grisu3 succeeded, which it does for about 99.5% of doubles
+bool grisu3(double value, char *digits, int *len, int *exponent) {
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    int biased_exponent = (int)(bits >> DOUBLE_SIGNIFICAND_BITS);
+    uint64_t significand = bits & (DOUBLE_HIDDEN_BIT - 1);
+    DiyFp v;
+
+    if (biased_exponent == 0) {
+        v = (DiyFp){.f = significand, .e = DOUBLE_DENORMAL_EXPONENT};
+    } else {
+        v = (DiyFp){.f = significand | DOUBLE_HIDDEN_BIT, .e = biased_exponent - DOUBLE_EXPONENT_BIAS};
+    }
+
+    // The boundaries are halfway to the neighboring doubles. The one below is closer when v is a power of 2
+    DiyFp plus = diyFpNormalize((DiyFp){.f = (v.f << 1) + 1, .e = v.e - 1});
+    DiyFp minus;
+
+    if (significand == 0 && biased_exponent > 1) {
+        minus = (DiyFp){.f = (v.f << 2) - 1, .e = v.e - 2};
+    } else {
+        minus = (DiyFp){.f = (v.f << 1) - 1, .e = v.e - 1};
+    }
+
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    DiyFp w = diyFpNormalize(v);
+
+    // Pick the cached power that scales w's exponent into [-60, -32]
+    int min_exponent = -60 - (w.e + 64);
+    int k = (int)ceil((min_exponent + 63) * 0.30102999566398114);
+    CachedPower power = cached_powers[(CACHED_POWERS_OFFSET + k - 1) / CACHED_POWERS_DISTANCE + 1];
+    DiyFp ten_mk = {.f = power.f, .e = power.e};
+
+    int kappa;
+    bool ok = grisuDigits(diyFpTimes(minus, ten_mk), diyFpTimes(w, ten_mk), diyFpTimes(plus, ten_mk), digits, len, &kappa);
+
+    *exponent = kappa - power.decimal_exponent;
+
+    return ok;
+}
+
+/// @brief Finds the shortest digits that read back as a positive, finite double by trying every precision with snprintf.
+/// Slow, but exact, so it's used when Grisu3 can't decide
+/// @param digits Where to write the digits, which has room for 18
+/// @param len Set to the number of digits
+/// @param exponent Set so the double is `digits * 10^exponent`
+void shortestDigitsExact(double value, char *digits, int *len, int *exponent) {
+    char buf[32];
+    int precision;
+
+    for (precision = 1; precision < 17; precision++) {
+        snprintf(buf, sizeof(buf), "%.*e", precision - 1, value);
+
+        if (strtod(buf, NULL) == value) {
+            break;
+        }
+    }
+
+    snprintf(buf, sizeof(buf), "%.*e", precision - 1, value);
+
+    // buf looks like d.ddde+XX
+    char *e = strchr(buf, 'e');
+    int i;
+
+    *len = 0;
+
+    for (i = 0; buf + i < e; i++) {
+        if (buf[i] != '.') {
+            digits[(*len)++] = buf[i];
+        }
+    }
+
+    // Trailing zeros aren't needed
+    while (*len > 1 && digits[*len - 1] == '0') {
+        (*len)--;
+    }
+
+    *exponent = atoi(e + 1) - (*len - 1);
+}
+
+/// @brief Writes the shortest representation of a double that reads back as the same double.
+/// Like Python's `repr`, numbers with a decimal exponent from -4 to 15 are written out in full (`100.0`, `0.0001`),
+/// others in scientific notation (`1e+16`, `1.5e-05`), and whole numbers always get a `.0`
+/// @param buf Where to write the double, which has room for FORMAT_DOUBLE_MAX chars. It isn't NUL-terminated
+/// @return The number of chars written
+int formatDouble(char *buf, double value) {
+    int len = 0;
+
+    if (signbit(value)) {
+        buf[len++] = '-';
+        value = -value;
+    }
+
+    if (isnan(value)) {
+        memcpy(buf, "nan", 3);
+        return 3;
+    }
+
+    if (isinf(value)) {
+        memcpy(buf + len, "inf", 3);
+        return len + 3;
+    }
+
+    if (value == 0) {
+        memcpy(buf + len, "0.0", 3);
+        return len + 3;
+    }
+
+    char digits[18];
+    int num_digits;
+    int exponent;
+
+    if (!grisu3(value, digits, &num_digits, &exponent)) {
+        shortestDigitsExact(value, digits, &num_digits, &exponent);
+    }
+
+    // Where the decimal point goes relative to the digits
+    int point = num_digits + exponent;
+
+    if (point - 1 < -4 || point - 1 >= 16) {
+        buf[len++] = digits[0];
+
+        if (num_digits > 1) {
+            buf[len++] = '.';
+            memcpy(buf + len, digits + 1, num_digits - 1);
+            len += num_digits - 1;
+        }
+
+        int e = point - 1;
+
+        buf[len++] = 'e';
+        buf[len++] = e < 0 ? '-' : '+';
+
+        if (e < 0) {
+            e = -e;
+        }
+
+        if (e < 10) {
+            buf[len++] = '0';
+        }
+
+        return len + formatUnsigned(buf + len, e);
+    }
+
+    if (point <= 0) {
+        memcpy(buf + len, "0.", 2);
+        len += 2;
+        memset(buf + len, '0', -point);
+        len += -point;
+        memcpy(buf + len, digits, num_digits);
+        return len + num_digits;
+    }
+
+    if (point >= num_digits) {
+        memcpy(buf + len, digits, num_digits);
+        len += num_digits;
+        memset(buf + len, '0', point - num_digits);
+        len += point - num_digits;
+        memcpy(buf + len, ".0", 2);
+        return len + 2;
+    }
+
+    memcpy(buf + len, digits, point);
+    len += point;
+    buf[len++] = '.';
+    memcpy(buf + len, digits + point, num_digits - point);
+
+    return len + num_digits - point;
+}
+
+/// @brief Appends an int to a buffer
+void formatIntTo(FormatBuffer *out, int x) {
+    if (formatReserve(out, FORMAT_INT_MAX)) {
+        out->len += formatInt(out->ref + out->len, x);
+    }
+}
+
+/// @brief Appends a double to a buffer
+void formatDoubleTo(FormatBuffer *out, double x) {
+    if (formatReserve(out, FORMAT_DOUBLE_MAX)) {
+        out->len += formatDouble(out->ref + out->len, x);
+    }
+}
+
+/// @brief Appends a pointer to a buffer
+void formatPointerTo(FormatBuffer *out, const void *ptr) {
+    if (formatReserve(out, FORMAT_HEX_MAX)) {
+        out->len += formatPointer(out->ref + out->len, ptr);
+    }
+}
+
+#endif
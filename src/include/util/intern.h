@@ -0,0 +1,94 @@
+#ifndef INTERN_IMPL
+
+#define INTERN_IMPL
+
+#define INTERN_CAPACITY 256
+
+DEFINE_VEC(AstrVec, Astr)
+
+/// @brief A table of unique strings. Each string is stored once, NUL-terminated, and referred to by its index (its intern id)
+typedef struct InternTable {
+    AstrVec strs;
+
+    int *buckets; // open addressing, holds intern ids or -1
+    int num_buckets;
+} InternTable;
+
+InternTable interned;
+
+/// @brief Hashes the data of an Astr (FNV-1a)
+unsigned int hashAstr(Astr _string) {
+    unsigned int hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < _string.len; i++) {
+        hash ^= (unsigned char)_string.str_ref[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/// @brief Rebuilds the bucket array of the intern table with `num_buckets` buckets
+void rehashInterned(int num_buckets) {
+    int i;
+
+    nfree(interned.buckets);
+    interned.buckets = nmalloc(num_buckets * sizeof(int));
+    interned.num_buckets = num_buckets;
+
+    for (i = 0; i < num_buckets; i++) {
+        interned.buckets[i] = -1;
+    }
+
+    for (i = 0; i < interned.strs.len; i++) {
+        unsigned int bucket = hashAstr(interned.strs.ref[i]) & (num_buckets - 1);
+
+        while (interned.buckets[bucket] != -1) {
+            bucket = (bucket + 1) & (num_buckets - 1);
+        }
+
+        interned.buckets[bucket] = i;
+    }
+}
+
+/// @brief Interns a string, copying it into the table if it isn't there yet
+/// @param _string The string to intern
+/// @return The intern id of the string
+int internAstr(Astr _string) {
+    if (interned.strs.ref == NULL) {
+        interned.strs = AstrVec_new(INTERN_CAPACITY);
+        rehashInterned(INTERN_CAPACITY * 2);
+    }
+
+    unsigned int bucket = hashAstr(_string) & (interned.num_buckets - 1);
+
+    while (interned.buckets[bucket] != -1) {
+        int id = interned.buckets[bucket];
+
+        if (Astreq(interned.strs.ref[id], _string)) {
+            return id;
+        }
+
+        bucket = (bucket + 1) & (interned.num_buckets - 1);
+    }
+
+    int id = interned.strs.len;
+
+    AstrVec_push(&interned.strs, (Astr){.str_ref = AstrToStr(_string), .len = _string.len});
+
+    if (interned.strs.len * 2 > interned.num_buckets) {
+        rehashInterned(interned.num_buckets * 2);
+    } else {
+        interned.buckets[bucket] = id;
+    }
+
+    return id;
+}
+
+/// @brief Returns the NUL-terminated string with a given intern id
+char *internedStr(int id) {
+    return interned.strs.ref[id].str_ref;
+}
+
+#endif
@@ -0,0 +1,352 @@
+#ifndef IO_IMPL
+
+#define IO_IMPL
+
+#include <pthread.h>
+
+// Asynchronous file I/O for the I/O builtins. Operations are queued on a pool of worker threads
+// and run alongside the interpreter and each other, and the interpreter only blocks when it awaits one.
+// Files are opened by the operations that run on them, so opening thousands of files doesn't block either,
+// and are closed as soon as no operation is using them, so they never run into the limit on open files.
+// Only the interpreter thread queues operations and reads their results, once they're done.
+// A write frees its copy of the data as soon as it's written. What a read read is handed to the interpreter
+// when the read is awaited, and everything else is freed by `freeIo` when the program ends.
+
+#define IO_MAX_WORKERS 32
+#define IO_READ_BLOCK (64 * 1024)
+
+typedef enum IoOpKind {
+    Io_ReadAll,
+    Io_ReadLines,
+    Io_Write
+} IoOpKind;
+
+typedef struct IoFile {
+    char *path;
+    int num_ops; // the operations queued on the file
+    bool writing; // whether the file is written (created or truncated) or read, decided by its first operation
+    long write_offset; // where the next queued write goes
+
+    // Writes share one descriptor, opened by the first write and closed when no write is running
+    pthread_mutex_t lock;
+    int fd; // -1 while no write is running
+    int writers; // the writes using `fd`
+    bool created; // whether the file has been truncated by its first write
+} IoFile;
+
+typedef struct IoOp {
+    IoOpKind kind;
+    IoFile *file;
+    struct IoOp *next; // the next operation in the queue
+
+    char *data; // what's written, or what was read, NUL-terminated. NULL once a write is done or a read is awaited
+    long len;
+    long offset; // where a write goes
+    IntVec lines; // where each line starts in `data`, for Io_ReadLines, whose line breaks are replaced by NULs
+    struct String *text; // the string that took over `data` when the read was first awaited, or NULL
+
+    int error; // the errno the operation failed with, or 0
+    bool done;
+} IoOp;
+
+DEFINE_VEC(IoFiles, IoFile*)
+DEFINE_VEC(IoOps, IoOp*)
+
+typedef struct IoPool {
+    pthread_mutex_t lock;
+    pthread_cond_t queued; // signalled when an operation is queued
+    pthread_cond_t finished; // broadcast when an operation is done
+
+    IoOp *head;
+    IoOp *tail;
+    int pending; // operations queued or running
+    int num_workers; // started with the first operation
+} IoPool;
+
+IoPool io_pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .queued = PTHREAD_COND_INITIALIZER, .finished = PTHREAD_COND_INITIALIZER};
+
+IoFiles io_files; // indexed by the ids `open` returns
+IoOps io_ops; // indexed by the ids operations return
+
+/// @brief Reads a whole file into `op->data`, starting with a buffer of the file's size
+void ioRead(IoOp *op, int fd) {
+    struct stat info;
+    long capacity = fstat(fd, &info) == 0 && info.st_size > 0 ? info.st_size + 1 : IO_READ_BLOCK;
+
+    op->data = nmalloc(capacity);
+    op->len = 0;
+
+    for (;;) {
+        // The file may have grown since it was measured
+        if (op->len + 1 >= capacity) {
+            capacity *= 2;
+            op->data = nrealloc(op->data, capacity);
+        }
+
+        long n = pread(fd, op->data + op->len, capacity - 1 - op->len, op->len);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0) {
+            op->error = errno;
+            break;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        op->len += n;
+    }
+
+    // The buffer becomes a string's characters, so it gives back what it didn't need
+    op->data = nrealloc(op->data, op->len + 1);
+    op->data[op->len] = '\0';
+}
+
+/// @brief Splits what an operation read into NUL-terminated lines, in place. Both `\n` and `\r\n` end a line
+void ioSplitLines(IoOp *op) {
+    long start = 0;
+    long i;
+
+    for (i = 0; i < op->len; i++) {
+        if (op->data[i] != '\n') {
+            continue;
+        }
+
+        op->data[i] = '\0';
+
+        if (i > start && op->data[i - 1] == '\r') {
+            op->data[i - 1] = '\0';
+        }
+
+        IntVec_push(&op->lines, start);
+        start = i + 1;
+    }
+
+    // The last line doesn't need a line break
+    if (start < op->len) {
+        IntVec_push(&op->lines, start);
+    }
+}
+
+/// @brief Writes all of an operation's data at its offset, opening the file's shared descriptor if no other write has
+void ioWrite(IoOp *op) {
+    IoFile *file = op->file;
+    long written = 0;
+
+    pthread_mutex_lock(&file->lock);
+
+    if (file->fd == -1) {
+        file->fd = open(file->path, O_WRONLY | O_CREAT | (file->created ? 0 : O_TRUNC), 0644);
+        file->created = file->created || file->fd != -1;
+    }
+
+    if (file->fd == -1) {
+        op->error = errno;
+        pthread_mutex_unlock(&file->lock);
+        return;
+    }
+
+    file->writers++;
+    pthread_mutex_unlock(&file->lock);
+
+    while (written < op->len) {
+        long n = pwrite(file->fd, op->data + written, op->len - written, op->offset + written);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0) {
+            op->error = errno;
+            break;
+        }
+
+        written += n;
+    }
+
+    pthread_mutex_lock(&file->lock);
+
+    if (--file->writers == 0) {
+        close(file->fd);
+        file->fd = -1;
+    }
+
+    pthread_mutex_unlock(&file->lock);
+}
+
+/// @brief Runs an operation on the calling worker
+void ioRun(IoOp *op) {
+    if (op->kind == Io_Write) {
+        ioWrite(op);
+        nfree(op->data);
+        op->data = NULL;
+        return;
+    }
+
+    // Reads don't share anything, so each one opens the file itself
+    int fd = open(op->file->path, O_RDONLY);
+
+    if (fd == -1) {
+        op->error = errno;
+        return;
+    }
+
+    ioRead(op, fd);
+    close(fd);
+
+    if (op->kind == Io_ReadLines && op->error == 0) {
+        ioSplitLines(op);
+    }
+}
+
+void *ioWorker(void *arg) {
+    pthread_mutex_lock(&io_pool.lock);
+
+    for (;;) {
+        while (io_pool.head == NULL) {
+            pthread_cond_wait(&io_pool.queued, &io_pool.lock);
+        }
+
+        IoOp *op = io_pool.head;
+
+        io_pool.head = op->next;
+
+        if (io_pool.head == NULL) {
+            io_pool.tail = NULL;
+        }
+
+        pthread_mutex_unlock(&io_pool.lock);
+        ioRun(op);
+        pthread_mutex_lock(&io_pool.lock);
+
+        op->done = true;
+        io_pool.pending--;
+        pthread_cond_broadcast(&io_pool.finished);
+    }
+
+    return NULL;
+}
+
+/// @brief Starts the workers. File I/O mostly waits on the disk or on page faults rather than
+/// on the CPU, so there are twice as many workers as cores
+void startIoWorkers() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_workers = cores > 0 && cores * 2 < IO_MAX_WORKERS ? cores * 2 : IO_MAX_WORKERS;
+    int i;
+
+    for (i = 0; i < num_workers; i++) {
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, ioWorker, NULL) != 0) {
+            break;
+        }
+
+        pthread_detach(thread);
+        io_pool.num_workers++;
+    }
+
+    if (io_pool.num_workers == 0) {
+        fprintf(stderr, "Could not start any I/O threads\n");
+        exit(1);
+    }
+}
+
+/// @brief Registers a file for operations to open later
+/// @param path The path of the file, allocated with `nmalloc`, which the file frees
+/// @return The id of the file
+int ioFile(char *path) {
+    IoFile *file = nmalloc(sizeof(IoFile));
+
+    *file = (IoFile){.path = path, .fd = -1};
+    pthread_mutex_init(&file->lock, NULL);
+    IoFiles_push(&io_files, file);
+
+    return io_files.len - 1;
+}
+
+/// @brief Queues an operation on a file
+/// @param data What a write writes, allocated with `nmalloc`, which the operation frees once it's written, or NULL
+/// @return The id of the operation
+int ioQueue(IoOpKind kind, IoFile *file, char *data) {
+    IoOp *op = nmalloc(sizeof(IoOp));
+
+    *op = (IoOp){.kind = kind, .file = file, .data = data};
+
+    if (kind == Io_Write) {
+        // Each write gets its own place in the file, so writes can run in any order
+        op->len = strlen(data);
+        op->offset = file->write_offset;
+        file->write_offset += op->len;
+    }
+
+    IoOps_push(&io_ops, op);
+    file->num_ops++;
+
+    if (io_pool.num_workers == 0) {
+        startIoWorkers();
+    }
+
+    pthread_mutex_lock(&io_pool.lock);
+
+    if (io_pool.tail != NULL) {
+        io_pool.tail->next = op;
+    } else {
+        io_pool.head = op;
+    }
+
+    io_pool.tail = op;
+    io_pool.pending++;
+    pthread_cond_signal(&io_pool.queued);
+    pthread_mutex_unlock(&io_pool.lock);
+
+    return io_ops.len - 1;
+}
+
+/// @brief Blocks until an operation is done
+void ioAwait(IoOp *op) {
+    pthread_mutex_lock(&io_pool.lock);
+
+    while (!op->done) {
+        pthread_cond_wait(&io_pool.finished, &io_pool.lock);
+    }
+
+    pthread_mutex_unlock(&io_pool.lock);
+}
+
+/// @brief Blocks until every queued operation is done, so no write is lost when the program ends
+void ioAwaitAll() {
+    pthread_mutex_lock(&io_pool.lock);
+
+    while (io_pool.pending > 0) {
+        pthread_cond_wait(&io_pool.finished, &io_pool.lock);
+    }
+
+    pthread_mutex_unlock(&io_pool.lock);
+}
+
+/// @brief Frees every file and operation, which all have to be done. The strings that took over what reads read
+/// have to have been released by then
+void freeIo() {
+    int i;
+
+    for (i = 0; i < io_ops.len; i++) {
+        IntVec_free(&io_ops.ref[i]->lines);
+        nfree(io_ops.ref[i]->data);
+        nfree(io_ops.ref[i]);
+    }
+
+    for (i = 0; i < io_files.len; i++) {
+        pthread_mutex_destroy(&io_files.ref[i]->lock);
+        nfree(io_files.ref[i]->path);
+        nfree(io_files.ref[i]);
+    }
+
+    IoOps_free(&io_ops);
+    IoFiles_free(&io_files);
+}
+
+#endif
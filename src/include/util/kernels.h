@@ -0,0 +1,459 @@
+#ifndef KERNELS_IMPL
+
+#define KERNELS_IMPL
+
+// Vectorized kernels over arrays of ints and floats (doubles), used by the array builtins.
+// Like the string kernels in astr.h, each one has a scalar reference version and an AVX2
+// version that is picked at runtime when the CPU supports it. SSE2 has no 32-bit multiply
+// or min/max, so below AVX2 the scalar versions are used.
+// The vector loops handle whole blocks and hand the tail to the scalar version.
+// Ints wrap around on overflow, and float sums are added in a different order than the scalar loop would.
+
+void fillIntsScalar(int *dst, int n, int x) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = x;
+    }
+}
+
+int sumIntsScalar(const int *a, int n) {
+    unsigned int sum = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        sum += (unsigned int)a[i];
+    }
+
+    return (int)sum;
+}
+
+int minIntsScalar(const int *a, int n) {
+    int min = a[0];
+    int i;
+
+    for (i = 1; i < n; i++) {
+        min = a[i] < min ? a[i] : min;
+    }
+
+    return min;
+}
+
+int maxIntsScalar(const int *a, int n) {
+    int max = a[0];
+    int i;
+
+    for (i = 1; i < n; i++) {
+        max = a[i] > max ? a[i] : max;
+    }
+
+    return max;
+}
+
+int dotIntsScalar(const int *a, const int *b, int n) {
+    unsigned int sum = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        sum += (unsigned int)a[i] * (unsigned int)b[i];
+    }
+
+    return (int)sum;
+}
+
+void addIntsScalar(int *dst, const int *a, const int *b, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = (int)((unsigned int)a[i] + (unsigned int)b[i]);
+    }
+}
+
+void mulIntsScalar(int *dst, const int *a, const int *b, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = (int)((unsigned int)a[i] * (unsigned int)b[i]);
+    }
+}
+
+void fillFloatsScalar(double *dst, int n, double x) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = x;
+    }
+}
+
+double sumFloatsScalar(const double *a, int n) {
+    double sum = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        sum += a[i];
+    }
+
+    return sum;
+}
+
+double minFloatsScalar(const double *a, int n) {
+    double min = a[0];
+    int i;
+
+    for (i = 1; i < n; i++) {
+        min = a[i] < min ? a[i] : min;
+    }
+
+    return min;
+}
+
+double maxFloatsScalar(const double *a, int n) {
+    double max = a[0];
+    int i;
+
+    for (i = 1; i < n; i++) {
+        max = a[i] > max ? a[i] : max;
+    }
+
+    return max;
+}
+
+double dotFloatsScalar(const double *a, const double *b, int n) {
+    double sum = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+
+    return sum;
+}
+
+void addFloatsScalar(double *dst, const double *a, const double *b, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = a[i] + b[i];
+    }
+}
+
+void mulFloatsScalar(double *dst, const double *a, const double *b, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = a[i] * b[i];
+    }
+}
+
+#ifdef __x86_64__
+__attribute__((target("avx2")))
+int horizontalSumInts(__m256i v) {
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2")))
+double horizontalSumFloats(__m256d v) {
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+
+    return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+__attribute__((target("avx2")))
+void fillIntsAvx2(int *dst, int n, int x) {
+    __m256i vx = _mm256_set1_epi32(x);
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        _mm256_storeu_si256((__m256i*)(dst + i), vx);
+    }
+
+    fillIntsScalar(dst + i, n - i, x);
+}
+
+__attribute__((target("avx2")))
+int sumIntsAvx2(const int *a, int n) {
+    __m256i sum = _mm256_setzero_si256();
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        sum = _mm256_add_epi32(sum, _mm256_loadu_si256((const __m256i*)(a + i)));
+    }
+
+    return (int)((unsigned int)horizontalSumInts(sum) + (unsigned int)sumIntsScalar(a + i, n - i));
+}
+
+__attribute__((target("avx2")))
+int minIntsAvx2(const int *a, int n) {
+    __m256i min = _mm256_loadu_si256((const __m256i*)a);
+    int lanes[8];
+    int i;
+
+    for (i = 8; i + 8 <= n; i += 8) {
+        min = _mm256_min_epi32(min, _mm256_loadu_si256((const __m256i*)(a + i)));
+    }
+
+    _mm256_storeu_si256((__m256i*)lanes, min);
+
+    int result = minIntsScalar(lanes, 8);
+
+    if (i < n) {
+        int tail = minIntsScalar(a + i, n - i);
+        result = tail < result ? tail : result;
+    }
+
+    return result;
+}
+
+__attribute__((target("avx2")))
+int maxIntsAvx2(const int *a, int n) {
+    __m256i max = _mm256_loadu_si256((const __m256i*)a);
+    int lanes[8];
+    int i;
+
+    for (i = 8; i + 8 <= n; i += 8) {
+        max = _mm256_max_epi32(max, _mm256_loadu_si256((const __m256i*)(a + i)));
+    }
+
+    _mm256_storeu_si256((__m256i*)lanes, max);
+
+    int result = maxIntsScalar(lanes, 8);
+
+    if (i < n) {
+        int tail = maxIntsScalar(a + i, n - i);
+        result = tail > result ? tail : result;
+    }
+
+    return result;
+}
+
+__attribute__((target("avx2")))
+int dotIntsAvx2(const int *a, const int *b, int n) {
+    __m256i sum = _mm256_setzero_si256();
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+
+        sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(va, vb));
+    }
+
+    return (int)((unsigned int)horizontalSumInts(sum) + (unsigned int)dotIntsScalar(a + i, b + i, n - i));
+}
+
+__attribute__((target("avx2")))
+void addIntsAvx2(int *dst, const int *a, const int *b, int n) {
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi32(va, vb));
+    }
+
+    addIntsScalar(dst + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void mulIntsAvx2(int *dst, const int *a, const int *b, int n) {
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_mullo_epi32(va, vb));
+    }
+
+    mulIntsScalar(dst + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void fillFloatsAvx2(double *dst, int n, double x) {
+    __m256d vx = _mm256_set1_pd(x);
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, vx);
+    }
+
+    fillFloatsScalar(dst + i, n - i, x);
+}
+
+__attribute__((target("avx2")))
+double sumFloatsAvx2(const double *a, int n) {
+    __m256d sum = _mm256_setzero_pd();
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        sum = _mm256_add_pd(sum, _mm256_loadu_pd(a + i));
+    }
+
+    return horizontalSumFloats(sum) + sumFloatsScalar(a + i, n - i);
+}
+
+__attribute__((target("avx2")))
+double minFloatsAvx2(const double *a, int n) {
+    __m256d min = _mm256_loadu_pd(a);
+    double lanes[4];
+    int i;
+
+    for (i = 4; i + 4 <= n; i += 4) {
+        min = _mm256_min_pd(min, _mm256_loadu_pd(a + i));
+    }
+
+    _mm256_storeu_pd(lanes, min);
+
+    double result = minFloatsScalar(lanes, 4);
+
+    if (i < n) {
+        double tail = minFloatsScalar(a + i, n - i);
+        result = tail < result ? tail : result;
+    }
+
+    return result;
+}
+
+__attribute__((target("avx2")))
+double maxFloatsAvx2(const double *a, int n) {
+    __m256d max = _mm256_loadu_pd(a);
+    double lanes[4];
+    int i;
+
+    for (i = 4; i + 4 <= n; i += 4) {
+        max = _mm256_max_pd(max, _mm256_loadu_pd(a + i));
+    }
+
+    _mm256_storeu_pd(lanes, max);
+
+    double result = maxFloatsScalar(lanes, 4);
+
+    if (i < n) {
+        double tail = maxFloatsScalar(a + i, n - i);
+        result = tail > result ? tail : result;
+    }
+
+    return result;
+}
+
+__attribute__((target("avx2")))
+double dotFloatsAvx2(const double *a, const double *b, int n) {
+    __m256d sum = _mm256_setzero_pd();
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+
+    return horizontalSumFloats(sum) + dotFloatsScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void addFloatsAvx2(double *dst, const double *a, const double *b, int n) {
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+
+    addFloatsScalar(dst + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void mulFloatsAvx2(double *dst, const double *a, const double *b, int n) {
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+
+    mulFloatsScalar(dst + i, a + i, b + i, n - i);
+}
+
+#endif
+
+// Dispatches a kernel call to its AVX2 version when there's at least one whole vector, otherwise to the scalar version
+#ifdef __x86_64__
+#define dispatchKernel(name, n, width, ...) \
+    ((n) >= (width) && astrSimdLevel() == ASTR_SIMD_AVX2 ? name##Avx2(__VA_ARGS__) : name##Scalar(__VA_ARGS__))
+#else
+#define dispatchKernel(name, n, width, ...) name##Scalar(__VA_ARGS__)
+#endif
+
+/// @brief Sets all `n` ints at `dst` to `x`
+void fillInts(int *dst, int n, int x) {
+    dispatchKernel(fillInts, n, 8, dst, n, x);
+}
+
+/// @brief Returns the sum of `n` ints
+int sumInts(const int *a, int n) {
+    return dispatchKernel(sumInts, n, 8, a, n);
+}
+
+/// @brief Returns the smallest of `n` ints, `n` has to be at least 1
+int minInts(const int *a, int n) {
+    return dispatchKernel(minInts, n, 8, a, n);
+}
+
+/// @brief Returns the largest of `n` ints, `n` has to be at least 1
+int maxInts(const int *a, int n) {
+    return dispatchKernel(maxInts, n, 8, a, n);
+}
+
+/// @brief Returns the dot product of `n` ints at `a` and `b`
+int dotInts(const int *a, const int *b, int n) {
+    return dispatchKernel(dotInts, n, 8, a, b, n);
+}
+
+/// @brief Sets `dst[i]` to `a[i] + b[i]` for `n` ints
+void addInts(int *dst, const int *a, const int *b, int n) {
+    dispatchKernel(addInts, n, 8, dst, a, b, n);
+}
+
+/// @brief Sets `dst[i]` to `a[i] * b[i]` for `n` ints
+void mulInts(int *dst, const int *a, const int *b, int n) {
+    dispatchKernel(mulInts, n, 8, dst, a, b, n);
+}
+
+/// @brief Sets all `n` floats at `dst` to `x`
+void fillFloats(double *dst, int n, double x) {
+    dispatchKernel(fillFloats, n, 4, dst, n, x);
+}
+
+/// @brief Returns the sum of `n` floats
+double sumFloats(const double *a, int n) {
+    return dispatchKernel(sumFloats, n, 4, a, n);
+}
+
+/// @brief Returns the smallest of `n` floats, `n` has to be at least 1
+double minFloats(const double *a, int n) {
+    return dispatchKernel(minFloats, n, 4, a, n);
+}
+
+/// @brief Returns the largest of `n` floats, `n` has to be at least 1
+double maxFloats(const double *a, int n) {
+    return dispatchKernel(maxFloats, n, 4, a, n);
+}
+
+/// @brief Returns the dot product of `n` floats at `a` and `b`
+double dotFloats(const double *a, const double *b, int n) {
+    return dispatchKernel(dotFloats, n, 4, a, b, n);
+}
+
+/// @brief Sets `dst[i]` to `a[i] + b[i]` for `n` floats
+void addFloats(double *dst, const double *a, const double *b, int n) {
+    dispatchKernel(addFloats, n, 4, dst, a, b, n);
+}
+
+/// @brief Sets `dst[i]` to `a[i] * b[i]` for `n` floats
+void mulFloats(double *dst, const double *a, const double *b, int n) {
+    dispatchKernel(mulFloats, n, 4, dst, a, b, n);
+}
+
+#endif
@@ -5,59 +5,172 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 
-typedef struct LinkedList {
-    void* value;
-    void* next;
-} LinkedList;
-
-int LinkedList_length(LinkedList list) {
-    int len = 0;
-    LinkedList currentItem = list;
-    
-    while (true) {
-        if (currentItem.next == NULL) {
-            return len;
-        }
-        
-        len++;
-    }
-}
+#include "alloc.h"
 
-LinkedList LinkedList_atIndex(LinkedList list, int index) {
-    LinkedList currentItem = list;
+#define VEC_INITIAL_CAPACITY 8
 
-    if (index < 0) {
-        index = LinkedList_length(list) + index + 1; // -1 = length(list), -2 = length(list) - 1, etc..
+/// @brief Returns the capacity a container should grow to so it can hold `needed` items.
+/// Capacities double, so pushing is amortized O(1), and stay powers of 2 if they start as one
+int vecGrowCapacity(int capacity, int needed) {
+    if (capacity < VEC_INITIAL_CAPACITY) {
+        capacity = VEC_INITIAL_CAPACITY;
     }
-    
-    while (index != 0) {
-        if (currentItem.next == NULL) {
-            perror("Indexing out of range");
-            _exit(1);
-        }
-
-        currentItem = *((LinkedList*)(currentItem.next));
-        index--;
+
+    while (capacity < needed) {
+        capacity *= 2;
     }
 
-    return currentItem;
+    return capacity;
 }
 
-void LinkedList_push(LinkedList list, void* value) {
-    LinkedList lastItem = LinkedList_atIndex(list, -1);
-    
-    LinkedList* new_ptr = malloc(sizeof(LinkedList));
-    LinkedList new = *new_ptr;
+/// @brief Defines `Name`, a contiguous dynamic array of `Type`, and its functions:
+/// `Name_new`, `Name_reserve`, `Name_push`, `Name_pop`, `Name_swapRemove`, `Name_append` and `Name_free`.
+/// A zeroed `Name` is a valid empty vector. Allocations are attributed to the vector type in `-trace-alloc`
+#define DEFINE_VEC(Name, Type) \
+    typedef struct Name { \
+        Type *ref; \
+        int len; \
+        int capacity; \
+    } Name; \
+    \
+    /* Makes sure `vec` can hold `capacity` items without growing */ \
+    void Name##_reserve(Name *vec, int capacity) { \
+        if (capacity > vec->capacity) { \
+            vec->capacity = vecGrowCapacity(vec->capacity, capacity); \
+            vec->ref = trackedRealloc(vec->ref, vec->capacity * sizeof(Type), "vector " #Name, __LINE__); \
+        } \
+    } \
+    \
+    Name Name##_new(int capacity) { \
+        Name vec = {.ref = NULL, .len = 0, .capacity = 0}; \
+        Name##_reserve(&vec, capacity); \
+        return vec; \
+    } \
+    \
+    void Name##_push(Name *vec, Type item) { \
+        if (vec->len >= vec->capacity) { \
+            Name##_reserve(vec, vec->len + 1); \
+        } \
+        vec->ref[vec->len] = item; \
+        vec->len++; \
+    } \
+    \
+    Type Name##_pop(Name *vec) { \
+        vec->len--; \
+        return vec->ref[vec->len]; \
+    } \
+    \
+    /* Removes the item at `index` in O(1) by moving the last item into its place */ \
+    Type Name##_swapRemove(Name *vec, int index) { \
+        Type item = vec->ref[index]; \
+        vec->len--; \
+        vec->ref[index] = vec->ref[vec->len]; \
+        return item; \
+    } \
+    \
+    void Name##_append(Name *vec, const Type *items, int count) { \
+        Name##_reserve(vec, vec->len + count); \
+        memcpy(vec->ref + vec->len, items, count * sizeof(Type)); \
+        vec->len += count; \
+    } \
+    \
+    void Name##_free(Name *vec) { \
+        nfree(vec->ref); \
+        *vec = (Name){.ref = NULL, .len = 0, .capacity = 0}; \
+    }
+
+/// @brief Iterates over a vector, pointing `item` at each element in turn
+#define vecForEach(vec, item) for ((item) = (vec)->ref; (item) < (vec)->ref + (vec)->len; (item)++)
 
-    new.next = NULL;
-    new.value = value;
+/// @brief Defines `Name`, a double-ended queue of `Type` stored in a ring buffer, and its functions:
+/// `Name_new`, `Name_reserve`, `Name_pushBack`, `Name_pushFront`, `Name_popBack`, `Name_popFront`, `Name_at`, `Name_append` and `Name_free`.
+/// The capacity is always a power of 2, so wrapping around is a mask. A zeroed `Name` is a valid empty deque
+#define DEFINE_DEQUE(Name, Type) \
+    typedef struct Name { \
+        Type *ref; \
+        int head; \
+        int len; \
+        int capacity; \
+    } Name; \
+    \
+    void Name##_reserve(Name *deque, int capacity) { \
+        if (capacity <= deque->capacity) { \
+            return; \
+        } \
+        int new_capacity = vecGrowCapacity(deque->capacity, capacity); \
+        Type *ref = trackedMalloc(new_capacity * sizeof(Type), "deque " #Name, __LINE__); \
+        /* Unwrap the items into the start of the new buffer */ \
+        int first = deque->capacity - deque->head < deque->len ? deque->capacity - deque->head : deque->len; \
+        if (deque->len > 0) { \
+            memcpy(ref, deque->ref + deque->head, first * sizeof(Type)); \
+            memcpy(ref + first, deque->ref, (deque->len - first) * sizeof(Type)); \
+        } \
+        nfree(deque->ref); \
+        deque->ref = ref; \
+        deque->head = 0; \
+        deque->capacity = new_capacity; \
+    } \
+    \
+    Name Name##_new(int capacity) { \
+        Name deque = {.ref = NULL, .head = 0, .len = 0, .capacity = 0}; \
+        Name##_reserve(&deque, capacity); \
+        return deque; \
+    } \
+    \
+    /* Returns a pointer to the item `index` places from the front */ \
+    Type *Name##_at(Name *deque, int index) { \
+        return deque->ref + ((deque->head + index) & (deque->capacity - 1)); \
+    } \
+    \
+    void Name##_pushBack(Name *deque, Type item) { \
+        if (deque->len >= deque->capacity) { \
+            Name##_reserve(deque, deque->len + 1); \
+        } \
+        deque->len++; \
+        *Name##_at(deque, deque->len - 1) = item; \
+    } \
+    \
+    void Name##_pushFront(Name *deque, Type item) { \
+        if (deque->len >= deque->capacity) { \
+            Name##_reserve(deque, deque->len + 1); \
+        } \
+        deque->head = (deque->head - 1) & (deque->capacity - 1); \
+        deque->len++; \
+        deque->ref[deque->head] = item; \
+    } \
+    \
+    Type Name##_popBack(Name *deque) { \
+        deque->len--; \
+        return *Name##_at(deque, deque->len); \
+    } \
+    \
+    Type Name##_popFront(Name *deque) { \
+        Type item = deque->ref[deque->head]; \
+        deque->head = (deque->head + 1) & (deque->capacity - 1); \
+        deque->len--; \
+        return item; \
+    } \
+    \
+    void Name##_append(Name *deque, const Type *items, int count) { \
+        int i; \
+        Name##_reserve(deque, deque->len + count); \
+        for (i = 0; i < count; i++) { \
+            Name##_pushBack(deque, items[i]); \
+        } \
+    } \
+    \
+    void Name##_free(Name *deque) { \
+        nfree(deque->ref); \
+        *deque = (Name){.ref = NULL, .head = 0, .len = 0, .capacity = 0}; \
+    }
 
-    lastItem.next = new_ptr;
-}
+DEFINE_VEC(IntVec, int)
+DEFINE_VEC(ByteVec, unsigned char)
 
 #endif
 
 #ifndef NULL
 #define NULL ((void*)0)
-#endif
\ No newline at end of file
+#endif
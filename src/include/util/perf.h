@@ -0,0 +1,237 @@
+#ifndef PERF_IMPL
+
+#define PERF_IMPL
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// The counters `-perf` reads around each phase of a run. Every counter is opened on its own with
+// perf_event_open, so one the CPU or VM doesn't have (hardware counters are often missing under virtualization)
+// only leaves out its column. When perf_event_open isn't allowed at all, page faults and CPU time come from getrusage instead.
+// Events only count the main thread, so the work parallel builtins hand to the pool's threads isn't included,
+// while getrusage counts the whole process.
+
+typedef enum PerfPhase {
+    Perf_None, // before the first phase starts, not reported
+    Perf_Read,
+    Perf_Lex,
+    Perf_Parse,
+    Perf_Link,
+    Perf_Check,
+    Perf_Interpret,
+    NUM_PERF_PHASES
+} PerfPhase;
+
+typedef enum PerfSource {
+    Source_Event, // a perf_event_open counter
+    Source_Rusage_Faults, // page faults from getrusage
+    Source_Rusage_Cpu // CPU time from getrusage, in ns
+} PerfSource;
+
+typedef struct PerfCounter {
+    char *name;
+    PerfSource source;
+    unsigned int type; // the perf_event_attr type and config of a Source_Event counter
+    unsigned long config;
+    int fd; // -1 if it couldn't be opened
+    long last; // the value when the current phase started
+} PerfCounter;
+
+#define PERF_HW_CACHE_MISSES(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+// Indices into `perf_counters`, the ones IPC is worked out from
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_NUM_EVENTS 7
+
+PerfCounter perf_counters[] = {
+    {"cycles", Source_Event, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1, 0},
+    {"instructions", Source_Event, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1, 0},
+    {"branch-miss", Source_Event, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1, 0},
+    {"L1d-miss", Source_Event, PERF_TYPE_HW_CACHE, PERF_HW_CACHE_MISSES(PERF_COUNT_HW_CACHE_L1D), -1, 0},
+    {"LLC-miss", Source_Event, PERF_TYPE_HW_CACHE, PERF_HW_CACHE_MISSES(PERF_COUNT_HW_CACHE_LL), -1, 0},
+    {"page-faults", Source_Event, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, -1, 0},
+    {"task-clock-ms", Source_Event, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, -1, 0},
+    // Used instead of the software events when perf_event_open can't be used at all
+    {"page-faults", Source_Rusage_Faults, 0, 0, -1, 0},
+    {"cpu-ms", Source_Rusage_Cpu, 0, 0, -1, 0}
+};
+
+#define PERF_NUM_COUNTERS ((int)(sizeof(perf_counters) / sizeof(PerfCounter)))
+
+bool perf_enabled = false;
+bool perf_rusage = false; // whether perf_event_open was refused and getrusage is used instead
+PerfPhase perf_phase = Perf_None;
+double perf_phase_start;
+long perf_counts[NUM_PERF_PHASES][PERF_NUM_COUNTERS];
+double perf_ms[NUM_PERF_PHASES];
+
+double perfClockMs() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+/// @brief Opens a perf_event_open counter for the calling thread, counting user space only
+/// @return The file descriptor, or -1 if the counter isn't available
+int openPerfEvent(unsigned int type, unsigned long config) {
+    #ifdef SYS_perf_event_open
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // A counter that had to share the PMU with others is scaled up by how long it actually ran
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    #else
+    return -1;
+    #endif
+}
+
+/// @brief Reads the current value of a counter
+long readPerfCounter(PerfCounter *counter) {
+    struct rusage usage;
+
+    switch (counter->source) {
+        case Source_Event: {
+            unsigned long values[3]; // the count, the time enabled and the time running
+
+            if (read(counter->fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+                return 0;
+            }
+
+            return values[2] < values[1] ? (long)((double)values[0] * values[1] / values[2]) : (long)values[0];
+        }
+        case Source_Rusage_Faults:
+            getrusage(RUSAGE_SELF, &usage);
+            return usage.ru_minflt + usage.ru_majflt;
+        case Source_Rusage_Cpu:
+            getrusage(RUSAGE_SELF, &usage);
+            return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000L + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000L;
+    }
+
+    return 0;
+}
+
+/// @brief Returns whether a counter is being read
+#define perfCounterUsed(counter) ((counter)->source == Source_Event ? (counter)->fd != -1 : perf_rusage)
+
+/// @brief Returns whether a counter's value is in ns and printed in ms
+#define perfCounterNs(i) (perf_counters[i].source == Source_Rusage_Cpu || (perf_counters[i].type == PERF_TYPE_SOFTWARE && perf_counters[i].config == PERF_COUNT_SW_TASK_CLOCK))
+
+/// @brief Ends the current phase, adding what the counters counted during it to its totals, and starts another
+void setPerfPhase(PerfPhase phase) {
+    double now;
+    int i;
+
+    if (!perf_enabled) {
+        return;
+    }
+
+    for (i = 0; i < PERF_NUM_COUNTERS; i++) {
+        PerfCounter *counter = perf_counters + i;
+
+        if (perfCounterUsed(counter)) {
+            long value = readPerfCounter(counter);
+
+            perf_counts[perf_phase][i] += value - counter->last;
+            counter->last = value;
+        }
+    }
+
+    now = perfClockMs();
+    perf_ms[perf_phase] += now - perf_phase_start;
+    perf_phase_start = now;
+    perf_phase = phase;
+}
+
+/// @brief Prints the counts of every phase that ran and their totals
+void printPerfReport() {
+    char *phase_names[NUM_PERF_PHASES] = {"", "read", "lex", "parse", "link", "check", "interpret"};
+    long totals[PERF_NUM_COUNTERS] = {0};
+    double total_ms = 0;
+    bool ipc = perf_counters[PERF_CYCLES].fd != -1 && perf_counters[PERF_INSTRUCTIONS].fd != -1;
+    int phase, i;
+
+    setPerfPhase(Perf_None);
+
+    fprintf(stderr, "perf counters (%s)\n", perf_rusage ? "perf_event_open unavailable, using getrusage"
+        : ipc ? "hardware and software events" : "hardware events unavailable, software events only");
+    fprintf(stderr, "  %-10s %10s", "phase", "wall-ms");
+
+    for (i = 0; i < PERF_NUM_COUNTERS; i++) {
+        if (perfCounterUsed(perf_counters + i)) {
+            fprintf(stderr, " %14s", perf_counters[i].name);
+        }
+    }
+
+    fprintf(stderr, ipc ? " %6s\n" : "\n", "IPC");
+
+    for (phase = Perf_None + 1; phase <= NUM_PERF_PHASES; phase++) {
+        bool total = phase == NUM_PERF_PHASES;
+        long *counts = total ? totals : perf_counts[phase];
+        double ms = total ? total_ms : perf_ms[phase];
+
+        if (!total && ms == 0) {
+            continue; // never ran
+        }
+
+        fprintf(stderr, "  %-10s %10.2f", total ? "total" : phase_names[phase], ms);
+
+        for (i = 0; i < PERF_NUM_COUNTERS; i++) {
+            if (!perfCounterUsed(perf_counters + i)) {
+                continue;
+            }
+
+            if (perfCounterNs(i)) {
+                fprintf(stderr, " %14.2f", counts[i] / 1e6);
+            } else {
+                fprintf(stderr, " %14ld", counts[i]);
+            }
+
+            if (!total) {
+                totals[i] += counts[i];
+            }
+        }
+
+        if (ipc) {
+            fprintf(stderr, " %6.2f", counts[PERF_CYCLES] > 0 ? (double)counts[PERF_INSTRUCTIONS] / counts[PERF_CYCLES] : 0.0);
+        }
+
+        fprintf(stderr, "\n");
+        total_ms += total ? 0 : ms;
+    }
+}
+
+/// @brief Opens the counters for the main thread and prints a report of every phase when the program exits
+void startPerfCounters() {
+    bool refused = true;
+    int i;
+
+    for (i = 0; i < PERF_NUM_EVENTS; i++) {
+        perf_counters[i].fd = openPerfEvent(perf_counters[i].type, perf_counters[i].config);
+        refused = refused && perf_counters[i].fd == -1;
+    }
+
+    // Even the software events failed, so the syscall is missing or forbidden (by perf_event_paranoid or a seccomp filter)
+    perf_rusage = refused;
+
+    perf_enabled = true;
+    setPerfPhase(Perf_None);
+    atexit(printPerfReport);
+}
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef POOL_IMPL
+
+#define POOL_IMPL
+
+#include <pthread.h>
+
+// A work-stealing pool for the parallel builtins. A job is a number of chunks, which are dealt out
+// as contiguous runs to one deque per worker. Each worker takes chunks from the front of its own deque,
+// and once that's empty, steals from the back of the others', so uneven chunks even out.
+// The thread that runs a job is worker 0 and works on it too. A job started from inside a job runs
+// on the worker that started it, in order.
+
+#define POOL_MAX_WORKERS 64
+#define POOL_STACK_SIZE (8L * 1024 * 1024) // the native stack of each pool thread
+
+/// @brief Runs one chunk of a job
+/// @param context The context the job was started with
+/// @param chunk The index of the chunk
+/// @param worker The index of the worker running it, below `poolWorkers()`
+typedef void (*ChunkFn)(void *context, int chunk, int worker);
+
+DEFINE_DEQUE(IntDeque, int)
+
+typedef struct ChunkQueue {
+    pthread_mutex_t lock;
+    IntDeque chunks;
+} ChunkQueue;
+
+typedef struct WorkPool {
+    pthread_mutex_t lock;
+    pthread_cond_t started; // broadcast when a job starts
+    pthread_cond_t finished; // signalled when the last thread is done with a job
+
+    bool threads_started;
+    int num_threads; // the pool's threads, started by the first job
+    long job; // counts the jobs started, so threads can tell a new one has started
+    int busy; // the threads still working on the current job
+
+    ChunkFn run;
+    void *context;
+    ChunkQueue queues[POOL_MAX_WORKERS];
+} WorkPool;
+
+WorkPool work_pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .started = PTHREAD_COND_INITIALIZER, .finished = PTHREAD_COND_INITIALIZER};
+
+int pool_workers = 0; // how many workers run a job, the calling thread included. 0 until set or worked out from the cores
+
+__thread bool in_pool_job = false; // whether this thread is running a chunk of a job
+
+/// @brief Returns how many workers run each job
+int poolWorkers() {
+    if (pool_workers <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+        pool_workers = cores > 0 ? cores : 1;
+    }
+
+    if (pool_workers > POOL_MAX_WORKERS) {
+        pool_workers = POOL_MAX_WORKERS;
+    }
+
+    return pool_workers;
+}
+
+/// @brief Takes the next chunk from a worker's own deque, or steals one from the back of another's
+/// @return The chunk, or -1 if every deque is empty
+int takeChunk(int worker) {
+    int num_workers = work_pool.num_threads + 1;
+    int i;
+
+    for (i = 0; i < num_workers; i++) {
+        ChunkQueue *queue = work_pool.queues + (worker + i) % num_workers;
+        int chunk = -1;
+
+        pthread_mutex_lock(&queue->lock);
+
+        if (queue->chunks.len > 0) {
+            chunk = i == 0 ? IntDeque_popFront(&queue->chunks) : IntDeque_popBack(&queue->chunks);
+        }
+
+        pthread_mutex_unlock(&queue->lock);
+
+        if (chunk != -1) {
+            return chunk;
+        }
+    }
+
+    return -1;
+}
+
+/// @brief Runs chunks of the current job until there are none left. No chunks are added while a job runs,
+/// so once every deque is empty, all that's left is finishing the chunks other workers have taken
+void workOnJob(int worker) {
+    int chunk;
+
+    in_pool_job = true;
+
+    while ((chunk = takeChunk(worker)) != -1) {
+        work_pool.run(work_pool.context, chunk, worker);
+    }
+
+    in_pool_job = false;
+}
+
+void *poolThread(void *arg) {
+    int worker = (int)(long)arg;
+    long seen = 0;
+
+    pthread_mutex_lock(&work_pool.lock);
+
+    for (;;) {
+        while (work_pool.job == seen) {
+            pthread_cond_wait(&work_pool.started, &work_pool.lock);
+        }
+
+        seen = work_pool.job;
+        pthread_mutex_unlock(&work_pool.lock);
+
+        workOnJob(worker);
+
+        pthread_mutex_lock(&work_pool.lock);
+
+        if (--work_pool.busy == 0) {
+            pthread_cond_signal(&work_pool.finished);
+        }
+    }
+
+    return NULL;
+}
+
+/// @brief Starts the pool's threads, one less than there are workers
+void startPool() {
+    pthread_attr_t attr;
+    int i;
+
+    for (i = 0; i < POOL_MAX_WORKERS; i++) {
+        pthread_mutex_init(&work_pool.queues[i].lock, NULL);
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, POOL_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (i = 1; i < poolWorkers(); i++) {
+        pthread_t thread;
+
+        if (pthread_create(&thread, &attr, poolThread, (void*)(long)i) != 0) {
+            break;
+        }
+
+        work_pool.num_threads++;
+    }
+
+    pthread_attr_destroy(&attr);
+    work_pool.threads_started = true;
+
+    // Jobs run on the calling thread alone if no thread could be started
+    pool_workers = work_pool.num_threads + 1;
+}
+
+/// @brief Runs every chunk of a job and waits for them to finish
+/// @param num_chunks The number of chunks
+/// @param run Runs one chunk
+/// @param context Passed to `run`
+void runChunks(int num_chunks, ChunkFn run, void *context) {
+    int i;
+
+    if (in_pool_job) {
+        for (i = 0; i < num_chunks; i++) {
+            run(context, i, 0);
+        }
+
+        return;
+    }
+
+    if (!work_pool.threads_started) {
+        startPool();
+    }
+
+    int num_workers = work_pool.num_threads + 1;
+
+    // Each worker starts out with a contiguous run of chunks, so neighbouring chunks usually run on the same core
+    for (i = 0; i < num_workers; i++) {
+        int first = (long)num_chunks * i / num_workers;
+        int end = (long)num_chunks * (i + 1) / num_workers;
+        int chunk;
+
+        for (chunk = first; chunk < end; chunk++) {
+            IntDeque_pushBack(&work_pool.queues[i].chunks, chunk);
+        }
+    }
+
+    pthread_mutex_lock(&work_pool.lock);
+    work_pool.run = run;
+    work_pool.context = context;
+    work_pool.busy = work_pool.num_threads;
+    work_pool.job++;
+    pthread_cond_broadcast(&work_pool.started);
+    pthread_mutex_unlock(&work_pool.lock);
+
+    workOnJob(0);
+
+    pthread_mutex_lock(&work_pool.lock);
+
+    while (work_pool.busy > 0) {
+        pthread_cond_wait(&work_pool.finished, &work_pool.lock);
+    }
+
+    pthread_mutex_unlock(&work_pool.lock);
+}
+
+#endif
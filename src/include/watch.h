@@ -0,0 +1,618 @@
+#ifndef WATCH_IMPL
+
+#define WATCH_IMPL
+
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+
+#define WATCH_EVENT_BUFFER 4096
+#define WATCH_DIFF_BLOCK 64 // bytes compared at once when looking for the edited range
+#define WATCH_RELEX_BACKTRACK 2 // tokens before an edit that are lexed again, since the lexer looks up to 2 chars ahead
+
+/// @brief Runs a parsed program. Watch mode calls it in a child process after every edit
+typedef void (*WatchRunner)(Ast *ast, Program program);
+
+/// @brief A file being watched. The tokens, Ast and statement spans are kept between edits,
+/// so only the parts around an edit have to be lexed and parsed again
+typedef struct WatchState {
+    char *path;
+    int file; // index into `sources`
+
+    Program program;
+    Ast ast;
+    StatementSpans spans;
+    bool valid; // false after a syntax error, until the file is lexed and parsed from scratch
+
+    // The edit being lexed and parsed. It's kept here rather than on the stack, so after a syntax error
+    // `abandonEdit` can put the Ast back and free the rest
+    Lexstate lexing;
+    Parsestate parsing;
+    Ast detached;
+    StatementSpans new_spans;
+
+    // What the last edit cost, for the status line
+    int relexed_tokens;
+    int reparsed_statements;
+} WatchState;
+
+/// @brief Returns how many bytes two strings have in common at their start
+int commonPrefix(Astr a, Astr b) {
+    int max = a.len < b.len ? a.len : b.len;
+    int i = 0;
+
+    while (i + WATCH_DIFF_BLOCK <= max && bytesEqual(a.str_ref + i, b.str_ref + i, WATCH_DIFF_BLOCK)) {
+        i += WATCH_DIFF_BLOCK;
+    }
+
+    while (i < max && a.str_ref[i] == b.str_ref[i]) {
+        i++;
+    }
+
+    return i;
+}
+
+/// @brief Returns how many bytes two strings have in common at their end, not counting the first `prefix` bytes of either
+int commonSuffix(Astr a, Astr b, int prefix) {
+    int max = (a.len < b.len ? a.len : b.len) - prefix;
+    int i = 0;
+
+    while (i + WATCH_DIFF_BLOCK <= max
+        && bytesEqual(a.str_ref + a.len - i - WATCH_DIFF_BLOCK, b.str_ref + b.len - i - WATCH_DIFF_BLOCK, WATCH_DIFF_BLOCK)) {
+        i += WATCH_DIFF_BLOCK;
+    }
+
+    while (i < max && a.str_ref[a.len - i - 1] == b.str_ref[b.len - i - 1]) {
+        i++;
+    }
+
+    return i;
+}
+
+/// @brief Finds the first token that ends at or after an offset
+/// @return The index of the token. The EOF token ends after every offset in the file
+int firstTokenEndingAt(Program program, int offset) {
+    int low = 0;
+    int high = program.len - 1;
+
+    while (low < high) {
+        int mid = (low + high) / 2;
+
+        if ((int)(program.ref[mid].offset + program.ref[mid].len) >= offset) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    return low;
+}
+
+/// @brief Finds the token that starts at an offset, searching from the token `from`
+/// @return The index of the token, or -1 if no token starts there
+int tokenStartingAt(Program program, int from, int offset) {
+    int low = from;
+    int high = program.len - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+
+        if ((int)program.ref[mid].offset == offset) {
+            return mid;
+        }
+
+        if ((int)program.ref[mid].offset < offset) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return -1;
+}
+
+/// @brief Replaces the text of the watched file, lexing only the tokens around the edit.
+/// Lexing starts a little before the edit and stops at the first token boundary after it that lines up
+/// with an old token, since everything from there on is the same text shifted by the edit's size
+/// @param watch The watched file
+/// @param text The new text of the file
+/// @param old_end Set to one past the last old token that was replaced
+/// @return The index of the first replaced token. The new tokens end at `old_end` plus the change in token count
+int relexEdit(WatchState *watch, Astr text, int *old_end) {
+    SourceFile *file = sources.ref + watch->file;
+    Astr old_text = file->text;
+    Program *program = &watch->program;
+
+    int prefix = commonPrefix(old_text, text);
+    int suffix = commonSuffix(old_text, text, prefix);
+    int delta = text.len - old_text.len;
+
+    int first = firstTokenEndingAt(*program, prefix) - WATCH_RELEX_BACKTRACK;
+
+    if (first < 0) {
+        first = 0;
+    }
+
+    // Locations are worked out from the new text from now on
+    file->text = text;
+    IntVec_free(&file->line_starts);
+
+    Lexstate *state = &watch->lexing;
+
+    *state = (Lexstate){
+        .input = text,
+        .index = first == 0 ? 0 : program->ref[first].offset, // the edit may have been in whitespace before the first token
+        .file = watch->file,
+        .program = TokenList_new(64)
+    };
+
+    int end = -1;
+
+    while (end == -1) {
+        skipWhiteSpace(state);
+
+        if (state->index >= text.len - suffix) {
+            end = tokenStartingAt(*program, first, state->index - delta);
+
+            if (end != -1) {
+                break;
+            }
+        }
+
+        if (!lexNext(state)) {
+            lexToken(state, Tk_EOF, state->index, 0);
+            end = program->len;
+        }
+    }
+
+    // Splice the new tokens in place of [first, end), shifting the ones after them
+    int tail = program->len - end;
+    int i;
+
+    TokenList_reserve(program, first + state->program.len + tail);
+    memmove(program->ref + first + state->program.len, program->ref + end, tail * sizeof(Token));
+    memcpy(program->ref + first, state->program.ref, state->program.len * sizeof(Token));
+    program->len = first + state->program.len + tail;
+
+    for (i = first + state->program.len; i < program->len; i++) {
+        program->ref[i].offset += delta;
+    }
+
+    watch->relexed_tokens = state->program.len;
+    TokenList_free(&state->program);
+
+    *old_end = end;
+
+    return first;
+}
+
+/// @brief Moves nodes out of an Ast into a separate one, so the Ast can be parsed into from `first_node` on
+/// @param ast The Ast to take the nodes from. It's truncated to `first_node`
+/// @param first_node The first node to move
+/// @return The moved nodes. The node that was `first_node` is node 0
+Ast detachNodes(Ast *ast, int first_node) {
+    int count = ast->len - first_node;
+
+    Ast rest = {
+        .kind = nmalloc(count * sizeof(unsigned char) + 1),
+        .token = nmalloc(count * sizeof(int) + 1),
+        .first_child = nmalloc(count * sizeof(int) + 1),
+        .child_count = nmalloc(count * sizeof(int) + 1),
+        .len = count,
+        .capacity = count
+    };
+
+    memcpy(rest.kind, ast->kind + first_node, count * sizeof(unsigned char));
+    memcpy(rest.token, ast->token + first_node, count * sizeof(int));
+    memcpy(rest.first_child, ast->first_child + first_node, count * sizeof(int));
+    memcpy(rest.child_count, ast->child_count + first_node, count * sizeof(int));
+
+    ast->len = first_node;
+
+    return rest;
+}
+
+/// @brief Copies detached nodes of unchanged statements back into an Ast, moving their token and child indices
+/// @param ast The Ast to copy into
+/// @param rest The detached nodes
+/// @param base The node id `rest` started at
+/// @param first_node The id the first node to copy had before it was detached
+/// @param end_node One past the last node to copy
+/// @param token_delta How far the statements' tokens have moved
+void copyStatementNodes(Ast *ast, Ast *rest, int base, int first_node, int end_node, int token_delta) {
+    int node_delta = ast->len - first_node;
+    int i;
+
+    for (i = first_node - base; i < end_node - base; i++) {
+        int node = push_AstNode(ast, rest->kind[i], rest->token[i], rest->first_child[i], rest->child_count[i]);
+
+        if (ast->token[node] != AST_NO_TOKEN) {
+            ast->token[node] += token_delta;
+        }
+
+        if (ast->child_count[node] > 0) {
+            ast->first_child[node] += node_delta;
+        }
+    }
+}
+
+/// @brief Finds the old statement that starts at a token, if the tokens had moved by `token_delta`
+/// @return The index of the statement, or -1 if none starts there
+int statementStartingAt(StatementSpans *spans, int from, int token, int token_delta) {
+    int low = from;
+    int high = spans->len - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int first = spans->ref[mid].first_token + token_delta;
+
+        if (first == token) {
+            return mid;
+        }
+
+        if (first < token) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return -1;
+}
+
+/// @brief Frees what was lexed and parsed of an edit. After a syntax error the Ast is put back first,
+/// since parsing into it may have moved its arrays
+void abandonEdit(WatchState *watch) {
+    TokenList_free(&watch->lexing.program);
+
+    if (watch->parsing.ast.kind != NULL) {
+        watch->ast = watch->parsing.ast;
+    }
+
+    PendingNodes_free(&watch->parsing.pending);
+    watch->parsing = (Parsestate){0};
+
+    if (watch->detached.kind != NULL) {
+        nfree(watch->detached.kind);
+        nfree(watch->detached.token);
+        nfree(watch->detached.first_child);
+        nfree(watch->detached.child_count);
+        watch->detached = (Ast){0};
+    }
+
+    StatementSpans_free(&watch->new_spans);
+}
+
+/// @brief Parses the top-level statements touched by an edit again. The statements before them keep their nodes where they are,
+/// and the ones after them are copied behind the new nodes
+/// @param watch The watched file, whose tokens have already been relexed
+/// @param first The index of the first relexed token
+/// @param old_end One past the last old token that was replaced
+/// @param new_end One past the last new token
+void reparseEdit(WatchState *watch, int first, int old_end, int new_end) {
+    StatementSpans *spans = &watch->spans;
+    int token_delta = new_end - old_end;
+    int old_root = watch->ast.first_child[0];
+    int start = 0;
+    int i;
+
+    // Statements that end before the edit are kept as they are
+    while (start < spans->len && spans->ref[start].end_token < first) {
+        start++;
+    }
+
+    int kept_nodes = start < spans->len ? spans->ref[start].first_node : old_root;
+    Ast *rest = &watch->detached;
+    *rest = detachNodes(&watch->ast, kept_nodes);
+
+    Parsestate *state = &watch->parsing;
+
+    *state = (Parsestate){
+        .program = watch->program,
+        .loc = start < spans->len && spans->ref[start].first_token < first ? spans->ref[start].first_token : first,
+        .ast = watch->ast,
+        .pending = PendingNodes_new(PENDING_CAPACITY)
+    };
+
+    for (i = 0; i < start; i++) {
+        int node = old_root + i - kept_nodes;
+
+        pushPending(state, rest->kind[node], rest->token[node]);
+        state->pending.ref[i].first_child = rest->first_child[node];
+        state->pending.ref[i].child_count = rest->child_count[node];
+    }
+
+    StatementSpans old_spans = *spans;
+    StatementSpans *new_spans = &watch->new_spans;
+    *new_spans = StatementSpans_new(old_spans.len + 1);
+
+    if (start > 0) {
+        StatementSpans_append(new_spans, old_spans.ref, start);
+    }
+
+    // Parse until a statement starts where an old one after the edit did
+    int resume = -1;
+
+    while (currentToken(state)->token_type == Tk_Semicolon) {
+        state->loc++;
+    }
+
+    while (currentToken(state)->token_type != Tk_EOF) {
+        if (state->loc >= new_end) {
+            resume = statementStartingAt(&old_spans, start, state->loc, token_delta);
+
+            if (resume != -1) {
+                break;
+            }
+        }
+
+        parseTopLevelStatement(state, new_spans);
+    }
+
+    watch->reparsed_statements = new_spans->len - start;
+
+    // The statements after the edit keep their nodes, moved to follow the new ones
+    if (resume != -1) {
+        int node_delta = state->ast.len - old_spans.ref[resume].first_node;
+
+        copyStatementNodes(&state->ast, rest, kept_nodes, old_spans.ref[resume].first_node, old_root, token_delta);
+
+        for (i = resume; i < old_spans.len; i++) {
+            int node = old_root + i - kept_nodes;
+
+            pushPending(state, rest->kind[node], rest->token[node] + token_delta);
+
+            if (rest->child_count[node] > 0) {
+                state->pending.ref[state->pending.len - 1].first_child = rest->first_child[node] + node_delta;
+                state->pending.ref[state->pending.len - 1].child_count = rest->child_count[node];
+            }
+
+            StatementSpans_push(new_spans, (StatementSpan){
+                .first_token = old_spans.ref[i].first_token + token_delta,
+                .end_token = old_spans.ref[i].end_token + token_delta,
+                .first_node = old_spans.ref[i].first_node + node_delta,
+                .end_node = old_spans.ref[i].end_node + node_delta
+            });
+        }
+    }
+
+    placeRootChildren(state);
+    StatementSpans_free(spans);
+
+    watch->ast = state->ast;
+    watch->spans = *new_spans;
+    *new_spans = (StatementSpans){0};
+    abandonEdit(watch);
+}
+
+/// @brief Frees the tokens, Ast and spans of the watched file
+void freeWatchedProgram(WatchState *watch) {
+    TokenList_free(&watch->program);
+    StatementSpans_free(&watch->spans);
+
+    if (watch->ast.kind != NULL) {
+        nfree(watch->ast.kind);
+        nfree(watch->ast.token);
+        nfree(watch->ast.first_child);
+        nfree(watch->ast.child_count);
+        watch->ast = (Ast){0};
+    }
+}
+
+/// @brief Lexes and parses the whole watched file
+void reparseAll(WatchState *watch) {
+    watch->program = lexSource(watch->file);
+    watch->spans = (StatementSpans){0};
+    watch->ast = parse(watch->program, &watch->spans);
+
+    watch->relexed_tokens = watch->program.len;
+    watch->reparsed_statements = watch->spans.len;
+}
+
+/// @brief Reads the watched file into memory. Unlike `fileToAstr` the text is copied rather than mapped,
+/// so an editor truncating the file can't pull the old text away while it's being compared
+/// @return The text, or (Astr){} if the file can't be read (editors briefly remove it while saving)
+Astr readWatchedFile(char *path) {
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        return (Astr){};
+    }
+
+    Astr text = streamToAstr(fd);
+    close(fd);
+
+    return text;
+}
+
+/// @brief Brings the tokens and Ast up to date with the new text of the watched file.
+/// A syntax error leaves the file to be lexed and parsed from scratch after the next edit
+/// @param watch The watched file
+/// @param text The new text
+void applyEdit(WatchState *watch, Astr text) {
+    Astr old_text = sources.ref[watch->file].text;
+    jmp_buf recovery;
+
+    error_recovery = &recovery;
+
+    if (setjmp(recovery) != 0) {
+        abandonEdit(watch);
+        watch->valid = false;
+    } else if (watch->valid) {
+        int old_end;
+        int first = relexEdit(watch, text, &old_end);
+
+        reparseEdit(watch, first, old_end, first + watch->relexed_tokens);
+        watch->valid = true;
+    } else {
+        sources.ref[watch->file].text = text;
+        IntVec_free(&sources.ref[watch->file].line_starts);
+
+        freeWatchedProgram(watch);
+        reparseAll(watch);
+        watch->valid = true;
+    }
+
+    error_recovery = NULL;
+
+    if (old_text.len > 0 && old_text.str_ref != text.str_ref) {
+        nfree(old_text.str_ref);
+    }
+}
+
+/// @brief Waits for inotify to report that the watched file was written or replaced
+/// @param fd The inotify file descriptor, watching the file's directory
+/// @param name The file's name within its directory
+void waitForEdit(int fd, char *name) {
+    char buffer[WATCH_EVENT_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (true) {
+        int len = read(fd, buffer, sizeof(buffer));
+        int i = 0;
+
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+
+            printf("Lost the inotify watch\n");
+            exit(1);
+        }
+
+        while (i < len) {
+            struct inotify_event *event = (struct inotify_event*)(buffer + i);
+
+            if (event->len > 0 && streq(event->name, name)) {
+                return;
+            }
+
+            i += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+/// @brief Runs the watched program in a child process, so runtime errors and the interpreter's global state
+/// don't outlive the run. If the file is edited before the program finishes, the run is cut short
+/// @param watch The watched file
+/// @param run Runs the program
+/// @param fd The inotify file descriptor
+/// @param name The file's name within its directory
+/// @return Whether the file was edited during the run
+bool runWatched(WatchState *watch, WatchRunner run, int fd, char *name) {
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        run(&watch->ast, watch->program);
+        exit(0);
+    }
+
+    if (pid == -1) {
+        printf("Could not start the program\n");
+        return false;
+    }
+
+    // A pidfd lets the watcher wait for the program and the next edit at once. Without one, it waits for the program first
+    #ifdef SYS_pidfd_open
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+    #else
+    int pidfd = -1;
+    #endif
+    bool edited = false;
+
+    if (pidfd != -1) {
+        struct pollfd fds[2] = {
+            {.fd = pidfd, .events = POLLIN},
+            {.fd = fd, .events = POLLIN}
+        };
+
+        while (!edited) {
+            if (poll(fds, 2, -1) < 0) {
+                continue;
+            }
+
+            if (fds[0].revents) {
+                break;
+            }
+
+            if (fds[1].revents) {
+                waitForEdit(fd, name);
+                edited = true;
+                kill(pid, SIGKILL);
+            }
+        }
+
+        close(pidfd);
+    }
+
+    waitpid(pid, NULL, 0);
+
+    return edited;
+}
+
+/// @brief Runs a file, then runs it again every time it's saved. Edits are applied to the previous tokens and Ast,
+/// so the time between saving and running depends on the size of the edit rather than the size of the file
+/// @param path The file to watch
+/// @param run Runs the parsed program
+/// @return The exit code, if watching couldn't start
+int watchFile(char *path, WatchRunner run) {
+    // Editors often save by replacing the file, so its directory is watched rather than the file itself
+    char *slash = strrchr(path, '/');
+    char *name = slash == NULL ? path : slash + 1;
+    char *dir = slash == NULL ? nstrdup(".") : nstrndup(path, slash == path ? 1 : slash - path);
+
+    int fd = inotify_init1(IN_CLOEXEC);
+
+    if (fd == -1 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        printf("Could not watch %s\n", path);
+        return 1;
+    }
+
+    Astr text = readWatchedFile(path);
+
+    if (text.str_ref == NULL) {
+        printf("Error with opening file %s\n", path);
+        return 1;
+    }
+
+    WatchState watch = {
+        .path = path,
+        .file = addSourceFile(path, (Astr){.str_ref = "", .len = 0}),
+        .valid = false
+    };
+
+    applyEdit(&watch, text);
+
+    while (true) {
+        bool edited = false;
+
+        if (watch.valid) {
+            edited = runWatched(&watch, run, fd, name);
+        }
+
+        if (!edited) {
+            waitForEdit(fd, name);
+        }
+
+        text = readWatchedFile(path);
+
+        if (text.str_ref == NULL) {
+            continue;
+        }
+
+        double start = clockMs();
+        applyEdit(&watch, text);
+
+        if (watch.valid) {
+            fprintf(stderr, "watch: %s changed, lexed %d tokens and parsed %d statements again in %.2fms\n",
+                path, watch.relexed_tokens, watch.reparsed_statements, clockMs() - start);
+        }
+    }
+}
+
+#endif
@@ -1,8 +1,19 @@
 #include "include/util/astr.h"
 #include "include/util/list.h"
+#include "include/util/intern.h"
+#include "include/util/kernels.h"
+#include "include/util/io.h"
+#include "include/util/pool.h"
+#include "include/util/perf.h"
 #include "include/lexer.h"
 #include "include/parser.h"
 #include "include/interpreter.h"
+#include "include/module.h"
+#include "include/typecheck.h"
+#include "include/closure.h"
+#include "include/jit.h"
+#include "include/snapshot.h"
+#include "include/watch.h"
 
 // #define GDB_MODE
 #define GDB_DEBUG_FILENAME "hello.n"
@@ -10,7 +21,12 @@
 #define INTERPRET 0
 #define COMPILE 1
 
+#define ENGINE_TREE 0
+#define ENGINE_CLOSURE 1
+
 bool debug_logs;
+bool print_mem_stats;
+int engine = ENGINE_TREE;
 
 bool inArgv(char *argv[], int argc, char *str) {
     int i;
@@ -24,6 +40,124 @@ bool inArgv(char *argv[], int argc, char *str) {
     return false;
 }
 
+/// @brief Returns the argument after `str` in argv
+/// @return The argument after `str`, or NULL if `str` isn't there or is the last argument
+char *argAfter(char *argv[], int argc, char *str) {
+    int i;
+
+    for (i = 0; i < argc - 1; i++) {
+        if (streq(argv[i], str)) {
+            return argv[i + 1];
+        }
+    }
+
+    return NULL;
+}
+
+/// @brief Runs a type checked program with the selected engine
+/// @param ast The parsed program
+/// @param program The tokens the Ast refers to
+/// @param types What `typecheck` worked out about the program
+void runTypedProgram(Ast *ast, Program program, TypeInfo *types) {
+    setAllocPhase(Phase_Interpret);
+    setPerfPhase(Perf_Interpret);
+
+    if (engine == ENGINE_CLOSURE) {
+        runClosureEngine(ast, program, types);
+    } else {
+        interpretAst(ast, program, types);
+    }
+
+    finishIo();
+
+    if (print_mem_stats) {
+        printMemStats();
+    }
+}
+
+/// @brief Links in the modules a parsed program imports, type checks it and runs it with the selected engine
+/// @param ast The parsed program
+/// @param program The tokens the Ast refers to
+void runProgram(Ast *ast, Program program) {
+    setPerfPhase(Perf_Link);
+    program = linkImports(ast, program);
+
+    setAllocPhase(Phase_Check);
+    setPerfPhase(Perf_Check);
+    TypeInfo types = typecheck(ast, program);
+
+    runTypedProgram(ast, program, &types);
+
+    // Taking a snapshot ends the program, so reaching this means it never asked for one
+    if (snapshot_path != NULL) {
+        fprintf(stderr, "The program never called snapshot(), so no image was written to %s\n", snapshot_path);
+    }
+}
+
+/// @brief Reads a size more than 0 like `512`, `64K`, `16M` or `2G` in bytes
+/// @return The size, or -1 if it isn't one or doesn't fit in a long
+long parseSize(char *str) {
+    char *end;
+
+    errno = 0;
+    long size = strtol(str, &end, 10);
+    int shifts = 0;
+
+    switch (*end) {
+        case 'G': case 'g':
+            shifts++;
+            // falls through
+        case 'M': case 'm':
+            shifts++;
+            // falls through
+        case 'K': case 'k':
+            shifts++;
+            end++;
+    }
+
+    if (end == str || *end != '\0' || errno == ERANGE || size <= 0) {
+        return -1;
+    }
+
+    while (shifts-- > 0) {
+        if (size > LONG_MAX / 1024) {
+            return -1;
+        }
+
+        size *= 1024;
+    }
+
+    return size;
+}
+
+/// @brief Reads a whole number from 1 to `max`
+/// @return The number, or -1 if it isn't one or is out of range
+long parseCount(char *str, long max) {
+    char *end;
+
+    errno = 0;
+    long count = strtol(str, &end, 10);
+
+    if (end == str || *end != '\0' || errno == ERANGE || count < 1 || count > max) {
+        return -1;
+    }
+
+    return count;
+}
+
+/// @brief Reads a number of seconds more than 0, like `2` or `0.5`
+/// @return The seconds, or -1 if it isn't one
+double parseSeconds(char *str) {
+    char *end;
+    double seconds = strtod(str, &end);
+
+    if (end == str || *end != '\0' || !isfinite(seconds) || seconds <= 0) {
+        return -1;
+    }
+
+    return seconds;
+}
+
 int main(int argc, char *argv[]) {
     #ifndef GDB_MODE
     if (argc <= 1) {
@@ -32,7 +166,28 @@ int main(int argc, char *argv[]) {
     }
 
     if (streq(argv[1], "-help")) {
-        printf("TODO: Write help\n");
+        printf("Usage: nitrogen FILE [options]\n");
+        printf("       nitrogen -restore IMAGE [options]\n");
+        printf("Use - as the FILE to read the program from stdin\n\n");
+        printf("  -c [TYPE]         Compile instead of interpreting (not yet supported)\n");
+        printf("  -d, -debug, -log  Print the lexed tokens\n");
+        printf("  --no-parse        Stop after lexing\n");
+        printf("  -engine ENGINE    Execution engine: `tree` (default) or `closure`\n");
+        printf("  -no-jit           Never compile hot statements to machine code\n");
+        printf("  -jit-dump         Print the machine code of every compiled statement\n");
+        printf("  -trace-alloc      Print where memory was allocated (and leaked) when the program ends\n");
+        printf("  -mem-stats        Print runtime memory statistics when the program ends\n");
+        printf("  -perf             Print CPU counters (cycles, instructions, cache misses...) for each phase when the program ends\n");
+        printf("  -watch            Run the program again every time the file is saved\n");
+        printf("  -threads N        Threads the parallel builtins run on (default: one per core, at most %d)\n", POOL_MAX_WORKERS);
+        printf("  -max-steps N      Stop the program after N steps (exit code %d)\n", EXIT_STEP_LIMIT);
+        printf("  -max-memory SIZE  Stop the program if it needs more than SIZE bytes, like 64M (exit code %d)\n", EXIT_MEMORY_LIMIT);
+        printf("  -timeout SECONDS  Stop the program after SECONDS (exit code %d)\n", EXIT_TIMEOUT);
+        printf("  -snapshot IMAGE   Write the program's state to IMAGE when it calls snapshot(), then stop\n");
+        printf("  -restore IMAGE    Continue the program in IMAGE from where its snapshot was taken\n");
+        printf("  -usage            Print the steps, memory and time the program used when it ends\n");
+        printf("  -jit-threshold N  Executions before a statement gets compiled (default %d)\n", JIT_THRESHOLD);
+        printf("  -max-depth N      Most nested function calls before a stack overflow (default %d)\n", MAX_CALL_DEPTH);
         return 0;
     }
 
@@ -52,7 +207,111 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    char *engine_name = argAfter(argv, argc, "-engine");
+
+    if (engine_name != NULL) {
+        if (streq(engine_name, "closure")) {
+            engine = ENGINE_CLOSURE;
+        } else if (!streq(engine_name, "tree")) {
+            printf("Unknown engine %s\n", engine_name);
+            return 1;
+        }
+    }
+
+    jit_options.enabled = !inArgv(argv, argc, "-no-jit");
+    jit_options.dump = inArgv(argv, argc, "-jit-dump");
+
+    if (argAfter(argv, argc, "-jit-threshold") != NULL) {
+        jit_options.threshold = parseCount(argAfter(argv, argc, "-jit-threshold"), INT_MAX);
+
+        if (jit_options.threshold < 0) {
+            printf("Invalid JIT threshold %s, it has to be from 1 to %d\n", argAfter(argv, argc, "-jit-threshold"), INT_MAX);
+            return 1;
+        }
+    }
+
+    if (argAfter(argv, argc, "-max-depth") != NULL) {
+        max_call_depth = parseCount(argAfter(argv, argc, "-max-depth"), MAX_CALL_DEPTH_LIMIT);
+
+        if (max_call_depth < 0) {
+            printf("Invalid call depth %s, it has to be from 1 to %d\n", argAfter(argv, argc, "-max-depth"), MAX_CALL_DEPTH_LIMIT);
+            return 1;
+        }
+    }
+
+    if (argAfter(argv, argc, "-threads") != NULL) {
+        pool_workers = parseCount(argAfter(argv, argc, "-threads"), POOL_MAX_WORKERS);
+
+        if (pool_workers < 0) {
+            printf("Invalid number of threads %s, it has to be from 1 to %d\n", argAfter(argv, argc, "-threads"), POOL_MAX_WORKERS);
+            return 1;
+        }
+    }
+
+    if (argAfter(argv, argc, "-max-steps") != NULL) {
+        quotas.max_steps = parseCount(argAfter(argv, argc, "-max-steps"), LONG_MAX);
+
+        if (quotas.max_steps < 0) {
+            printf("Invalid step limit %s, it has to be at least 1\n", argAfter(argv, argc, "-max-steps"));
+            return 1;
+        }
+    }
+
+    if (argAfter(argv, argc, "-max-memory") != NULL) {
+        quotas.max_memory = parseSize(argAfter(argv, argc, "-max-memory"));
+
+        if (quotas.max_memory < 0) {
+            printf("Invalid memory limit %s, it has to be a size more than 0\n", argAfter(argv, argc, "-max-memory"));
+            return 1;
+        }
+    }
+
+    if (argAfter(argv, argc, "-timeout") != NULL) {
+        quotas.timeout = parseSeconds(argAfter(argv, argc, "-timeout"));
+
+        if (quotas.timeout < 0) {
+            printf("Invalid timeout %s, it has to be a number of seconds more than 0\n", argAfter(argv, argc, "-timeout"));
+            return 1;
+        }
+    }
+
+    if (inArgv(argv, argc, "-usage")) {
+        atexit(printUsage);
+    }
+
     debug_logs = inArgv(argv, argc, "-d") || inArgv(argv, argc, "-debug") || inArgv(argv, argc, "-log");
+    print_mem_stats = inArgv(argv, argc, "-mem-stats");
+
+    snapshot_path = argAfter(argv, argc, "-snapshot");
+
+    if (inArgv(argv, argc, "-perf")) {
+        startPerfCounters();
+    }
+
+    char *restore_path = argAfter(argv, argc, "-restore");
+
+    if (restore_path != NULL) {
+        RestoredProgram restored;
+
+        setPerfPhase(Perf_Read);
+
+        if (!restoreSnapshot(restore_path, &restored)) {
+            printf("Could not restore %s, it isn't an image written by this build of nitrogen\n", restore_path);
+            return 1;
+        }
+
+        runTypedProgram(&restored.ast, restored.program, &restored.types);
+        return 0;
+    }
+
+    if (inArgv(argv, argc, "-watch")) {
+        if (streq(filename, "-")) {
+            printf("Can't watch stdin\n");
+            return 1;
+        }
+
+        return watchFile(filename, runProgram);
+    }
 
     #endif
 
@@ -60,14 +319,26 @@ int main(int argc, char *argv[]) {
     char *filename = GDB_DEBUG_FILENAME;
     #endif
 
+    if (inArgv(argv, argc, "-trace-alloc")) {
+        startAllocTracing();
+    }
+
+    setPerfPhase(Perf_Read);
     Astr file = fileToAstr(filename);
 
-    if (Astreq(file, (Astr){})) {
+    if (file.str_ref == NULL) {
         printf("Error with opening file %s\n", filename);
         return 1;
     }
 
+    if (streq(filename, "-")) {
+        filename = "<stdin>";
+    }
+
+    setAllocPhase(Phase_Lex);
+    setPerfPhase(Perf_Lex);
     Program _program = lex(file, filename);
+    setAllocPhase(Phase_Other);
 
     int i = 0;
 
@@ -78,7 +349,7 @@ int main(int argc, char *argv[]) {
             printf("tk: %s\n", TokenTypeRepr(tk->token_type));
 
             if (tk->token_type == Tk_ID) {
-                printf("    id: %s\n", (char*)tk->values);
+                printf("    id: %s\n", internedStr(tk->value));
             }
         }
     }
@@ -87,13 +358,15 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    AstNode* _ast = parse(_program);
+    setAllocPhase(Phase_Parse);
+    setPerfPhase(Perf_Parse);
+    Ast _ast = parse(_program, NULL);
 
     #ifndef GDB_MODE
     if (run_type == COMPILE) { // compiling
         printf("Compilation is not yet supported\n");
     } else if (run_type == INTERPRET) {
-        interpretAst(_ast);
+        runProgram(&_ast, _program);
     } else {
         printf("Invalid run type %d\n", run_type);
         return 1;
@@ -101,7 +374,7 @@ int main(int argc, char *argv[]) {
     #endif
 
     #ifdef GDB_MODE
-    interpretAst(_ast);
+    runProgram(&_ast, _program);
     #endif
 
     return 0;
@@ -0,0 +1,347 @@
+#include "../src/include/util/astr.h"
+#include "../src/include/util/kernels.h"
+
+// Checks the SSE2 and AVX2 kernels in astr.h and kernels.h, and the functions that dispatch to them,
+// against their scalar reference versions. Every input is copied into a buffer of exactly its size,
+// at every start offset within a vector, so the lengths around the vector width, unaligned loads and the
+// scalar tails all get run (and reads past the end show up under -fsanitize=address).
+// Run with `make test`; the AVX2 versions are skipped on CPUs that don't have it.
+
+#define MAX_LEN 100
+#define MAX_OFFSET 32
+
+int failures = 0;
+bool has_avx2 = false;
+
+#define check(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            if (failures++ < 20) { \
+                printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+                printf(__VA_ARGS__); \
+                printf("\n"); \
+            } \
+        } \
+    } while (0)
+
+/// @brief Returns a buffer holding a copy of `len` bytes of `src`, starting `offset` bytes into its allocation
+char *placeBytes(const char *src, int len, int offset, char **block) {
+    *block = malloc(offset + len + 1);
+    memcpy(*block + offset, src, len);
+
+    return *block + offset;
+}
+
+/// @brief Returns a copy of `n` ints of `src` starting `offset` ints into its allocation
+int *placeInts(const int *src, int n, int offset, int **block) {
+    *block = malloc((offset + n + 1) * sizeof(int));
+    memcpy(*block + offset, src, n * sizeof(int));
+
+    return *block + offset;
+}
+
+/// @brief Returns a copy of `n` floats of `src` starting `offset` floats into its allocation
+double *placeFloats(const double *src, int n, int offset, double **block) {
+    *block = malloc((offset + n + 1) * sizeof(double));
+    memcpy(*block + offset, src, n * sizeof(double));
+
+    return *block + offset;
+}
+
+/// @brief Fills `len` bytes with random picks from `alphabet`
+void randomBytes(char *dst, int len, const char *alphabet, int alphabet_len) {
+    int i;
+
+    for (i = 0; i < len; i++) {
+        dst[i] = alphabet[rand() % alphabet_len];
+    }
+}
+
+int randomInt() {
+    switch (rand() % 8) {
+        case 0: return INT_MIN;
+        case 1: return INT_MAX;
+        case 2: return -1;
+        default: return (int)(((unsigned int)rand() << 16) ^ (unsigned int)rand());
+    }
+}
+
+double randomFloat() {
+    return (rand() % 2000001 - 1000000) / 1000.0;
+}
+
+void testBytesEqual() {
+    char a[MAX_LEN], b[MAX_LEN];
+    int len, offset, diff;
+
+    for (len = 0; len <= MAX_LEN; len++) {
+        for (offset = 0; offset < MAX_OFFSET; offset++) {
+            // diff == len leaves the two equal
+            for (diff = 0; diff <= len; diff++) {
+                char *block_a, *block_b;
+
+                randomBytes(a, len, "ab\x80\xff", 4);
+                memcpy(b, a, len);
+
+                if (diff < len) {
+                    b[diff] ^= (char)0x81;
+                }
+
+                char *pa = placeBytes(a, len, offset, &block_a);
+                char *pb = placeBytes(b, len, (offset * 7) % MAX_OFFSET, &block_b);
+                bool expected = bytesEqualScalar(pa, pb, len);
+
+                check(bytesEqualSse2(pa, pb, len) == expected, "bytesEqualSse2 len %d offset %d diff %d", len, offset, diff);
+                check(!has_avx2 || bytesEqualAvx2(pa, pb, len) == expected, "bytesEqualAvx2 len %d offset %d diff %d", len, offset, diff);
+                check(bytesEqual(pa, pb, len) == expected, "bytesEqual len %d offset %d diff %d", len, offset, diff);
+
+                free(block_a);
+                free(block_b);
+            }
+        }
+    }
+}
+
+void testBytesDigits() {
+    // The bytes on either side of '0'..'9' and '-', and ones with the top bit set
+    const char *wrong = "/:,.\x80\xb0\xb9\xff";
+    char str[MAX_LEN];
+    int len, offset, bad;
+
+    for (len = 0; len <= MAX_LEN; len++) {
+        for (offset = 0; offset < MAX_OFFSET; offset++) {
+            for (bad = 0; bad <= len; bad++) {
+                char *block;
+
+                randomBytes(str, len, "0123456789-", 11);
+
+                if (bad < len) {
+                    str[bad] = wrong[rand() % 8];
+                }
+
+                char *p = placeBytes(str, len, offset, &block);
+                bool expected = bytesDigitsScalar(p, len);
+
+                check(bytesDigitsSse2(p, len) == expected, "bytesDigitsSse2 len %d offset %d bad %d", len, offset, bad);
+                check(!has_avx2 || bytesDigitsAvx2(p, len) == expected, "bytesDigitsAvx2 len %d offset %d bad %d", len, offset, bad);
+                check(bytesDigits(p, len) == expected, "bytesDigits len %d offset %d bad %d", len, offset, bad);
+
+                free(block);
+            }
+        }
+    }
+}
+
+void testFindByte() {
+    char str[MAX_LEN];
+    int len, offset, at;
+
+    for (len = 0; len <= MAX_LEN; len++) {
+        for (offset = 0; offset < MAX_OFFSET; offset++) {
+            // at == len leaves the byte out
+            for (at = 0; at <= len; at++) {
+                char *block;
+                char c = rand() % 2 ? 'x' : '\xf0';
+
+                randomBytes(str, len, "ab\x80\xef", 4);
+
+                if (at < len) {
+                    str[at] = c;
+                    // Sometimes a second one further on, which mustn't be the one found
+                    if (at + 1 < len && rand() % 2) {
+                        str[at + 1 + rand() % (len - at - 1)] = c;
+                    }
+                }
+
+                char *p = placeBytes(str, len, offset, &block);
+                int expected = findByteScalar(p, len, c);
+
+                check(findByteSse2(p, len, c) == expected, "findByteSse2 len %d offset %d at %d", len, offset, at);
+                check(!has_avx2 || findByteAvx2(p, len, c) == expected, "findByteAvx2 len %d offset %d at %d", len, offset, at);
+                check(findByte(p, len, c) == expected, "findByte len %d offset %d at %d", len, offset, at);
+
+                free(block);
+            }
+        }
+    }
+}
+
+void testFindBytes() {
+    char haystack[MAX_LEN], needle[MAX_LEN];
+    int len, offset, needle_len, round;
+
+    for (len = 0; len <= MAX_LEN; len++) {
+        for (needle_len = 0; needle_len <= len + 1 && needle_len <= 40; needle_len++) {
+            for (offset = 0; offset < MAX_OFFSET; offset++) {
+                for (round = 0; round < 4; round++) {
+                    char *block;
+
+                    // A small alphabet so partial matches, where only the first and last bytes agree, are common
+                    randomBytes(haystack, len, "ab", 2);
+
+                    if (round % 2 == 0 && needle_len <= len) {
+                        memcpy(needle, haystack + rand() % (len - needle_len + 1), needle_len);
+                    } else {
+                        randomBytes(needle, needle_len, "ab", 2);
+                    }
+
+                    char *p = placeBytes(haystack, len, offset, &block);
+                    // The scalar version needs a needle, an empty one is found at 0
+                    int expected = needle_len == 0 ? 0 : findBytesScalar(p, len, needle, needle_len);
+
+                    if (needle_len >= 2) {
+                        check(findBytesSse2(p, len, needle, needle_len) == expected, "findBytesSse2 len %d needle %d offset %d", len, needle_len, offset);
+                        check(!has_avx2 || findBytesAvx2(p, len, needle, needle_len) == expected, "findBytesAvx2 len %d needle %d offset %d", len, needle_len, offset);
+                    }
+
+                    check(findBytes(p, len, needle, needle_len) == expected, "findBytes len %d needle %d offset %d", len, needle_len, offset);
+
+                    free(block);
+                }
+            }
+        }
+    }
+}
+
+// The AVX2 versions are only run on at least one whole vector, like `dispatchKernel` does
+
+/// @brief Checks an int kernel that writes `n` ints against its scalar version
+#define checkIntsOut(name, ...) \
+    do { \
+        int expected[MAX_LEN], got[MAX_LEN]; \
+        name##Scalar(expected, __VA_ARGS__); \
+        if (has_avx2 && n >= 8) { \
+            name##Avx2(got, __VA_ARGS__); \
+            check(memcmp(got, expected, n * sizeof(int)) == 0, #name "Avx2 n %d offset %d", n, offset); \
+        } \
+        name(got, __VA_ARGS__); \
+        check(memcmp(got, expected, n * sizeof(int)) == 0, #name " n %d offset %d", n, offset); \
+    } while (0)
+
+/// @brief Checks an int kernel that returns an int against its scalar version
+#define checkIntsResult(name, ...) \
+    do { \
+        int expected = name##Scalar(__VA_ARGS__); \
+        check(!has_avx2 || n < 8 || name##Avx2(__VA_ARGS__) == expected, #name "Avx2 n %d offset %d", n, offset); \
+        check(name(__VA_ARGS__) == expected, #name " n %d offset %d", n, offset); \
+    } while (0)
+
+void testInts() {
+    int a[MAX_LEN], b[MAX_LEN];
+    int n, offset, i;
+
+    for (n = 1; n <= MAX_LEN; n++) {
+        for (offset = 0; offset < 8; offset++) {
+            int *block_a, *block_b;
+            int x = randomInt();
+
+            for (i = 0; i < n; i++) {
+                a[i] = randomInt();
+                b[i] = randomInt();
+            }
+
+            // The smallest or largest at the very end, in the scalar tail
+            if (n % 3 == 0) {
+                a[n - 1] = n % 2 ? INT_MIN : INT_MAX;
+            }
+
+            int *pa = placeInts(a, n, offset, &block_a);
+            int *pb = placeInts(b, n, (offset + 3) % 8, &block_b);
+
+            checkIntsOut(fillInts, n, x);
+            checkIntsResult(sumInts, pa, n);
+            checkIntsResult(minInts, pa, n);
+            checkIntsResult(maxInts, pa, n);
+            checkIntsResult(dotInts, pa, pb, n);
+            checkIntsOut(addInts, pa, pb, n);
+            checkIntsOut(mulInts, pa, pb, n);
+
+            free(block_a);
+            free(block_b);
+        }
+    }
+}
+
+/// @brief Checks a float kernel that writes `n` floats against its scalar version, which has to give the exact same values
+#define checkFloatsOut(name, ...) \
+    do { \
+        double expected[MAX_LEN], got[MAX_LEN]; \
+        name##Scalar(expected, __VA_ARGS__); \
+        if (has_avx2 && n >= 4) { \
+            name##Avx2(got, __VA_ARGS__); \
+            check(memcmp(got, expected, n * sizeof(double)) == 0, #name "Avx2 n %d offset %d", n, offset); \
+        } \
+        name(got, __VA_ARGS__); \
+        check(memcmp(got, expected, n * sizeof(double)) == 0, #name " n %d offset %d", n, offset); \
+    } while (0)
+
+/// @brief Checks a float kernel that returns a float against its scalar version, within `tolerance`
+#define checkFloatsResult(name, tolerance, ...) \
+    do { \
+        double expected = name##Scalar(__VA_ARGS__); \
+        check(!has_avx2 || n < 4 || fabs(name##Avx2(__VA_ARGS__) - expected) <= (tolerance), #name "Avx2 n %d offset %d", n, offset); \
+        check(fabs(name(__VA_ARGS__) - expected) <= (tolerance), #name " n %d offset %d", n, offset); \
+    } while (0)
+
+void testFloats() {
+    double a[MAX_LEN], b[MAX_LEN];
+    int n, offset, i;
+
+    for (n = 1; n <= MAX_LEN; n++) {
+        for (offset = 0; offset < 4; offset++) {
+            double *block_a, *block_b;
+            double x = randomFloat();
+            double abs_sum = 0, abs_dot = 0;
+
+            for (i = 0; i < n; i++) {
+                a[i] = randomFloat();
+                b[i] = randomFloat();
+                abs_sum += fabs(a[i]);
+                abs_dot += fabs(a[i] * b[i]);
+            }
+
+            if (n % 3 == 0) {
+                a[n - 1] = n % 2 ? -1e9 : 1e9;
+                abs_sum += 1e9;
+                abs_dot += fabs(a[n - 1] * b[n - 1]);
+            }
+
+            double *pa = placeFloats(a, n, offset, &block_a);
+            double *pb = placeFloats(b, n, (offset + 1) % 4, &block_b);
+
+            // Sums are added in a different order, so they only have to agree to within the rounding of each addition
+            checkFloatsOut(fillFloats, n, x);
+            checkFloatsResult(sumFloats, abs_sum * n * 1e-15, pa, n);
+            checkFloatsResult(minFloats, 0, pa, n);
+            checkFloatsResult(maxFloats, 0, pa, n);
+            checkFloatsResult(dotFloats, abs_dot * n * 1e-15, pa, pb, n);
+            checkFloatsOut(addFloats, pa, pb, n);
+            checkFloatsOut(mulFloats, pa, pb, n);
+
+            free(block_a);
+            free(block_b);
+        }
+    }
+}
+
+int main() {
+    srand(1);
+    has_avx2 = astrSimdLevel() == ASTR_SIMD_AVX2;
+
+    printf("Testing the SSE2%s kernels against the scalar ones\n", has_avx2 ? " and AVX2" : "");
+
+    testBytesEqual();
+    testBytesDigits();
+    testFindByte();
+    testFindBytes();
+    testInts();
+    testFloats();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("All checks passed\n");
+    return 0;
+}
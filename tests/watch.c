@@ -0,0 +1,139 @@
+#include "../src/include/util/astr.h"
+#include "../src/include/util/list.h"
+#include "../src/include/util/intern.h"
+#include "../src/include/util/kernels.h"
+#include "../src/include/util/io.h"
+#include "../src/include/util/pool.h"
+#include "../src/include/util/perf.h"
+#include "../src/include/lexer.h"
+#include "../src/include/parser.h"
+#include "../src/include/interpreter.h"
+#include "../src/include/module.h"
+#include "../src/include/typecheck.h"
+#include "../src/include/closure.h"
+#include "../src/include/jit.h"
+#include "../src/include/snapshot.h"
+#include "../src/include/watch.h"
+
+// Applies a series of edits to a watched file the way `-watch` does, without inotify or running anything,
+// and checks that after each one the tokens and Ast are the same as lexing and parsing the text from scratch.
+// Run with `make test`, preferably also built with -fsanitize=address.
+
+int failures = 0;
+
+#define check(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            if (failures++ < 20) { \
+                printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+                printf(__VA_ARGS__); \
+                printf("\n"); \
+            } \
+        } \
+    } while (0)
+
+/// @brief Returns whether two subtrees have the same kinds and tokens, wherever their nodes are stored
+bool sameTree(Ast *a, int node_a, Ast *b, int node_b) {
+    int i;
+
+    if (a->kind[node_a] != b->kind[node_b] || a->token[node_a] != b->token[node_b]
+        || a->child_count[node_a] != b->child_count[node_b]) {
+        return false;
+    }
+
+    for (i = 0; i < a->child_count[node_a]; i++) {
+        if (!sameTree(a, a->first_child[node_a] + i, b, b->first_child[node_b] + i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// @brief Returns `count` numbered statements, followed by `tail`
+char *numberedStatements(int count, char *tail) {
+    char *text = nmalloc(count * 32 + strlen(tail) + 1);
+    int len = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        len += sprintf(text + len, "int v%d = %d;\n", i, i);
+    }
+
+    strcpy(text + len, tail);
+
+    return text;
+}
+
+/// @brief Saves `text` as the watched file's new contents and checks the result against a fresh parse
+void applyText(WatchState *watch, char *text, bool valid, char *step) {
+    applyEdit(watch, (Astr){.str_ref = text, .len = strlen(text)});
+
+    check(watch->valid == valid, "%s: valid is %d", step, watch->valid);
+
+    if (!valid || !watch->valid) {
+        return;
+    }
+
+    int file = addSourceFile("expected.n", (Astr){.str_ref = text, .len = strlen(text)});
+    Program expected_program = lexSource(file);
+    Ast expected = parse(expected_program, NULL);
+    int i;
+
+    check(watch->program.len == expected_program.len, "%s: %d tokens, expected %d", step, watch->program.len, expected_program.len);
+
+    for (i = 0; i < watch->program.len && i < expected_program.len; i++) {
+        check(watch->program.ref[i].token_type == expected_program.ref[i].token_type
+            && watch->program.ref[i].offset == expected_program.ref[i].offset, "%s: token %d differs", step, i);
+    }
+
+    check(sameTree(&watch->ast, 0, &expected, 0), "%s: the Ast differs", step);
+
+    TokenList_free(&expected_program);
+    nfree(expected.kind);
+    nfree(expected.token);
+    nfree(expected.first_child);
+    nfree(expected.child_count);
+}
+
+void testSyntaxErrorThenFix() {
+    WatchState watch = {
+        .path = "watched.n",
+        .file = addSourceFile("watched.n", (Astr){.str_ref = "", .len = 0}),
+        .valid = false
+    };
+
+    applyText(&watch, nstrdup("int a = 1;\nprint(a);\n"), true, "first version");
+
+    // Big enough that parsing it moves the Ast's arrays before the error is found
+    applyText(&watch, numberedStatements(200, "print(a +);\n"), false, "syntax error after 200 statements");
+    applyText(&watch, nstrdup("int a = 2;\nprint(a);\n"), true, "fixed");
+    applyText(&watch, numberedStatements(200, "print(v1);\n"), true, "200 statements");
+
+    // The same, with the error in the middle so statements after it are kept from before
+    applyText(&watch, numberedStatements(100, "print(v1 +);\nprint(v2);\nprint(v3);\n"), false, "syntax error in the middle");
+    applyText(&watch, numberedStatements(100, "print(v1);\nprint(v2);\nprint(v3);\n"), true, "fixed in the middle");
+    applyText(&watch, numberedStatements(100, "print(v1);\nprint(v2 + 1);\nprint(v3);\n"), true, "edited in the middle");
+
+    // An error the lexer finds, rather than the parser
+    applyText(&watch, numberedStatements(100, "print(\"v1);\n"), false, "unclosed string");
+    applyText(&watch, numberedStatements(100, "print(\"v1\");\n"), true, "closed string");
+
+    freeWatchedProgram(&watch);
+    nfree(sources.ref[watch.file].text.str_ref);
+    sources.ref[watch.file].text = (Astr){0};
+}
+
+int main() {
+    printf("Testing incremental reparsing in watch mode\n");
+
+    testSyntaxErrorThenFix();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("All checks passed\n");
+    return 0;
+}